@@ -0,0 +1,267 @@
+#include "avltree.h"
+#include <stdlib.h>
+
+#define AVL_HEIGHT(node)    ((node) ? (node)->height : 0)
+
+static inline avltree_node_t *
+avl_lower_address(avltree_node_t *node1, avltree_node_t *node2){
+
+    if(!node1) return node2;
+    if(!node2) return node1;
+    return (node1 < node2) ? node1 : node2;
+}
+
+/*recompute height and lowest addressed node from the children*/
+static inline void
+avl_update(avltree_node_t *node){
+
+    int left_height = AVL_HEIGHT(node->left);
+    int right_height = AVL_HEIGHT(node->right);
+
+    node->height = 1 + (left_height > right_height ? left_height : right_height);
+    node->lowest = node;
+    if(node->left)
+        node->lowest = avl_lower_address(node->lowest, node->left->lowest);
+    if(node->right)
+        node->lowest = avl_lower_address(node->lowest, node->right->lowest);
+}
+
+static avltree_node_t *
+avl_rotate_right(avltree_node_t *node){
+
+    avltree_node_t *left = node->left;
+
+    node->left = left->right;
+    left->right = node;
+    avl_update(node);
+    avl_update(left);
+    return left;
+}
+
+static avltree_node_t *
+avl_rotate_left(avltree_node_t *node){
+
+    avltree_node_t *right = node->right;
+
+    node->right = right->left;
+    right->left = node;
+    avl_update(node);
+    avl_update(right);
+    return right;
+}
+
+/*fixes the subtree rooted at node after one insertion or removal below it,
+ * returns the new root of the subtree*/
+static avltree_node_t *
+avl_rebalance(avltree_node_t *node){
+
+    avl_update(node);
+
+    int balance = AVL_HEIGHT(node->left) - AVL_HEIGHT(node->right);
+
+    if(balance > 1){
+        if(AVL_HEIGHT(node->left->left) < AVL_HEIGHT(node->left->right))
+            node->left = avl_rotate_left(node->left);
+        return avl_rotate_right(node);
+    }
+
+    if(balance < -1){
+        if(AVL_HEIGHT(node->right->right) < AVL_HEIGHT(node->right->left))
+            node->right = avl_rotate_right(node->right);
+        return avl_rotate_left(node);
+    }
+
+    return node;
+}
+
+/*total order of the nodes, ties of comp_fn are broken by node address*/
+static inline int
+avl_compare(avltree_t *tree, avltree_node_t *node1, avltree_node_t *node2){
+
+    int rc = tree->comp_fn(
+            AVLTREE_GET_USER_DATA_FROM_OFFSET(node1, tree->offset),
+            AVLTREE_GET_USER_DATA_FROM_OFFSET(node2, tree->offset));
+
+    if(rc)
+        return rc;
+    if(node1 < node2)
+        return -1;
+    if(node1 > node2)
+        return 1;
+    return 0;
+}
+
+static avltree_node_t *
+avl_insert(avltree_t *tree, avltree_node_t *root, avltree_node_t *node){
+
+    if(!root)
+        return node;
+
+    if(avl_compare(tree, node, root) < 0)
+        root->left = avl_insert(tree, root->left, node);
+    else
+        root->right = avl_insert(tree, root->right, node);
+
+    return avl_rebalance(root);
+}
+
+/*detach the smallest node of the subtree, returns the new subtree root*/
+static avltree_node_t *
+avl_remove_min(avltree_node_t *root, avltree_node_t **min_node){
+
+    if(!root->left){
+        *min_node = root;
+        return root->right;
+    }
+
+    root->left = avl_remove_min(root->left, min_node);
+    return avl_rebalance(root);
+}
+
+static avltree_node_t *
+avl_remove(avltree_t *tree, avltree_node_t *root, avltree_node_t *node){
+
+    avltree_node_t *min_node = NULL;
+
+    if(!root)
+        return NULL;
+
+    int rc = avl_compare(tree, node, root);
+
+    if(rc < 0){
+        root->left = avl_remove(tree, root->left, node);
+        return avl_rebalance(root);
+    }
+
+    if(rc > 0){
+        root->right = avl_remove(tree, root->right, node);
+        return avl_rebalance(root);
+    }
+
+    /*root is the node being removed*/
+    if(!root->right)
+        return root->left;
+
+    if(!root->left)
+        return root->right;
+
+    /*replace by its in order successor*/
+    avltree_node_t *right = avl_remove_min(root->right, &min_node);
+    min_node->left = root->left;
+    min_node->right = right;
+    return avl_rebalance(min_node);
+}
+
+void
+avltree_init(avltree_t *tree,
+             int (*comp_fn)(void *, void *),
+             int offset){
+
+    tree->root = NULL;
+    tree->comp_fn = comp_fn;
+    tree->offset = offset;
+    tree->count = 0;
+}
+
+void
+init_avltree_node(avltree_node_t *node){
+
+    node->left = NULL;
+    node->right = NULL;
+    node->lowest = NULL;
+    node->height = 0;
+}
+
+void
+avltree_insert(avltree_t *tree, avltree_node_t *node){
+
+    node->left = NULL;
+    node->right = NULL;
+    node->lowest = node;
+    node->height = 1;
+
+    tree->root = avl_insert(tree, tree->root, node);
+    tree->count++;
+}
+
+void
+avltree_remove(avltree_t *tree, avltree_node_t *node){
+
+    if(!AVLTREE_IS_NODE_IN_TREE(node))
+        return;
+
+    tree->root = avl_remove(tree, tree->root, node);
+    tree->count--;
+    init_avltree_node(node);
+}
+
+avltree_node_t *
+avltree_max(avltree_t *tree){
+
+    avltree_node_t *node = tree->root;
+
+    if(!node)
+        return NULL;
+
+    while(node->right)
+        node = node->right;
+    return node;
+}
+
+avltree_node_t *
+avltree_min(avltree_t *tree){
+
+    avltree_node_t *node = tree->root;
+
+    if(!node)
+        return NULL;
+
+    while(node->left)
+        node = node->left;
+    return node;
+}
+
+avltree_node_t *
+avltree_lower_bound(avltree_t *tree,
+                    void *key,
+                    int (*key_comp_fn)(void *, void *)){
+
+    avltree_node_t *node = tree->root,
+                   *result = NULL;
+
+    while(node){
+
+        if(key_comp_fn(AVLTREE_GET_USER_DATA_FROM_OFFSET(node, tree->offset),
+                    key) < 0){
+            node = node->right;
+            continue;
+        }
+        result = node;
+        node = node->left;
+    }
+    return result;
+}
+
+avltree_node_t *
+avltree_lowest_address_lower_bound(avltree_t *tree,
+                                   void *key,
+                                   int (*key_comp_fn)(void *, void *)){
+
+    avltree_node_t *node = tree->root,
+                   *result = NULL;
+
+    while(node){
+
+        if(key_comp_fn(AVLTREE_GET_USER_DATA_FROM_OFFSET(node, tree->offset),
+                    key) < 0){
+            node = node->right;
+            continue;
+        }
+        /*node and its whole right subtree are not less than the key*/
+        result = avl_lower_address(result, node);
+        if(node->right)
+            result = avl_lower_address(result, node->right->lowest);
+        node = node->left;
+    }
+    return result;
+}
@@ -0,0 +1,79 @@
+#ifndef __AVLTREE__
+#define __AVLTREE__
+
+/* Intrusive AVL tree. Like glthread_t, the node is embedded in the
+ * user structure and the user structure is recovered from the node
+ * using its offset. Nodes which compare equal are ordered by their
+ * address so every node has a unique position in the tree.
+ * Every node also caches the lowest addressed node of its subtree so
+ * that "lowest address among nodes >= key" queries are O(log n)*/
+
+typedef struct _avltree_node{
+
+    struct _avltree_node *left;
+    struct _avltree_node *right;
+    struct _avltree_node *lowest;   /*lowest addressed node in this subtree*/
+    int height;                     /*0 when the node is not in a tree*/
+} avltree_node_t;
+
+typedef struct _avltree{
+
+    avltree_node_t *root;
+    /*returns -1 if first user data orders before the second one,
+     * 1 if after and 0 if they are equal*/
+    int (*comp_fn)(void *, void *);
+    int offset;                     /*offset of the node in user structure*/
+    unsigned int count;
+} avltree_t;
+
+#define AVLTREE_TO_STRUCT(fn_name, structure_name, field_name, avlnodeptr)             \
+    static inline structure_name * fn_name(avltree_node_t *avlnodeptr){                \
+        return (structure_name *)((char *)(avlnodeptr) - (char *)&(((structure_name *)0)->field_name)); \
+    }
+
+#define AVLTREE_GET_USER_DATA_FROM_OFFSET(avlnodeptr, offset)  \
+    (void *)((char *)(avlnodeptr) - offset)
+
+#define AVLTREE_IS_NODE_IN_TREE(avlnodeptr)    \
+    ((avlnodeptr)->height != 0)
+
+#define AVLTREE_IS_EMPTY(avltreeptr)    \
+    ((avltreeptr)->root == 0)
+
+void
+avltree_init(avltree_t *tree,
+             int (*comp_fn)(void *, void *),
+             int offset);
+
+void
+init_avltree_node(avltree_node_t *node);
+
+void
+avltree_insert(avltree_t *tree, avltree_node_t *node);
+
+void
+avltree_remove(avltree_t *tree, avltree_node_t *node);
+
+/*Biggest node as per comp_fn*/
+avltree_node_t *
+avltree_max(avltree_t *tree);
+
+/*Smallest node as per comp_fn*/
+avltree_node_t *
+avltree_min(avltree_t *tree);
+
+/*Smallest node whose user data is not less than the key, key_comp_fn
+ * compares user data with the key the same way as comp_fn*/
+avltree_node_t *
+avltree_lower_bound(avltree_t *tree,
+                    void *key,
+                    int (*key_comp_fn)(void *, void *));
+
+/*Lowest addressed node among the nodes whose user data is not less
+ * than the key*/
+avltree_node_t *
+avltree_lowest_address_lower_bound(avltree_t *tree,
+                                   void *key,
+                                   int (*key_comp_fn)(void *, void *));
+
+#endif /* __AVLTREE__ */
@@ -0,0 +1,654 @@
+/*
+ * Microbenchmarks of xcalloc()/xfree() against the malloc of the C library.
+ *
+ * Every benchmark runs in a child process of its own so that the peak RSS
+ * and the pages held are those of the benchmark alone. Throughput is
+ * measured over the whole run, latency percentiles of allocations and of
+ * frees apart from every MM_BENCH_SAMPLE_EVERY-th one, timed on its own.
+ * The pages are the
+ * system pages held by the page families while the live set is at its
+ * biggest, they are not known for libc.
+ *
+ * The libc baseline is whatever malloc the binary resolves, run it under
+ * LD_PRELOAD=libjemalloc.so (or tcmalloc) to compare with those allocators.
+ *
+ * -p bytes runs the mm side with the heap profiler sampling about every
+ * that many bytes, to measure its overhead.
+ *
+ * -c gives the page families per thread caches, the _mt benchmarks then
+ * show how the magazines scale with -t threads, e.g.
+ *   for t in 1 2 4 8 16; do mm_bench -c -a mm -t $t _mt; done
+ *
+ * -d defers the coalescing of freed blocks, compare the free latencies of
+ * a run with and without it, e.g. mm_bench -a mm random and mm_bench -a mm
+ * -d random.
+ *
+ * usage : mm_bench [-n ops] [-t threads] [-a mm|libc|all] [-p bytes] [-c]
+ *                  [-d] [filter]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "uapi_mm.h"
+
+#define MM_BENCH_SAMPLE_EVERY   8
+#define MM_BENCH_LIVE_OBJECTS   1024
+#define MM_BENCH_FAMILIES       64
+#define MM_BENCH_RING_SIZE      1024
+
+typedef struct bench_obj_{
+
+    uint64_t data[4];
+} bench_obj_t;
+
+typedef enum{
+
+    ALLOCATOR_MM,
+    ALLOCATOR_LIBC
+} allocator_t;
+
+static const char *allocator_names[] = {"mm", "libc"};
+
+static allocator_t allocator;
+static long bench_ops = 2000000;
+static int bench_threads = 4;
+static uint64_t profile_sample_bytes = 0;
+static int thread_caches = 0;
+static int deferred_coalescing = 0;
+static mm_page_family_handle_t families[MM_BENCH_FAMILIES];
+static uint32_t family_sizes[MM_BENCH_FAMILIES];
+
+/*Timing*/
+
+static inline uint64_t
+now_ns(){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t timer_overhead_ns;
+
+static void
+calibrate_timer(){
+
+    uint64_t min = UINT64_MAX;
+    int i;
+
+    for(i = 0; i < 10000; i++){
+        uint64_t t0 = now_ns();
+        uint64_t t1 = now_ns();
+        if(t1 - t0 < min)
+            min = t1 - t0;
+    }
+    timer_overhead_ns = min;
+}
+
+/*latency samples of one thread*/
+typedef struct latency_samples_{
+
+    uint32_t *ns;
+    long count;
+    long capacity;
+} latency_samples_t;
+
+static void
+samples_init(latency_samples_t *samples, long ops){
+
+    samples->capacity = ops / MM_BENCH_SAMPLE_EVERY + 16;
+    samples->ns = malloc(samples->capacity * sizeof(uint32_t));
+    samples->count = 0;
+}
+
+static inline void
+samples_add(latency_samples_t *samples, uint64_t t0, uint64_t t1){
+
+    uint64_t ns = t1 - t0;
+
+    ns = ns > timer_overhead_ns ? ns - timer_overhead_ns : 0;
+    if(samples->count < samples->capacity)
+        samples->ns[samples->count++] = ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+/*Allocator under test*/
+
+static inline void *
+bench_alloc(int family_index, int units){
+
+    if(allocator == ALLOCATOR_MM)
+        return xcalloc_h(families[family_index], units);
+    return calloc(units, family_sizes[family_index]);
+}
+
+static inline void
+bench_free(void *ptr){
+
+    if(allocator == ALLOCATOR_MM)
+        xfree(ptr);
+    else
+        free(ptr);
+}
+
+typedef struct bench_thread_{
+
+    pthread_t thread;
+    int index;
+    long ops;
+    long alloc_count;
+    long free_count;
+    uint32_t rand_state;
+    latency_samples_t alloc_samples;
+    latency_samples_t free_samples;
+    void *shared;
+} bench_thread_t;
+
+static inline uint32_t
+bench_rand(bench_thread_t *th){
+
+    /*xorshift32*/
+    uint32_t x = th->rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    th->rand_state = x;
+    return x;
+}
+
+/*every op of a thread goes through these two so that one allocation and
+ * one free of MM_BENCH_SAMPLE_EVERY are timed*/
+static inline void *
+op_alloc(bench_thread_t *th, int family_index, int units){
+
+    void *ptr;
+
+    if(th->alloc_count++ % MM_BENCH_SAMPLE_EVERY){
+        ptr = bench_alloc(family_index, units);
+    }
+    else{
+        uint64_t t0 = now_ns();
+        ptr = bench_alloc(family_index, units);
+        samples_add(&th->alloc_samples, t0, now_ns());
+    }
+    if(!ptr){
+        printf("Error : allocation failed\n");
+        exit(1);
+    }
+    /*touch the memory like an application would*/
+    *(volatile char *)ptr = 1;
+    return ptr;
+}
+
+static inline void
+op_free(bench_thread_t *th, void *ptr){
+
+    if(th->free_count++ % MM_BENCH_SAMPLE_EVERY){
+        bench_free(ptr);
+        return;
+    }
+    uint64_t t0 = now_ns();
+    bench_free(ptr);
+    samples_add(&th->free_samples, t0, now_ns());
+}
+
+static uint64_t
+mm_pages_held(){
+
+    mm_page_family_stats_t stats;
+    uint64_t pages = 0;
+    int i;
+
+    for(i = 0; i < MM_BENCH_FAMILIES; i++){
+        mm_get_page_family_stats(families[i], &stats);
+        pages += stats.pages_held;
+    }
+    return pages;
+}
+
+/*pages held by the page families while the live set is at its biggest,
+ * sampled once by the first thread*/
+static uint64_t peak_pages_held;
+
+static inline void
+sample_pages_held(bench_thread_t *th){
+
+    if(allocator != ALLOCATOR_MM || th->index || peak_pages_held)
+        return;
+    peak_pages_held = mm_pages_held();
+}
+
+/*Workloads, every one of them does th->ops allocations and as many frees*/
+
+/*frees in the reverse order of allocation*/
+static void
+workload_lifo(bench_thread_t *th){
+
+    void *objs[MM_BENCH_LIVE_OBJECTS];
+    long done;
+    int i;
+
+    for(done = 0; done < th->ops; done += MM_BENCH_LIVE_OBJECTS){
+        for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+            objs[i] = op_alloc(th, 0, 1);
+        sample_pages_held(th);
+        for(i = MM_BENCH_LIVE_OBJECTS - 1; i >= 0; i--)
+            op_free(th, objs[i]);
+    }
+}
+
+/*frees in the order of allocation*/
+static void
+workload_fifo(bench_thread_t *th){
+
+    void *objs[MM_BENCH_LIVE_OBJECTS];
+    long done;
+    int i;
+
+    for(done = 0; done < th->ops; done += MM_BENCH_LIVE_OBJECTS){
+        for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+            objs[i] = op_alloc(th, 0, 1);
+        sample_pages_held(th);
+        for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+            op_free(th, objs[i]);
+    }
+}
+
+static void
+shuffle(bench_thread_t *th, void **objs, int n){
+
+    int i;
+
+    for(i = n - 1; i > 0; i--){
+        int j = bench_rand(th) % (i + 1);
+        void *tmp = objs[i];
+        objs[i] = objs[j];
+        objs[j] = tmp;
+    }
+}
+
+/*frees in a random order*/
+static void
+workload_random(bench_thread_t *th){
+
+    void *objs[MM_BENCH_LIVE_OBJECTS];
+    long done;
+    int i;
+
+    for(done = 0; done < th->ops; done += MM_BENCH_LIVE_OBJECTS){
+        for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+            objs[i] = op_alloc(th, 0, 1);
+        sample_pages_held(th);
+        shuffle(th, objs, MM_BENCH_LIVE_OBJECTS);
+        for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+            op_free(th, objs[i]);
+    }
+}
+
+/*steady state of live objects of 1 to 16 units, a random one is replaced
+ * at every step*/
+static void
+workload_mixed(bench_thread_t *th){
+
+    void *objs[MM_BENCH_LIVE_OBJECTS];
+    long done;
+    int i;
+
+    for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+        objs[i] = op_alloc(th, 0, 1 + bench_rand(th) % 16);
+    sample_pages_held(th);
+
+    for(done = MM_BENCH_LIVE_OBJECTS; done < th->ops; done++){
+        i = bench_rand(th) % MM_BENCH_LIVE_OBJECTS;
+        op_free(th, objs[i]);
+        objs[i] = op_alloc(th, 0, 1 + bench_rand(th) % 16);
+    }
+
+    for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+        op_free(th, objs[i]);
+}
+
+/*same as mixed but single units of MM_BENCH_FAMILIES page families*/
+static void
+workload_families(bench_thread_t *th){
+
+    void *objs[MM_BENCH_LIVE_OBJECTS];
+    long done;
+    int i;
+
+    for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+        objs[i] = op_alloc(th, bench_rand(th) % MM_BENCH_FAMILIES, 1);
+    sample_pages_held(th);
+
+    for(done = MM_BENCH_LIVE_OBJECTS; done < th->ops; done++){
+        i = bench_rand(th) % MM_BENCH_LIVE_OBJECTS;
+        op_free(th, objs[i]);
+        objs[i] = op_alloc(th, bench_rand(th) % MM_BENCH_FAMILIES, 1);
+    }
+
+    for(i = 0; i < MM_BENCH_LIVE_OBJECTS; i++)
+        op_free(th, objs[i]);
+}
+
+/*single producer single consumer ring, threads are paired, the even one
+ * allocates and the odd one frees what it receives*/
+typedef struct bench_ring_{
+
+    void *slots[MM_BENCH_RING_SIZE];
+    volatile uint64_t head __attribute__((aligned(64)));
+    volatile uint64_t tail __attribute__((aligned(64)));
+} bench_ring_t;
+
+static void
+workload_prodcons(bench_thread_t *th){
+
+    bench_ring_t *ring = (bench_ring_t *)th->shared + th->index / 2;
+    long done;
+
+    if(th->index % 2 == 0){
+        for(done = 0; done < th->ops; done++){
+            void *ptr = op_alloc(th, 0, 1);
+            uint64_t head = ring->head;
+            while(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+                    == MM_BENCH_RING_SIZE)
+                sched_yield();
+            if(done == MM_BENCH_RING_SIZE)
+                sample_pages_held(th);
+            ring->slots[head % MM_BENCH_RING_SIZE] = ptr;
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+        }
+        return;
+    }
+
+    for(done = 0; done < th->ops; done++){
+        uint64_t tail = ring->tail;
+        while(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+            sched_yield();
+        void *ptr = ring->slots[tail % MM_BENCH_RING_SIZE];
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        op_free(th, ptr);
+    }
+}
+
+typedef struct bench_{
+
+    const char *name;
+    void (*workload)(bench_thread_t *);
+    int threaded;   /*runs on bench_threads threads*/
+} bench_t;
+
+static bench_t benches[] = {
+    {"lifo",            workload_lifo,      0},
+    {"fifo",            workload_fifo,      0},
+    {"random",          workload_random,    0},
+    {"mixed_units",     workload_mixed,     0},
+    {"many_families",   workload_families,  0},
+    {"lifo_mt",         workload_lifo,      1},
+    {"random_mt",       workload_random,    1},
+    {"mixed_units_mt",  workload_mixed,     1},
+    {"prodcons_mt",     workload_prodcons,  1},
+};
+
+/*Results, written by the child to a pipe*/
+/*p50, p99 and p99.9*/
+#define MM_BENCH_PERCENTILES    3
+
+typedef struct bench_result_{
+
+    double ops_per_sec;
+    double alloc_ns[MM_BENCH_PERCENTILES];
+    double free_ns[MM_BENCH_PERCENTILES];
+    uint64_t pages_held;
+    long peak_rss_kb;
+} bench_result_t;
+
+static int
+compare_u32(const void *a, const void *b){
+
+    uint32_t x = *(const uint32_t *)a,
+             y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bench_t *current_bench;
+
+/*percentiles of the allocation or free latencies of all the threads*/
+static void
+latency_percentiles(bench_thread_t *threads, int nthreads, int frees,
+        double ns[MM_BENCH_PERCENTILES]){
+
+    static const int per_mille[MM_BENCH_PERCENTILES] = {500, 990, 999};
+    latency_samples_t *samples;
+    uint32_t *all;
+    long n = 0;
+    int i;
+
+    for(i = 0; i < nthreads; i++){
+        samples = frees ? &threads[i].free_samples : &threads[i].alloc_samples;
+        n += samples->count;
+    }
+    memset(ns, 0, MM_BENCH_PERCENTILES * sizeof(double));
+    if(!n)
+        return;
+
+    all = malloc(n * sizeof(uint32_t));
+    n = 0;
+    for(i = 0; i < nthreads; i++){
+        samples = frees ? &threads[i].free_samples : &threads[i].alloc_samples;
+        memcpy(all + n, samples->ns, samples->count * sizeof(uint32_t));
+        n += samples->count;
+    }
+    qsort(all, n, sizeof(uint32_t), compare_u32);
+    for(i = 0; i < MM_BENCH_PERCENTILES; i++)
+        ns[i] = all[n * per_mille[i] / 1000];
+    free(all);
+}
+
+static void *
+bench_thread_main(void *arg){
+
+    bench_thread_t *th = arg;
+    current_bench->workload(th);
+    return NULL;
+}
+
+static void
+bench_child(bench_t *bench, int fd){
+
+    int nthreads = bench->threaded ? bench_threads : 1,
+        i;
+    bench_thread_t *threads;
+    bench_ring_t *rings;
+    bench_result_t result;
+    long total = 0;
+    uint64_t t0, t1;
+
+    if(bench->workload == workload_prodcons && nthreads % 2)
+        nthreads++;
+
+    if(allocator == ALLOCATOR_MM){
+        char name[32];
+        mm_init();
+        for(i = 0; i < MM_BENCH_FAMILIES; i++){
+            snprintf(name, sizeof(name), "bench_obj_%d", i);
+            families[i] = mm_instantiate_new_page_family(name,
+                    family_sizes[i]);
+            if(thread_caches)
+                mm_page_family_set_thread_cache(families[i], MM_TRUE);
+            if(deferred_coalescing)
+                mm_page_family_set_deferred_coalescing(families[i], MM_TRUE);
+        }
+        if(profile_sample_bytes)
+            mm_profiler_start(profile_sample_bytes);
+    }
+
+    threads = calloc(nthreads, sizeof(bench_thread_t));
+    rings = calloc(nthreads / 2 + 1, sizeof(bench_ring_t));
+    current_bench = bench;
+
+    for(i = 0; i < nthreads; i++){
+        threads[i].index = i;
+        threads[i].ops = bench_ops / nthreads;
+        threads[i].rand_state = 2463534242u + i * 7919;
+        threads[i].shared = rings;
+        /*every thread allocates and frees ops objects*/
+        samples_init(&threads[i].alloc_samples, threads[i].ops);
+        samples_init(&threads[i].free_samples, threads[i].ops);
+        total += threads[i].ops;
+    }
+
+    t0 = now_ns();
+    for(i = 0; i < nthreads; i++)
+        pthread_create(&threads[i].thread, NULL, bench_thread_main, &threads[i]);
+    for(i = 0; i < nthreads; i++)
+        pthread_join(threads[i].thread, NULL);
+    t1 = now_ns();
+
+    /*prodcons threads do half the work each*/
+    if(bench->workload == workload_prodcons)
+        total /= 2;
+
+    memset(&result, 0, sizeof(result));
+    /*one alloc and one free per object*/
+    result.ops_per_sec = (double)total * 2 * 1e9 / (double)(t1 - t0);
+
+    latency_percentiles(threads, nthreads, 0, result.alloc_ns);
+    latency_percentiles(threads, nthreads, 1, result.free_ns);
+
+    result.pages_held = peak_pages_held;
+
+    if(write(fd, &result, sizeof(result)) != sizeof(result))
+        exit(1);
+    exit(0);
+}
+
+static int
+bench_run(bench_t *bench, bench_result_t *result){
+
+    int fds[2], status;
+    struct rusage usage;
+    pid_t pid;
+
+    if(pipe(fds) < 0)
+        return -1;
+
+    fflush(stdout);
+    pid = fork();
+    if(pid < 0)
+        return -1;
+    if(pid == 0){
+        close(fds[0]);
+        bench_child(bench, fds[1]);
+    }
+
+    close(fds[1]);
+    if(read(fds[0], result, sizeof(*result)) != sizeof(*result)){
+        close(fds[0]);
+        wait4(pid, &status, 0, &usage);
+        return -1;
+    }
+    close(fds[0]);
+    wait4(pid, &status, 0, &usage);
+    result->peak_rss_kb = usage.ru_maxrss;
+    return 0;
+}
+
+static void
+usage(const char *prog){
+
+    printf("usage : %s [-n ops] [-t threads] [-a mm|libc|all] [-p bytes] "
+            "[-c] [-d] [filter]\n", prog);
+    exit(1);
+}
+
+int
+main(int argc, char **argv){
+
+    int opt, i, a;
+    int first_allocator = ALLOCATOR_MM,
+        last_allocator = ALLOCATOR_LIBC;
+    const char *filter = NULL;
+    bench_result_t result;
+
+    while((opt = getopt(argc, argv, "n:t:a:p:cdh")) != -1){
+        switch(opt){
+            case 'n':
+                bench_ops = atol(optarg);
+                break;
+            case 't':
+                bench_threads = atoi(optarg);
+                break;
+            case 'a':
+                if(strcmp(optarg, "mm") == 0)
+                    last_allocator = ALLOCATOR_MM;
+                else if(strcmp(optarg, "libc") == 0)
+                    first_allocator = ALLOCATOR_LIBC;
+                else if(strcmp(optarg, "all") != 0)
+                    usage(argv[0]);
+                break;
+            case 'p':
+                profile_sample_bytes = strtoull(optarg, NULL, 10);
+                break;
+            case 'c':
+                thread_caches = 1;
+                break;
+            case 'd':
+                deferred_coalescing = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if(optind < argc)
+        filter = argv[optind];
+    if(bench_ops < MM_BENCH_LIVE_OBJECTS || bench_threads < 1)
+        usage(argv[0]);
+
+    /*family 0 is bench_obj_t, the others span 16B to 1KB*/
+    for(i = 0; i < MM_BENCH_FAMILIES; i++)
+        family_sizes[i] = i ? 16 * (uint32_t)i : sizeof(bench_obj_t);
+
+    calibrate_timer();
+
+    /*latencies in ns, a for allocations and f for frees*/
+    printf("%-18s %-5s %12s %8s %8s %8s %8s %8s %8s %12s %10s\n",
+            "Benchmark", "Alloc", "ops/s", "a p50", "a p99", "a p99.9",
+            "f p50", "f p99", "f p99.9", "peak RSS KB", "peak pages");
+    for(i = 0; i < 113; i++)
+        putchar('-');
+    putchar('\n');
+
+    for(i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); i++){
+
+        if(filter && !strstr(benches[i].name, filter))
+            continue;
+
+        for(a = first_allocator; a <= last_allocator; a++){
+
+            allocator = a;
+            if(bench_run(&benches[i], &result) < 0){
+                printf("%-18s %-5s failed\n", benches[i].name,
+                        allocator_names[a]);
+                continue;
+            }
+
+            printf("%-18s %-5s %12.0f %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f "
+                    "%12ld ",
+                    benches[i].name, allocator_names[a], result.ops_per_sec,
+                    result.alloc_ns[0], result.alloc_ns[1], result.alloc_ns[2],
+                    result.free_ns[0], result.free_ns[1], result.free_ns[2],
+                    result.peak_rss_kb);
+            if(a == ALLOCATOR_MM)
+                printf("%10lu\n", (unsigned long)result.pages_held);
+            else
+                printf("%10s\n", "-");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Node based containers with mm::allocator against std::allocator.
+ *
+ * Each benchmark fills a container with bench_ops elements, looks every
+ * key up, erases half of them in an order other than the insertion order,
+ * refills and clears it. The time is for the whole sequence, divided by the
+ * number of node allocations and frees it did.
+ *
+ * usage : mm_bench_containers [-n ops] [-r rounds] [filter]
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "mm_allocator.hpp"
+
+static long bench_ops = 200000;
+static int bench_rounds = 5;
+
+/*Timing*/
+
+static inline uint64_t
+now_ns(){
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//keys in a fixed pseudo random order, the same for every allocator
+static std::vector<uint64_t>
+make_keys(){
+
+    std::vector<uint64_t> keys(bench_ops);
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+
+    for(long i = 0; i < bench_ops; i++){
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys[i] = x;
+    }
+    return keys;
+}
+
+static uint64_t checksum;
+
+/*Workloads, each returns the node allocations plus frees it did*/
+
+template<template<typename> class Alloc>
+static long
+bench_list(const std::vector<uint64_t> &keys){
+
+    std::list<uint64_t, Alloc<uint64_t>> list;
+    long ops = 0;
+
+    for(uint64_t key : keys)
+        list.push_back(key);
+    ops += keys.size();
+
+    //every other node, leaving holes all over the pages
+    bool erase = true;
+    for(auto it = list.begin(); it != list.end(); erase = !erase){
+        if(erase){
+            it = list.erase(it);
+            ops++;
+        }
+        else
+            ++it;
+    }
+
+    for(uint64_t key : keys){
+        if(key & 1){
+            list.push_front(key);
+            ops++;
+        }
+    }
+    for(uint64_t key : list)
+        checksum += key;
+    ops += list.size();
+    list.clear();
+    return ops;
+}
+
+template<template<typename> class Alloc>
+static long
+bench_map(const std::vector<uint64_t> &keys){
+
+    std::map<uint64_t, uint64_t, std::less<uint64_t>,
+        Alloc<std::pair<const uint64_t, uint64_t>>> map;
+    long ops = 0;
+
+    for(uint64_t key : keys)
+        ops += map.emplace(key, key).second;
+
+    for(uint64_t key : keys)
+        checksum += map.find(key)->second;
+
+    for(uint64_t key : keys){
+        if(key & 2)
+            ops += map.erase(key);
+    }
+    for(uint64_t key : keys)
+        ops += map.emplace(key, key).second;
+    ops += map.size();
+    map.clear();
+    return ops;
+}
+
+template<template<typename> class Alloc>
+static long
+bench_unordered_map(const std::vector<uint64_t> &keys){
+
+    std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>,
+        std::equal_to<uint64_t>,
+        Alloc<std::pair<const uint64_t, uint64_t>>> map;
+    long ops = 0;
+
+    for(uint64_t key : keys)
+        ops += map.emplace(key, key).second;
+
+    for(uint64_t key : keys)
+        checksum += map.find(key)->second;
+
+    for(uint64_t key : keys){
+        if(key & 2)
+            ops += map.erase(key);
+    }
+    for(uint64_t key : keys)
+        ops += map.emplace(key, key).second;
+    ops += map.size();
+    map.clear();
+    return ops;
+}
+
+template<typename T>
+using std_allocator = std::allocator<T>;
+
+template<typename T>
+using mm_allocator = mm::allocator<T>;
+
+typedef long (*bench_fn_t)(const std::vector<uint64_t> &);
+
+typedef struct bench_{
+
+    const char *name;
+    bench_fn_t std_fn;
+    bench_fn_t mm_fn;
+} bench_t;
+
+static const bench_t benches[] = {
+
+    {"list", bench_list<std_allocator>, bench_list<mm_allocator>},
+    {"map", bench_map<std_allocator>, bench_map<mm_allocator>},
+    {"unordered_map", bench_unordered_map<std_allocator>,
+        bench_unordered_map<mm_allocator>},
+};
+
+//best of the rounds, in ns per node allocation or free
+static double
+run_bench(bench_fn_t fn, const std::vector<uint64_t> &keys){
+
+    double best = 0;
+
+    for(int round = 0; round < bench_rounds; round++){
+        uint64_t start = now_ns();
+        long ops = fn(keys);
+        double ns = (double)(now_ns() - start) / ops;
+        if(round == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+int
+main(int argc, char **argv){
+
+    const char *filter = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:r:")) != -1){
+        switch(opt){
+            case 'n':
+                bench_ops = atol(optarg);
+                break;
+            case 'r':
+                bench_rounds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr,
+                        "usage : %s [-n ops] [-r rounds] [filter]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if(optind < argc)
+        filter = argv[optind];
+    if(bench_ops <= 0 || bench_rounds <= 0){
+        fprintf(stderr, "Error : ops and rounds must be positive\n");
+        return 1;
+    }
+
+    mm_init();
+    std::vector<uint64_t> keys = make_keys();
+
+    printf("%-16s %14s %14s %10s\n",
+            "benchmark", "std ns/op", "mm ns/op", "speedup");
+    for(const bench_t &bench : benches){
+        if(filter && !strstr(bench.name, filter))
+            continue;
+        double std_ns = run_bench(bench.std_fn, keys);
+        double mm_ns = run_bench(bench.mm_fn, keys);
+        printf("%-16s %14.2f %14.2f %9.2fx\n",
+                bench.name, std_ns, mm_ns, std_ns / mm_ns);
+    }
+    //keeps the lookups from being optimized out
+    if(checksum == 1)
+        printf("\n");
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * Cost of the free block index as the number of free blocks grows.
+ *
+ * A page family is left with N free blocks of 1 to 8 units which cannot
+ * coalesce, every other block of a run of allocations is freed. Then a
+ * block of 1 to 8 units is allocated and freed again, over and over : the
+ * allocation looks the fitting free block up in the free block tree and
+ * removes it, the free inserts it back. Both are timed apart and, being
+ * O(log n), should grow only slowly from a thousand to a hundred thousand
+ * free blocks.
+ *
+ * usage : mm_bench_free_blocks [-n max free blocks] [-o ops] [-r rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "uapi_mm.h"
+
+#define MM_BENCH_MAX_UNITS  8
+
+static long max_free_blocks = 100000;
+static long bench_ops = 1000000;
+static int bench_rounds = 5;
+
+static const struct{
+
+    const char *name;
+    mm_placement_policy_t policy;
+} policies[] = {
+    {"best_fit",    MM_BEST_FIT},
+    {"first_fit",   MM_FIRST_FIT},
+    {"worst_fit",   MM_WORST_FIT},
+};
+
+static inline uint64_t
+now_ns(){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint32_t
+bench_rand(uint32_t *state){
+
+    /*xorshift32*/
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+typedef struct bench_result_{
+
+    double alloc_ns;
+    double free_ns;
+} bench_result_t;
+
+/*best of the rounds, in ns per allocation and per free*/
+static bench_result_t
+run_bench(mm_placement_policy_t policy, long free_blocks){
+
+    mm_page_family_handle_t pg_family;
+    void **kept, **freed;
+    uint32_t rand_state = 2463534242u;
+    bench_result_t best = {0, 0};
+    long i;
+    int round;
+
+    pg_family = mm_instantiate_new_page_family("free_blocks_obj", 16);
+    if(!pg_family)
+        exit(1);
+    mm_page_family_set_placement_policy(pg_family, policy);
+
+    kept = malloc(free_blocks * sizeof(void *));
+    freed = malloc(free_blocks * sizeof(void *));
+    for(i = 0; i < free_blocks; i++){
+        freed[i] = xcalloc_h(pg_family,
+                1 + bench_rand(&rand_state) % MM_BENCH_MAX_UNITS);
+        kept[i] = xcalloc_h(pg_family, 1);
+        if(!freed[i] || !kept[i]){
+            printf("Error : allocation failed\n");
+            exit(1);
+        }
+    }
+    /*every free block sits between two allocated ones*/
+    for(i = 0; i < free_blocks; i++)
+        xfree(freed[i]);
+
+    for(round = 0; round < bench_rounds; round++){
+
+        uint64_t alloc_total = 0, free_total = 0;
+
+        for(i = 0; i < bench_ops; i++){
+            int units = 1 + bench_rand(&rand_state) % MM_BENCH_MAX_UNITS;
+            uint64_t t0 = now_ns();
+            void *ptr = xcalloc_h(pg_family, units);
+            uint64_t t1 = now_ns();
+            if(!ptr){
+                printf("Error : allocation failed\n");
+                exit(1);
+            }
+            xfree(ptr);
+            alloc_total += t1 - t0;
+            free_total += now_ns() - t1;
+        }
+
+        double alloc_ns = (double)alloc_total / bench_ops;
+        double free_ns = (double)free_total / bench_ops;
+        if(round == 0 || alloc_ns < best.alloc_ns)
+            best.alloc_ns = alloc_ns;
+        if(round == 0 || free_ns < best.free_ns)
+            best.free_ns = free_ns;
+    }
+
+    mm_unregister_page_family(pg_family);
+    free(kept);
+    free(freed);
+    return best;
+}
+
+int
+main(int argc, char **argv){
+
+    long free_blocks;
+    int opt;
+    size_t p;
+
+    while((opt = getopt(argc, argv, "n:o:r:")) != -1){
+        switch(opt){
+            case 'n':
+                max_free_blocks = atol(optarg);
+                break;
+            case 'o':
+                bench_ops = atol(optarg);
+                break;
+            case 'r':
+                bench_rounds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage : %s [-n max free blocks] [-o ops] "
+                        "[-r rounds]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(max_free_blocks <= 0 || bench_ops <= 0 || bench_rounds <= 0){
+        fprintf(stderr, "Error : counts must be positive\n");
+        return 1;
+    }
+
+    mm_init();
+
+    printf("%-12s %14s %12s %12s\n", "policy", "free blocks",
+            "alloc ns", "free ns");
+    for(p = 0; p < sizeof(policies) / sizeof(policies[0]); p++){
+        for(free_blocks = 1000; free_blocks <= max_free_blocks;
+                free_blocks *= 10){
+            bench_result_t res = run_bench(policies[p].policy, free_blocks);
+            printf("%-12s %14ld %12.1f %12.1f\n", policies[p].name,
+                    free_blocks, res.alloc_ns, res.free_ns);
+        }
+    }
+    return 0;
+}
@@ -1,30 +1,91 @@
+#define _GNU_SOURCE     //dladdr()
 #include <stdio.h>
 #include <memory.h>
 #include <unistd.h>     //for getpagesize
 #include <sys/mman.h>   //For using mmap()
+#include <math.h>
+#include <execinfo.h>   //backtrace() of the heap profiler
+#include <dlfcn.h>
 #include <stdint.h>
+#include <stddef.h>     //offsetof
 #include "mm.h"
 #include <assert.h>
 #include "css.h"
 #include "uapi_mm.h"
 #include <stdlib.h>
+#include <time.h>
 //starting page is set to null initially
 static vm_page_for_families_t *first_vm_page_for_families = NULL;
+//registered page families hashed by struct name for O(1) lookup
+static vm_page_family_t *page_family_hash_table[MM_FAMILY_HASH_BUCKETS];
+//serializes registration, lookups are lock free
+static pthread_mutex_t page_family_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+//odd while a family is unlinked from the hash buckets or a slot is reused,
+//lock free lookups which overlap with either start over
+static uint32_t page_family_registry_seq = 0;
+//number of page family slots handed out, also the id of the next one
+static uint32_t page_family_count = 0;
+//slot of every id, registered, per thread or unused, guarded by registry lock
+static vm_page_family_t **page_families_by_id = NULL;
+static uint32_t page_families_by_id_pages = 0;
+//slots of unregistered families, reused oldest first before carving new
+//ones so that stale handles keep naming a dead slot for as long as possible
+static vm_page_family_t *free_page_families = NULL;
+static vm_page_family_t *free_page_families_tail = NULL;
+//per thread families are carved from internal pages which are never
+//unmapped, guarded by the registry lock
+static char *thread_family_carve_ptr = NULL;
+static uint32_t thread_family_carve_left = 0;
+static vm_page_family_t *free_thread_families = NULL;
+
+//thread cache of the calling thread and list of all thread caches
+static __thread mm_thread_cache_t *mm_thread_cache = NULL;
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_key_once = PTHREAD_ONCE_INIT;
+static glthread_t thread_cache_list;
+static pthread_mutex_t thread_cache_list_lock = PTHREAD_MUTEX_INITIALIZER;
 static size_t SYSTEM_PAGE_SIZE = 0;
-
-typedef struct Allocation {
-    void* ptr;
-    size_t size;
-    int freed; 
-    struct Allocation* next;
-} Allocation;
-
-
-Allocation* head = NULL;
+//used bytes of a meta block page shifted by this give its occupancy bin
+static uint32_t page_occupancy_shift = 0;
+
+//empty pages overflowing the page pools of the families
+static mm_page_pool_t global_page_pool = {
+    {NULL, NULL}, 0,
+    MM_GLOBAL_POOL_HIGH_WATERMARK, MM_GLOBAL_POOL_LOW_WATERMARK};
+static pthread_mutex_t global_page_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+//pooled pages older than this are unmapped, 0 keeps them forever
+static uint32_t page_pool_decay_ms = 0;
+
+//regions single pages are carved from, only the ones with free pages are
+//listed, full regions are found again from their pages
+static glthread_t partial_regions = {NULL, NULL};
+static mm_region_t *spare_region = NULL;
+static pthread_mutex_t region_lock = PTHREAD_MUTEX_INITIALIZER;
+static mm_region_backing_t mm_region_backing = MM_REGION_NORMAL_PAGES;
+
+//background thread calling mm_maintenance()
+static pthread_t maintenance_thread;
+static vm_bool_t maintenance_thread_running = MM_FALSE;
+static uint32_t maintenance_interval_ms = 0;
+static uint32_t maintenance_budget = 0;
+static pthread_mutex_t maintenance_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maintenance_cond = PTHREAD_COND_INITIALIZER;
+
+
+_Static_assert(MM_FIRST_DATA_BLOCK_OFFSET % MM_MAX_ALIGNMENT == 0,
+        "first data block of a page must be MM_MAX_ALIGNMENT aligned");
+_Static_assert(offset_of(vm_page_t, page_header_pad) == MM_PAGE_HEADER_SIZE,
+        "page header fields must add up to MM_PAGE_HEADER_SIZE");
 
 void mm_init(){
 
     SYSTEM_PAGE_SIZE = getpagesize();//returns size of one page
+    page_occupancy_shift =
+        __builtin_ctzl(SYSTEM_PAGE_SIZE / MM_OCCUPANCY_BINS);
+#ifdef MM_COMPACT_BLOCK_HEADER
+    //meta blocks link their neighbours by 16 bit page offsets
+    assert(SYSTEM_PAGE_SIZE <= 65536);
+#endif
 }
 //accepts as argument the number of units of contiguous free memory location
 //to find the free space multiply the number of units and page size - the meta data 
@@ -32,43 +93,442 @@ static inline uint32_t
 mm_max_page_allocatable_memory(int units){
 
     return (uint32_t)
-        ((SYSTEM_PAGE_SIZE * units) - offset_of(vm_page_t, page_memory));
+        ((SYSTEM_PAGE_SIZE * units) - MM_FIRST_DATA_BLOCK_OFFSET);
 }
 
 #define MAX_PAGE_ALLOCATABLE_MEMORY(units) \
     (mm_max_page_allocatable_memory(units))
 
+//number of system pages a span needs to hold size bytes of data
+static inline uint32_t
+mm_span_pages_needed(uint64_t size){
+
+    return (uint32_t)((size + MM_FIRST_DATA_BLOCK_OFFSET +
+                SYSTEM_PAGE_SIZE - 1) / SYSTEM_PAGE_SIZE);
+}
+
+//a span data block covers all the pages of the span
+#define MM_SPAN_PAGES(vm_page_ptr)  \
+    (mm_span_pages_needed((vm_page_ptr)->block_meta_data.block_size))
+
 
-//Function to request Virtual memory page from kernel
-static void * mm_get_new_vm_page_from_kernel(int units){
+//maps size bytes straight from the kernel, aligned to align bytes
+static void *
+mm_map_from_kernel(size_t size, size_t align, int extra_flags){
+
+    size_t map_size = size + (align > SYSTEM_PAGE_SIZE ? align : 0);
+    uintptr_t start, aligned;
 
     //mmap() system call returns the address of the starting of the allocatted page
     //read,write and execute are permissions
-    char *vm_page = mmap(0, units * SYSTEM_PAGE_SIZE,
+    char *vm_page = mmap(0, map_size,
         PROT_READ|PROT_WRITE|PROT_EXEC,
-        MAP_ANON|MAP_PRIVATE,
+        MAP_ANON|MAP_PRIVATE|extra_flags,
         0, 0);
 
+    if(vm_page == MAP_FAILED)
+        return NULL;
+
+    if(map_size == size)
+        return (void *)vm_page;
+
+    //trim the mapping down to an aligned one
+    start = (uintptr_t)vm_page;
+    aligned = (start + align - 1) & ~((uintptr_t)align - 1);
+    if(aligned != start)
+        munmap(vm_page, aligned - start);
+    if(aligned + size != start + map_size)
+        munmap((void *)(aligned + size), start + map_size - (aligned + size));
+    return (void *)aligned;
+}
+
+static mm_region_t *
+mm_region_new(){
+
+    mm_region_t *region = NULL;
+    mm_region_backing_t region_backing =
+        __atomic_load_n(&mm_region_backing, __ATOMIC_RELAXED);
+
+#ifdef MAP_HUGETLB
+    //huge page mappings are huge page aligned already, so one huge page
+    //is mapped and none trimmed
+    if(region_backing == MM_REGION_HUGETLB_PAGES)
+        region = mm_map_from_kernel(MM_REGION_SIZE, 0, MAP_HUGETLB);
+#endif
+    if(!region)
+        region = mm_map_from_kernel(MM_REGION_SIZE, MM_REGION_SIZE, 0);
+    if(!region)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if(region_backing == MM_REGION_TRANSPARENT_HUGE_PAGES)
+        madvise(region, MM_REGION_SIZE, MADV_HUGEPAGE);
+#endif
+
+    //fresh mapping is zero filled
+    init_glthread(&region->region_glue);
+    region->pages_in_use = 0;
+    region->carved_pages = 1;   //the header page
+    region->free_pages = NULL;
+    return region;
+}
+
+//one page out of a region with free pages, region lock must be held
+static void *
+mm_region_get_page(vm_bool_t *is_zero){
+
+    glthread_t *glthread = BASE(&partial_regions);
+    mm_region_t *region = NULL;
+    void *vm_page = NULL;
+
+    if(glthread)
+        region = glthread_to_region(glthread);
+    else{
+        region = spare_region ? spare_region : mm_region_new();
+        spare_region = NULL;
+        if(!region)
+            return NULL;
+        glthread_add_next(&partial_regions, &region->region_glue);
+    }
+
+    if(region->free_pages){
+        vm_page = region->free_pages;
+        region->free_pages = *(void **)vm_page;
+        *is_zero = MM_FALSE;
+    }
+    else{
+        //never used pages are still zero from mmap
+        vm_page = (char *)region + region->carved_pages * SYSTEM_PAGE_SIZE;
+        region->carved_pages++;
+        *is_zero = MM_TRUE;
+    }
+
+    region->pages_in_use++;
+    if(!region->free_pages &&
+            region->carved_pages == MM_REGION_SIZE / SYSTEM_PAGE_SIZE){
+        remove_glthread(&region->region_glue);
+        init_glthread(&region->region_glue);
+    }
+    return vm_page;
+}
+
+//returns a page to its region, an empty region is kept as spare or unmapped.
+//Region lock must be held
+static void
+mm_region_put_page(void *vm_page){
+
+    mm_region_t *region = MM_GET_REGION_FROM_PAGE(vm_page);
+    vm_bool_t was_full = (!region->free_pages &&
+            region->carved_pages == MM_REGION_SIZE / SYSTEM_PAGE_SIZE) ?
+        MM_TRUE : MM_FALSE;
+
+    *(void **)vm_page = region->free_pages;
+    region->free_pages = vm_page;
+    region->pages_in_use--;
+
+    if(was_full)
+        glthread_add_next(&partial_regions, &region->region_glue);
+
+    if(region->pages_in_use)
+        return;
+
+    remove_glthread(&region->region_glue);
+    init_glthread(&region->region_glue);
+
+    //one empty region is kept so a family growing and shrinking around
+    //a region boundary does not map and unmap it every time
+    if(!spare_region){
+        spare_region = region;
+        return;
+    }
+    if(munmap((void *)region, MM_REGION_SIZE)){
+        printf("Error : Could not munmap VM region to kernel");
+    }
+}
+
+//Function to request Virtual memory pages from kernel, single pages are
+//carved out of regions to keep mmap calls and mappings few. Pages are not
+//zeroed, is_zero tells whether they still are
+static void *
+mm_get_vm_pages_from_kernel(int units, vm_bool_t *is_zero){
+
+    char *vm_page = NULL;
+
+    if(units == 1){
+        pthread_mutex_lock(&region_lock);
+        vm_page = mm_region_get_page(is_zero);
+        pthread_mutex_unlock(&region_lock);
+    }
+    else{
+        //fresh mapping is zero filled
+        vm_page = mm_map_from_kernel(units * SYSTEM_PAGE_SIZE,
+                SYSTEM_PAGE_SIZE, 0);
+        *is_zero = MM_TRUE;
+    }
+
     //error handling
-    if(vm_page == MAP_FAILED){
+    if(!vm_page){
         printf("Error : VM Page allocation Failed\n");
         return NULL;
     }
-    //initialise the memory assigned by mmap to our user process using memset()
-    memset(vm_page, 0, units * SYSTEM_PAGE_SIZE);
     return (void *)vm_page;
 }
 
+//zero filled pages, for internal structures which rely on it
+static void *
+mm_get_new_vm_page_from_kernel(int units){
+
+    vm_bool_t is_zero = MM_FALSE;
+    void *vm_page = mm_get_vm_pages_from_kernel(units, &is_zero);
+
+    if(vm_page && !is_zero)
+        memset(vm_page, 0, units * SYSTEM_PAGE_SIZE);
+    return vm_page;
+}
+
 //Function to return a page to kernel
 static void
 mm_return_vm_page_to_kernel (void *vm_page, int units){
 
+    if(units == 1){
+        pthread_mutex_lock(&region_lock);
+        mm_region_put_page(vm_page);
+        pthread_mutex_unlock(&region_lock);
+        return;
+    }
+
     //munmap system allocatte to return the page and also error handling
     if(munmap(vm_page, units * SYSTEM_PAGE_SIZE)){
         printf("Error : Could not munmap VM page to kernel");
     }
 }
 
+void
+mm_set_region_backing(mm_region_backing_t region_backing){
+
+    __atomic_store_n(&mm_region_backing, region_backing, __ATOMIC_RELAXED);
+}
+
+static uint64_t
+mm_now_ms(){
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline vm_bool_t
+mm_pooled_page_decayed(mm_pooled_page_t *pooled_page, uint64_t now_ms){
+
+    uint32_t decay_ms = __atomic_load_n(&page_pool_decay_ms, __ATOMIC_RELAXED);
+
+    return (decay_ms &&
+            now_ms - pooled_page->pooled_at_ms >= decay_ms) ?
+        MM_TRUE : MM_FALSE;
+}
+
+//count of the global pool is peeked at without its lock
+#define MM_PAGE_POOL_SET_COUNT(page_pool, value)   \
+    __atomic_store_n(&(page_pool)->count, (value), __ATOMIC_RELAXED)
+
+static void
+mm_page_pool_put(mm_page_pool_t *page_pool,
+        mm_pooled_page_t *pooled_page){
+
+    init_glthread(&pooled_page->pool_glue);
+    glthread_add_next(&page_pool->pages, &pooled_page->pool_glue);
+    MM_PAGE_POOL_SET_COUNT(page_pool, page_pool->count + 1);
+}
+
+//takes the most recently pooled page, its cache lines are likely still hot
+static void *
+mm_page_pool_get(mm_page_pool_t *page_pool){
+
+    glthread_t *glthread = BASE(&page_pool->pages);
+
+    if(!glthread)
+        return NULL;
+
+    remove_glthread(glthread);
+    MM_PAGE_POOL_SET_COUNT(page_pool, page_pool->count - 1);
+    return (void *)glthread_to_pooled_page(glthread);
+}
+
+//moves the least recently pooled pages to the released list while the pool
+//holds more than keep pages, and decayed pages wherever they are
+static void
+mm_page_pool_shrink(mm_page_pool_t *page_pool,
+        uint32_t keep,
+        uint64_t now_ms,
+        glthread_t *released){
+
+    glthread_t *glthread = BASE(&page_pool->pages),
+               *prev = NULL;
+
+    if(!glthread)
+        return;
+
+    while(glthread->right)
+        glthread = glthread->right;
+
+    //walk from the tail, the first page links back to the pool head
+    for(; glthread != &page_pool->pages; glthread = prev){
+
+        mm_pooled_page_t *pooled_page = glthread_to_pooled_page(glthread);
+
+        prev = glthread->left;
+        if(page_pool->count <= keep &&
+                !mm_pooled_page_decayed(pooled_page, now_ms))
+            continue;
+
+        remove_glthread(glthread);
+        MM_PAGE_POOL_SET_COUNT(page_pool, page_pool->count - 1);
+        init_glthread(glthread);
+        glthread_add_next(released, glthread);
+    }
+}
+
+//pages released by a family pool go to the global pool, the ones the
+//global pool cannot take go back to the kernel
+static void
+mm_global_page_pool_take(glthread_t *released, uint64_t now_ms){
+
+    glthread_t *glthread = NULL;
+    glthread_t unmapped;
+
+    init_glthread(&unmapped);
+
+    pthread_mutex_lock(&global_page_pool_lock);
+    ITERATE_GLTHREAD_BEGIN(released, glthread){
+
+        mm_pooled_page_t *pooled_page = glthread_to_pooled_page(glthread);
+
+        remove_glthread(glthread);
+        if(!global_page_pool.high_watermark ||
+                mm_pooled_page_decayed(pooled_page, now_ms)){
+            init_glthread(glthread);
+            glthread_add_next(&unmapped, glthread);
+            continue;
+        }
+        mm_page_pool_put(&global_page_pool, pooled_page);
+    } ITERATE_GLTHREAD_END(released, glthread);
+
+    if(global_page_pool.count > global_page_pool.high_watermark)
+        mm_page_pool_shrink(&global_page_pool,
+                global_page_pool.low_watermark, now_ms, &unmapped);
+    else if(__atomic_load_n(&page_pool_decay_ms, __ATOMIC_RELAXED))
+        mm_page_pool_shrink(&global_page_pool,
+                global_page_pool.count, now_ms, &unmapped);
+    pthread_mutex_unlock(&global_page_pool_lock);
+
+    //unmap outside the lock
+    ITERATE_GLTHREAD_BEGIN(&unmapped, glthread){
+
+        mm_return_vm_page_to_kernel(
+                (void *)glthread_to_pooled_page(glthread), 1);
+    } ITERATE_GLTHREAD_END(&unmapped, glthread);
+}
+
+//one page for the family, from its page pool, the global pool or the kernel.
+//Pooled pages are not zeroed again, data blocks are zeroed on allocation
+//unless the page is known to be zero. Family lock must be held
+static void *
+mm_family_get_vm_page(vm_page_family_t *vm_page_family, vm_bool_t *is_zero){
+
+    void *vm_page = mm_page_pool_get(&vm_page_family->page_pool);
+
+    *is_zero = MM_FALSE;
+    if(vm_page)
+        return vm_page;
+
+    if(__atomic_load_n(&global_page_pool.count, __ATOMIC_RELAXED)){
+        pthread_mutex_lock(&global_page_pool_lock);
+        vm_page = mm_page_pool_get(&global_page_pool);
+        pthread_mutex_unlock(&global_page_pool_lock);
+        if(vm_page)
+            return vm_page;
+    }
+
+    return mm_get_vm_pages_from_kernel(1, is_zero);
+}
+
+//parks a page which became empty in the page pool of its family, trimming
+//the pool down to its low watermark once it overflows. Family lock must be held
+static void
+mm_family_put_vm_page(vm_page_family_t *vm_page_family, void *vm_page){
+
+    mm_page_pool_t *page_pool = &vm_page_family->page_pool;
+    mm_pooled_page_t *pooled_page = (mm_pooled_page_t *)vm_page;
+    uint64_t now_ms = mm_now_ms();
+    glthread_t released;
+
+    init_glthread(&released);
+    //stamped whether decay is on or not, so that turning it on later does
+    //not find every pooled page decayed
+    pooled_page->pooled_at_ms = now_ms;
+
+    if(!page_pool->high_watermark){
+        init_glthread(&pooled_page->pool_glue);
+        glthread_add_next(&released, &pooled_page->pool_glue);
+    }
+    else{
+        mm_page_pool_put(page_pool, pooled_page);
+        if(page_pool->count > page_pool->high_watermark)
+            mm_page_pool_shrink(page_pool, page_pool->low_watermark,
+                    now_ms, &released);
+        else if(__atomic_load_n(&page_pool_decay_ms, __ATOMIC_RELAXED))
+            mm_page_pool_shrink(page_pool, page_pool->count,
+                    now_ms, &released);
+    }
+
+    if(!IS_GLTHREAD_LIST_EMPTY(&released))
+        mm_global_page_pool_take(&released, now_ms);
+}
+
+//moves the windows of released pages forward upto now_ms
+static void
+mm_family_roll_release_window(vm_page_family_t *vm_page_family,
+        uint64_t now_ms){
+
+    uint64_t elapsed = now_ms - vm_page_family->release_window_ms;
+
+    if(elapsed < MM_RELEASE_WINDOW_MS)
+        return;
+
+    vm_page_family->released_prev_window =
+        elapsed < 2 * MM_RELEASE_WINDOW_MS ?
+        vm_page_family->released_window : 0;
+    vm_page_family->released_window = 0;
+    vm_page_family->release_window_ms = now_ms - elapsed % MM_RELEASE_WINDOW_MS;
+}
+
+//pages given back by the family, family lock must be held
+static void
+mm_family_pages_released(vm_page_family_t *vm_page_family, uint32_t pages){
+
+    vm_page_family->stats.pages_held -= pages;
+    vm_page_family->stats.pages_released += pages;
+    mm_family_roll_release_window(vm_page_family, mm_now_ms());
+    vm_page_family->released_window += pages;
+}
+
+//pages released over the last minute, the previous window is weighed by
+//the part of it still within the minute. Family lock must be held
+static uint64_t
+mm_family_pages_released_per_minute(vm_page_family_t *vm_page_family){
+
+    uint64_t now_ms = mm_now_ms();
+    uint64_t elapsed;
+
+    mm_family_roll_release_window(vm_page_family, now_ms);
+    elapsed = now_ms - vm_page_family->release_window_ms;
+
+    return vm_page_family->released_window +
+        (uint64_t)vm_page_family->released_prev_window *
+        (MM_RELEASE_WINDOW_MS - elapsed) / MM_RELEASE_WINDOW_MS;
+}
+
 //theres a hard internally fragmented metablock sandwiched between 2 free meta blocks first and second(returns0 if no internal fragmented blocks)
 static int
 mm_get_hard_internal_memory_frag_size(
@@ -91,20 +551,32 @@ mm_union_free_blocks(block_meta_data_t *first,
     //update data block size
     first->block_size += sizeof(block_meta_data_t) +
         second->block_size;
+    //one of them was just freed, and the meta block of second becomes data
+    first->is_zero = MM_FALSE;
     //update first meta block's next to point to seconds next block
-    first->next_block = second->next_block;
+    SET_NEXT_META_BLOCK(first, NEXT_META_BLOCK(second));
+
+    //second block no longer exists, next fit resumes from first instead
+    vm_page_family_t *vm_page_family =
+        ((vm_page_t *)MM_GET_PAGE_FROM_META_BLOCK(first))->pg_family;
+    if(vm_page_family->next_fit_rover == second)
+        vm_page_family->next_fit_rover = first;
 
     //update previous of next block as long as it isnt null(check is necessary because our block might be the last block )
-    if(second->next_block)
-        second->next_block->prev_block = first;
+    if(NEXT_META_BLOCK(second))
+        SET_PREV_META_BLOCK(NEXT_META_BLOCK(second), first);
 }
 
 //to request fresh new page to add to the front of the linked list O(1)
 vm_page_t *
 allocate_vm_page(vm_page_family_t *vm_page_family){
 
+    vm_bool_t is_zero = MM_FALSE;
     //request fresh new page
-    vm_page_t *vm_page = mm_get_new_vm_page_from_kernel(1);
+    vm_page_t *vm_page = mm_family_get_vm_page(vm_page_family, &is_zero);
+
+    if(!vm_page)
+        return NULL;
    
     //Initialize lower most Meta block of the VM page
     MARK_VM_PAGE_EMPTY(vm_page);
@@ -113,12 +585,21 @@ allocate_vm_page(vm_page_family_t *vm_page_family){
         mm_max_page_allocatable_memory(1);
     vm_page->block_meta_data.offset =
         offset_of(vm_page_t, block_meta_data);
-    init_glthread(&vm_page->block_meta_data.priority_thread_glue);
+    vm_page->block_meta_data.is_zero = is_zero;
+    init_avltree_node(MM_FREE_TREE_NODE(&vm_page->block_meta_data));
     vm_page->next = NULL;
     vm_page->prev = NULL;
 
     //Set the back pointer to page family
     vm_page->pg_family = vm_page_family;
+    vm_page->page_type = MM_PAGE_BLOCKS;
+    __atomic_store_n(&vm_page->sampled_objects, 0, __ATOMIC_RELAXED);
+    //the free block of the page is accounted once added to the tree
+    init_glthread(&vm_page->occupancy_glue);
+    vm_page->free_bytes = 0;
+    vm_page->largest_free = 0;
+    vm_page->fit_offset = 0;
+    vm_page_family->stats.pages_held++;
 
     /*If it is a first VM data page for a given
      * page family*/
@@ -143,6 +624,16 @@ mm_vm_page_delete_and_free(
     vm_page_family_t *vm_page_family =
         vm_page->pg_family;
 
+    remove_glthread(&vm_page->occupancy_glue);
+    mm_family_pages_released(vm_page_family, 1);
+
+    //next fit restarts from the first page if its block goes away
+    if(vm_page_family->next_fit_rover &&
+            MM_GET_PAGE_FROM_META_BLOCK(vm_page_family->next_fit_rover) ==
+            (void *)vm_page){
+        vm_page_family->next_fit_rover = NULL;
+    }
+
     /*If the page being deleted is the head of the linked 
      * list*/
     if(vm_page_family->first_page == vm_page){
@@ -151,7 +642,7 @@ mm_vm_page_delete_and_free(
             vm_page->next->prev = NULL;
         vm_page->next = NULL;
         vm_page->prev = NULL;
-        mm_return_vm_page_to_kernel((void *)vm_page, 1);
+        mm_family_put_vm_page(vm_page_family, (void *)vm_page);
         return;
     }
 
@@ -160,7 +651,7 @@ mm_vm_page_delete_and_free(
     if(vm_page->next)
         vm_page->next->prev = vm_page->prev;
     vm_page->prev->next = vm_page->next;
-    mm_return_vm_page_to_kernel((void *)vm_page, 1);
+    mm_family_put_vm_page(vm_page_family, (void *)vm_page);
 }
 
 //to print the virtual memory details
@@ -170,6 +661,30 @@ mm_print_vm_page_details(vm_page_t *vm_page){
     printf("\t\t next = %p, prev = %p\n", vm_page->next, vm_page->prev);
     printf("\t\t page family = %s\n", vm_page->pg_family->struct_name);
 
+    if(vm_page->page_type == MM_PAGE_SPAN){
+        printf("\t\t\t%-14p Span  %-3u pages  block_size = %-6u\n",
+                &vm_page->block_meta_data, MM_SPAN_PAGES(vm_page),
+                vm_page->block_meta_data.block_size);
+        return;
+    }
+
+    if(vm_page->page_type == MM_PAGE_ARENA){
+        printf("\t\t\tArena %-3u pages  objects = %-4u  used = %u\n",
+                vm_page->arena.pages, vm_page->arena.objects,
+                vm_page->arena.used - (uint32_t)MM_ARENA_DATA_OFFSET);
+        return;
+    }
+
+    if(vm_page->page_type == MM_PAGE_SLAB){
+        printf("\t\t\tSlab  slot_size = %-6u  used slots = %-4u  "
+                "free slots = %u\n",
+                vm_page->pg_family->slab_slot_size,
+                vm_page->slab.used_slots,
+                vm_page->pg_family->slab_slots_per_page -
+                vm_page->slab.used_slots);
+        return;
+    }
+
     uint32_t j = 0;
     block_meta_data_t *curr;
     ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page, curr){
@@ -179,153 +694,739 @@ mm_print_vm_page_details(vm_page_t *vm_page){
                 curr,
                 j++, curr->is_free ? "F R E E D" : "ALLOCATED",
                 curr->block_size, curr->offset,
-                curr->prev_block,
-                curr->next_block);
+                PREV_META_BLOCK(curr),
+                NEXT_META_BLOCK(curr));
     } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page, curr);
 }
 
 
 
-//takes the struct name and size as input to make a page family
-void
-mm_instantiate_new_page_family(
-    char *struct_name,
-    uint32_t struct_size){
+static int
+free_blocks_comparison_function(void *_block_meta_data1,
+        void *_block_meta_data2);
+
+//hash of the struct name, only the first MM_MAX_STRUCT_NAME characters are
+//significant since that is all the page family stores
+static inline uint32_t
+mm_hash_struct_name(char *struct_name){
 
+    uint32_t hash = 5381;
+    uint32_t i = 0;
 
-    //points to the most recent page(initially null)
-    vm_page_family_t *vm_page_family_curr = NULL;
-    vm_page_for_families_t *new_vm_page_for_families = NULL;
+    for(; i < MM_MAX_STRUCT_NAME && struct_name[i]; i++)
+        hash = ((hash << 5) + hash) + (unsigned char)struct_name[i];
 
-    //struct size shouldnt exceed size of system page as this requires 2 or mor contiguous page
-    if(struct_size > SYSTEM_PAGE_SIZE){
-        
-        printf("Error : %s() Structure %s Size exceeds system page size\n",
-            __FUNCTION__, struct_name);
-        return;
+    return hash & (MM_FAMILY_HASH_BUCKETS - 1);
+}
+
+/* Brackets the changes to the hash buckets and to the families in them
+ * which lock free lookups could be reading. The changes are release stores
+ * and lookups read with acquire loads, so a lookup which sees any of them
+ * sees the sequence odd or bumped after. Registry lock must be held*/
+static inline void
+mm_registry_write_begin(){
+
+    __atomic_store_n(&page_family_registry_seq,
+            page_family_registry_seq + 1, __ATOMIC_RELAXED);
+}
+
+static inline void
+mm_registry_write_end(){
+
+    __atomic_store_n(&page_family_registry_seq,
+            page_family_registry_seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Names are written and compared a word at a time, lock free lookups may
+ * read the name of a slot being reused. Names are zero padded to
+ * MM_MAX_STRUCT_NAME and unterminated at that length as with strncpy()*/
+#define MM_STRUCT_NAME_WORDS    (MM_MAX_STRUCT_NAME / sizeof(uint64_t))
+_Static_assert(MM_MAX_STRUCT_NAME % sizeof(uint64_t) == 0 &&
+        offsetof(vm_page_family_t, struct_name) % sizeof(uint64_t) == 0,
+        "struct names are read as whole words");
+
+static void
+mm_struct_name_to_words(char *struct_name,
+        uint64_t words[MM_STRUCT_NAME_WORDS]){
+
+    char *bytes = (char *)words;
+    uint32_t i = 0;
+
+    memset(words, 0, MM_MAX_STRUCT_NAME);
+    for(; i < MM_MAX_STRUCT_NAME && struct_name[i]; i++)
+        bytes[i] = struct_name[i];
+}
+
+static void
+mm_page_family_set_name(vm_page_family_t *vm_page_family,
+        char *struct_name){
+
+    uint64_t words[MM_STRUCT_NAME_WORDS];
+    uint64_t *name = (uint64_t *)vm_page_family->struct_name;
+    uint32_t i = 0;
+
+    mm_struct_name_to_words(struct_name, words);
+    for(; i < MM_STRUCT_NAME_WORDS; i++)
+        __atomic_store_n(&name[i], words[i], __ATOMIC_RELEASE);
+}
+
+static vm_bool_t
+mm_page_family_name_equal(vm_page_family_t *vm_page_family,
+        uint64_t words[MM_STRUCT_NAME_WORDS]){
+
+    uint64_t *name = (uint64_t *)vm_page_family->struct_name;
+    uint32_t i = 0;
+
+    for(; i < MM_STRUCT_NAME_WORDS; i++){
+        if(__atomic_load_n(&name[i], __ATOMIC_ACQUIRE) != words[i])
+            return MM_FALSE;
     }
+    return MM_TRUE;
+}
 
-    //if there is no first page allocatted, allocate it, if it can be alocatted in already existing page, store it in that page otherwise get a new page and store it in the new page also update the linkedlist and make the head as the new page
-    if(!first_vm_page_for_families){
+//a page family with no pages, blocks or per thread families yet, its
+//configuration is left untouched. Registry lock must be held
+static void
+mm_init_page_family_state(vm_page_family_t *vm_page_family){
 
-        //requesting first page
-        first_vm_page_for_families = 
-            (vm_page_for_families_t *)mm_get_new_vm_page_from_kernel(1);
-        first_vm_page_for_families->next = NULL;
-        strncpy(first_vm_page_for_families->vm_page_family[0].struct_name, 
-        struct_name, MM_MAX_STRUCT_NAME);
-        first_vm_page_for_families->vm_page_family[0].struct_size = struct_size;
-        first_vm_page_for_families->vm_page_family[0].first_page = NULL;
-        init_glthread(&first_vm_page_for_families->vm_page_family[0].free_block_priority_list_head);
-        return;
+    uint32_t bin;
+
+    pthread_mutex_init(&vm_page_family->family_lock, NULL);
+    vm_page_family->first_page = NULL;
+    vm_page_family->next_fit_rover = NULL;
+    vm_page_family->first_slab_page = NULL;
+    for(bin = 0; bin < MM_OCCUPANCY_BINS; bin++){
+        init_glthread(&vm_page_family->page_bins[bin]);
+        init_glthread(&vm_page_family->slab_bins[bin]);
     }
+    vm_page_family->page_bins_mask = 0;
+    vm_page_family->slab_bins_mask = 0;
+    vm_page_family->first_span = NULL;
+    vm_page_family->first_arena_page = NULL;
+    __atomic_store_n(&vm_page_family->hash_next, NULL, __ATOMIC_RELEASE);
+    init_glthread(&vm_page_family->page_pool.pages);
+    vm_page_family->page_pool.count = 0;
+    memset(&vm_page_family->stats, 0, sizeof(mm_page_family_stats_t));
+    vm_page_family->release_window_ms = 0;
+    vm_page_family->released_window = 0;
+    vm_page_family->released_prev_window = 0;
+    vm_page_family->parent_family = NULL;
+    vm_page_family->thread_families = NULL;
+    vm_page_family->next_thread_family = NULL;
+    vm_page_family->spare_thread_families = NULL;
+    vm_page_family->next_spare_thread_family = NULL;
+    vm_page_family->pending_frees = NULL;
+    vm_page_family->coalesce_queue = NULL;
+    vm_page_family->next_free_family = NULL;
+    avltree_init(&vm_page_family->free_block_tree,
+            free_blocks_comparison_function,
+            MM_FREE_TREE_NODE_OFFSET);
+}
 
-	vm_page_family_curr = lookup_page_family_by_name(struct_name);
+//fills a free slot of the registry page with the new page family and
+//links it into the hash bucket of its name
+static vm_page_family_t *
+mm_init_page_family(vm_page_family_t *vm_page_family,
+        char *struct_name,
+        uint32_t struct_size){
+
+    uint32_t bucket = mm_hash_struct_name(struct_name);
+
+    //a reused slot may still be read by lookups which walked into it
+    //before it was unlinked
+    mm_registry_write_begin();
+    mm_page_family_set_name(vm_page_family, struct_name);
+    vm_page_family->struct_size = struct_size;
+    vm_page_family->alignment = MM_DEFAULT_ALIGNMENT;
+    vm_page_family->thread_cache = MM_FALSE;
+    vm_page_family->thread_affinity = MM_FALSE;
+    vm_page_family->deferred_coalescing = MM_FALSE;
+    vm_page_family->placement_policy = MM_FULLEST_PAGE_FIT;
+    vm_page_family->slab_mode = MM_FALSE;
+    vm_page_family->page_pool.high_watermark = MM_FAMILY_POOL_HIGH_WATERMARK;
+    vm_page_family->page_pool.low_watermark = MM_FAMILY_POOL_LOW_WATERMARK;
+    mm_init_page_family_state(vm_page_family);
+
+    //publish only the fully initialized family to lock free lookups
+    __atomic_store_n(&vm_page_family->hash_next,
+            page_family_hash_table[bucket], __ATOMIC_RELEASE);
+    __atomic_store_n(&page_family_hash_table[bucket], vm_page_family,
+            __ATOMIC_RELEASE);
+    mm_registry_write_end();
+    return vm_page_family;
+}
 
-	if(vm_page_family_curr) {
-		assert(0);
-	}
+//gives a newly carved page family slot the next id, registry lock must be held
+static vm_bool_t
+mm_page_family_assign_id(vm_page_family_t *vm_page_family){
 
-    //to iterate through the pages, so that we can place the new struct if we already have an existing page with space
-    uint32_t count = 0;
+    uint32_t capacity = page_families_by_id_pages * SYSTEM_PAGE_SIZE /
+        sizeof(vm_page_family_t *);
 
-    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+    if(page_family_count == MM_FAMILY_ID_MAX_SLOTS){
+        printf("Error : No page family slot left\n");
+        return MM_FALSE;
+    }
 
-	    count++;
+    if(page_family_count == capacity){
 
-    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+        uint32_t pages = page_families_by_id_pages ?
+            page_families_by_id_pages * 2 : 1;
+        vm_page_family_t **by_id = mm_get_new_vm_page_from_kernel(pages);
 
-    //if the current pages are already full, request a new page
-    if(count == MAX_FAMILIES_PER_VM_PAGE){
+        if(!by_id)
+            return MM_FALSE;
 
-        new_vm_page_for_families = 
-            (vm_page_for_families_t *)mm_get_new_vm_page_from_kernel(1);
-        new_vm_page_for_families->next = first_vm_page_for_families;
-        first_vm_page_for_families = new_vm_page_for_families;
+        if(page_families_by_id){
+            memcpy(by_id, page_families_by_id,
+                    page_family_count * sizeof(vm_page_family_t *));
+            mm_return_vm_page_to_kernel(page_families_by_id,
+                    page_families_by_id_pages);
+        }
+        page_families_by_id = by_id;
+        page_families_by_id_pages = pages;
     }
 
-    //count tells where page should be located
-    strncpy(vm_page_family_curr->struct_name, struct_name,
-            MM_MAX_STRUCT_NAME);
-    vm_page_family_curr->struct_size = struct_size;
-    vm_page_family_curr->first_page = NULL;
-    init_glthread(&vm_page_family_curr->free_block_priority_list_head);
+    vm_page_family->family_id = page_family_count;
+    vm_page_family->generation = 0;
+    page_families_by_id[page_family_count++] = vm_page_family;
+    return MM_TRUE;
 }
 
-//to print the registered pages detals
-void
-mm_print_registered_page_families(){
+//takes the struct name and size as input to make a page family, NULL if
+//the name is registered already. Registry lock must be held. O(1), a slot of an unregistered family is reused first,
+//then the next slot of the newest registry page
+static vm_page_family_t *
+mm_register_page_family(
+    char *struct_name,
+    uint32_t struct_size){
 
-    vm_page_family_t *vm_page_family_curr = NULL;
-    vm_page_for_families_t *vm_page_for_families_curr = NULL;
+    vm_page_family_t *vm_page_family = NULL;
+    vm_page_for_families_t *new_vm_page_for_families = NULL;
 
-    for(vm_page_for_families_curr = first_vm_page_for_families;
-            vm_page_for_families_curr;
-            vm_page_for_families_curr = vm_page_for_families_curr->next){
+    if(lookup_page_family_by_name(struct_name)){
+        printf("Error : Structure %s is already registered\n", struct_name);
+        return NULL;
+    }
 
-        ITERATE_PAGE_FAMILIES_BEGIN(vm_page_for_families_curr,
-                vm_page_family_curr){
+    //the slot keeps its index, its generation was bumped on unregistration
+    if(free_page_families){
+        vm_page_family = free_page_families;
+        free_page_families = vm_page_family->next_free_family;
+        if(!free_page_families)
+            free_page_families_tail = NULL;
+        return mm_init_page_family(vm_page_family, struct_name, struct_size);
+    }
 
-            printf("Page Family : %s, Size = %u\n",
-                    vm_page_family_curr->struct_name,
-                    vm_page_family_curr->struct_size);
+    //structs bigger than a system page are always allocated as spans of
+    //contiguous pages
+    //if there is no registry page or the newest one is full, get a new page and make it the head of the list
+    if(!first_vm_page_for_families ||
+            first_vm_page_for_families->families_count ==
+            MAX_FAMILIES_PER_VM_PAGE){
 
-        } ITERATE_PAGE_FAMILIES_END(vm_page_for_families_curr,
-                vm_page_family_curr);
+        new_vm_page_for_families =
+            (vm_page_for_families_t *)mm_get_new_vm_page_from_kernel(1);
+        if(!new_vm_page_for_families)
+            return NULL;
+        new_vm_page_for_families->next = first_vm_page_for_families;
+        new_vm_page_for_families->families_count = 0;
+        first_vm_page_for_families = new_vm_page_for_families;
     }
+
+    vm_page_family = &first_vm_page_for_families->vm_page_family[
+        first_vm_page_for_families->families_count];
+    if(!mm_page_family_assign_id(vm_page_family))
+        return NULL;
+    first_vm_page_for_families->families_count++;
+    return mm_init_page_family(vm_page_family, struct_name, struct_size);
 }
 
-//to compare for worst fit
-static int
-free_blocks_comparison_function(
-        void *_block_meta_data1,
-        void *_block_meta_data2){
+//returns the page family which can be used as a handle for XCALLOC_H()
+vm_page_family_t *
+mm_instantiate_new_page_family(
+    char *struct_name,
+    uint32_t struct_size){
 
-    block_meta_data_t *block_meta_data1 =
-        (block_meta_data_t *)_block_meta_data1;
+    vm_page_family_t *vm_page_family = NULL;
 
-    block_meta_data_t *block_meta_data2 =
-        (block_meta_data_t *)_block_meta_data2;
+    if(!struct_size){
+        printf("Error : Structure %s has no size\n", struct_name);
+        return NULL;
+    }
 
-    if(block_meta_data1->block_size > block_meta_data2->block_size)
-        return -1;
-    else if(block_meta_data1->block_size < block_meta_data2->block_size)
-        return 1;
-    return 0;
+    pthread_mutex_lock(&page_family_registry_lock);
+    vm_page_family = mm_register_page_family(struct_name, struct_size);
+    pthread_mutex_unlock(&page_family_registry_lock);
+    return vm_page_family;
 }
 
-static void
-mm_add_free_block_meta_data_to_free_block_list(
+mm_page_family_handle_t
+mm_page_family_set_placement_policy(
         vm_page_family_t *vm_page_family,
-        block_meta_data_t *free_block){
+        mm_placement_policy_t placement_policy){
 
-    assert(free_block->is_free == MM_TRUE);
-    glthread_priority_insert(&vm_page_family->free_block_priority_list_head,
-            &free_block->priority_thread_glue,
-            free_blocks_comparison_function,
-            offset_of(block_meta_data_t, priority_thread_glue));
+    if(!vm_page_family)
+        return NULL;
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    vm_page_family->placement_policy = placement_policy;
+    vm_page_family->next_fit_rover = NULL;
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    return vm_page_family;
 }
 
-static vm_page_t *
-mm_family_new_page_add(vm_page_family_t *vm_page_family){
+mm_page_family_handle_t
+mm_page_family_set_page_pool(
+        vm_page_family_t *vm_page_family,
+        uint32_t high_watermark,
+        uint32_t low_watermark){
 
-    vm_page_t *vm_page = allocate_vm_page(vm_page_family);
+    uint64_t now_ms = mm_now_ms();
+    glthread_t released;
 
-    if(!vm_page)
+    if(!vm_page_family)
         return NULL;
 
-    /* The new page is like one free block, add it to the
-     * free block list*/
-    mm_add_free_block_meta_data_to_free_block_list(
-            vm_page_family, &vm_page->block_meta_data);
+    if(low_watermark > high_watermark)
+        low_watermark = high_watermark;
 
-    return vm_page;
+    init_glthread(&released);
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    vm_page_family->page_pool.high_watermark = high_watermark;
+    vm_page_family->page_pool.low_watermark = low_watermark;
+    mm_page_pool_shrink(&vm_page_family->page_pool, high_watermark,
+            now_ms, &released);
+    if(!IS_GLTHREAD_LIST_EMPTY(&released))
+        mm_global_page_pool_take(&released, now_ms);
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    return vm_page_family;
 }
 
-/* Fn to mark block_meta_data as being Allocated for
- * 'size' bytes of application data. Return TRUE if 
- * block allocation succeeds*/
-//3 argumnets: pointer to the base family, pointer to meta block of free data block, size of memory requested by application
+void
+mm_set_global_page_pool(uint32_t high_watermark,
+        uint32_t low_watermark){
+
+    glthread_t released;
+
+    if(low_watermark > high_watermark)
+        low_watermark = high_watermark;
+
+    init_glthread(&released);
+
+    pthread_mutex_lock(&global_page_pool_lock);
+    global_page_pool.high_watermark = high_watermark;
+    global_page_pool.low_watermark = low_watermark;
+    pthread_mutex_unlock(&global_page_pool_lock);
+
+    //an empty released list just trims the global pool
+    mm_global_page_pool_take(&released, mm_now_ms());
+}
+
+void
+mm_set_page_pool_decay(uint32_t decay_ms){
+
+    __atomic_store_n(&page_pool_decay_ms, decay_ms, __ATOMIC_RELAXED);
+}
+
+void
+mm_page_pool_purge(){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+    vm_page_family_t *thread_family = NULL;
+    glthread_t *glthread = NULL;
+    glthread_t released;
+
+    init_glthread(&released);
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family_curr, thread_family){
+
+            pthread_mutex_lock(&thread_family->family_lock);
+            mm_page_pool_shrink(&thread_family->page_pool, 0, 0,
+                    &released);
+            pthread_mutex_unlock(&thread_family->family_lock);
+        } ITERATE_THREAD_FAMILIES_END(vm_page_family_curr, thread_family);
+
+    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_mutex_unlock(&page_family_registry_lock);
+
+    pthread_mutex_lock(&global_page_pool_lock);
+    mm_page_pool_shrink(&global_page_pool, 0, 0, &released);
+    pthread_mutex_unlock(&global_page_pool_lock);
+
+    ITERATE_GLTHREAD_BEGIN(&released, glthread){
+
+        mm_return_vm_page_to_kernel(
+                (void *)glthread_to_pooled_page(glthread), 1);
+    } ITERATE_GLTHREAD_END(&released, glthread);
+}
+
+mm_placement_policy_t
+mm_page_family_get_placement_policy(vm_page_family_t *vm_page_family){
+
+    return vm_page_family->placement_policy;
+}
+
+//to print the registered pages detals
+void
+mm_print_registered_page_families(){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        printf("Page Family : %s, Size = %u\n",
+                vm_page_family_curr->struct_name,
+                vm_page_family_curr->struct_size);
+
+    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_mutex_unlock(&page_family_registry_lock);
+}
+
+//orders free blocks by size, smallest first
+static int
+free_blocks_comparison_function(
+        void *_block_meta_data1,
+        void *_block_meta_data2){
+
+    block_meta_data_t *block_meta_data1 =
+        (block_meta_data_t *)_block_meta_data1;
+
+    block_meta_data_t *block_meta_data2 =
+        (block_meta_data_t *)_block_meta_data2;
+
+    if(block_meta_data1->block_size < block_meta_data2->block_size)
+        return -1;
+    else if(block_meta_data1->block_size > block_meta_data2->block_size)
+        return 1;
+    return 0;
+}
+
+//compares a free block with the requested size(key)
+static int
+free_block_size_comparison_function(
+        void *_block_meta_data,
+        void *_req_size){
+
+    block_meta_data_t *block_meta_data =
+        (block_meta_data_t *)_block_meta_data;
+    uint32_t req_size = *(uint32_t *)_req_size;
+
+    if(block_meta_data->block_size < req_size)
+        return -1;
+    else if(block_meta_data->block_size > req_size)
+        return 1;
+    return 0;
+}
+
+_Static_assert(MM_OCCUPANCY_BINS <= 32,
+        "a bit of the bins mask for every occupancy bin");
+
+//moves a page to the head of an occupancy bin unless it is in that bin
+//already. The bins mask has the bit of every bin which may hold pages,
+//bits of bins left empty are cleared only when looked at
+static inline void
+mm_occupancy_bin_move(glthread_t *bins, uint32_t *bins_mask,
+        uint32_t bin, vm_page_t *vm_page){
+
+    if(MM_VM_PAGE_IN_OCCUPANCY_BIN(vm_page) && vm_page->occupancy_bin == bin)
+        return;
+
+    remove_glthread(&vm_page->occupancy_glue);
+    glthread_add_next(&bins[bin], &vm_page->occupancy_glue);
+    vm_page->occupancy_bin = bin;
+    *bins_mask |= 1u << bin;
+}
+
+//fullest bin holding pages, -1 if none
+static inline int
+mm_occupancy_fullest_bin(glthread_t *bins, uint32_t *bins_mask){
+
+    int bin;
+
+    while(*bins_mask){
+        bin = 31 - __builtin_clz(*bins_mask);
+        if(BASE(&bins[bin]))
+            return bin;
+        *bins_mask &= ~(1u << bin);
+    }
+    return -1;
+}
+
+//occupancy bin of a meta block page, 0 for the emptiest pages
+static inline uint32_t
+mm_vm_page_occupancy_bin(vm_page_t *vm_page){
+
+    return (mm_max_page_allocatable_memory(1) - vm_page->free_bytes) >>
+        page_occupancy_shift;
+}
+
+//rebins a meta block page once an allocation or free from it is done, not
+//on every free block added or removed on the way. A page with no free
+//block big enough for one unit of the family is no candidate for
+//allocation and leaves the bins
+static void
+mm_vm_page_update_occupancy_bin(vm_page_family_t *vm_page_family,
+        vm_page_t *vm_page){
+
+    if(vm_page->largest_free < vm_page_family->struct_size){
+        remove_glthread(&vm_page->occupancy_glue);
+        return;
+    }
+
+    mm_occupancy_bin_move(vm_page_family->page_bins,
+            &vm_page_family->page_bins_mask,
+            mm_vm_page_occupancy_bin(vm_page), vm_page);
+}
+
+//every free block enters and leaves the tree through these two, which
+//keep the free bytes of its page up to date
+static void
+mm_add_free_block_meta_data_to_free_block_list(
+        vm_page_family_t *vm_page_family,
+        block_meta_data_t *free_block){
+
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_META_BLOCK(free_block);
+
+    assert(free_block->is_free == MM_TRUE);
+    avltree_insert(&vm_page_family->free_block_tree,
+            MM_FREE_TREE_NODE(free_block));
+
+    vm_page->free_bytes += free_block->block_size;
+    if(free_block->block_size > vm_page->largest_free)
+        vm_page->largest_free = free_block->block_size;
+    //the last block freed or split off is the likeliest to fit next
+    vm_page->fit_offset = free_block->offset;
+}
+
+static void
+mm_remove_free_block_meta_data_from_free_block_list(
+        vm_page_family_t *vm_page_family,
+        block_meta_data_t *free_block){
+
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_META_BLOCK(free_block);
+
+    //blocks just freed in a batch are not in the tree yet
+    if(!AVLTREE_IS_NODE_IN_TREE(MM_FREE_TREE_NODE(free_block)))
+        return;
+
+    avltree_remove(&vm_page_family->free_block_tree,
+            MM_FREE_TREE_NODE(free_block));
+
+    vm_page->free_bytes -= free_block->block_size;
+    //still an upper bound of the biggest free block left
+    if(vm_page->largest_free > vm_page->free_bytes)
+        vm_page->largest_free = vm_page->free_bytes;
+    if(vm_page->fit_offset == free_block->offset)
+        vm_page->fit_offset = 0;
+}
+
+block_meta_data_t *
+mm_get_best_fit_free_block_page_family(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size){
+
+    avltree_node_t *node = avltree_lower_bound(
+            &vm_page_family->free_block_tree, &req_size,
+            free_block_size_comparison_function);
+
+    return node ? avltree_to_block_meta_data(node) : NULL;
+}
+
+block_meta_data_t *
+mm_get_first_fit_free_block_page_family(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size){
+
+    avltree_node_t *node = avltree_lowest_address_lower_bound(
+            &vm_page_family->free_block_tree, &req_size,
+            free_block_size_comparison_function);
+
+    return node ? avltree_to_block_meta_data(node) : NULL;
+}
+
+//scans blocks from 'block' to the end of the page list, stops at 'stop_block'
+static block_meta_data_t *
+mm_next_fit_scan(vm_page_t *vm_page,
+        block_meta_data_t *block,
+        block_meta_data_t *stop_block,
+        uint32_t req_size){
+
+    for(; vm_page; vm_page = vm_page->next){
+
+        if(!block)
+            block = &vm_page->block_meta_data;
+
+        for(; block; block = NEXT_META_BLOCK(block)){
+
+            if(block == stop_block)
+                return NULL;
+
+            if(block->is_free == MM_TRUE && block->block_size >= req_size)
+                return block;
+        }
+    }
+    return NULL;
+}
+
+block_meta_data_t *
+mm_get_next_fit_free_block_page_family(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size){
+
+    block_meta_data_t *rover = vm_page_family->next_fit_rover;
+    block_meta_data_t *block_meta_data = NULL;
+
+    if(!rover){
+        return mm_next_fit_scan(vm_page_family->first_page, NULL,
+                NULL, req_size);
+    }
+
+    //from the rover to the end of the last page
+    block_meta_data = mm_next_fit_scan(
+            (vm_page_t *)MM_GET_PAGE_FROM_META_BLOCK(rover), rover,
+            NULL, req_size);
+
+    if(block_meta_data)
+        return block_meta_data;
+
+    //wrap around, from the first page upto the rover
+    return mm_next_fit_scan(vm_page_family->first_page, NULL,
+            rover, req_size);
+}
+
+//a free block of the page which can hold req_size, the one at fit offset
+//if it does or else the lowest addressed one. Once none does the largest
+//free block of the page is known exactly
+static block_meta_data_t *
+mm_vm_page_find_free_block(vm_page_family_t *vm_page_family,
+        vm_page_t *vm_page,
+        uint32_t req_size){
+
+    block_meta_data_t *block_meta_data = NULL;
+    uint32_t largest_free = 0;
+
+    if(vm_page->fit_offset){
+        block_meta_data = (block_meta_data_t *)
+            ((char *)vm_page + vm_page->fit_offset);
+        assert(block_meta_data->is_free == MM_TRUE);
+        if(block_meta_data->block_size >= req_size)
+            return block_meta_data;
+    }
+
+    ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page, block_meta_data){
+
+        if(block_meta_data->is_free == MM_FALSE)
+            continue;
+        if(block_meta_data->block_size >= req_size)
+            return block_meta_data;
+        if(block_meta_data->block_size > largest_free)
+            largest_free = block_meta_data->block_size;
+    } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page, block_meta_data);
+
+    vm_page->largest_free = largest_free;
+    mm_vm_page_update_occupancy_bin(vm_page_family, vm_page);
+    return NULL;
+}
+
+//free block of the fullest page with room for req_size, so that the
+//emptiest pages get no new blocks and drain. After MM_OCCUPANCY_PROBES
+//pages without room it settles for the best fit block of the family
+static block_meta_data_t *
+mm_get_fullest_page_fit_free_block_page_family(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size){
+
+    glthread_t *curr = NULL;
+    block_meta_data_t *block_meta_data = NULL;
+    uint32_t bins_mask = vm_page_family->page_bins_mask,
+             probes = 0;
+    int bin;
+
+    while((bin = mm_occupancy_fullest_bin(
+                    vm_page_family->page_bins, &bins_mask)) >= 0){
+
+        //pages moved to other bins while probing are not probed again
+        bins_mask &= ~(1u << bin);
+        ITERATE_GLTHREAD_BEGIN(&vm_page_family->page_bins[bin], curr){
+
+            vm_page_t *vm_page = glthread_to_occupancy_vm_page(curr);
+
+            if(vm_page->largest_free >= req_size){
+                block_meta_data = mm_vm_page_find_free_block(
+                        vm_page_family, vm_page, req_size);
+                if(block_meta_data)
+                    return block_meta_data;
+            }
+
+            if(++probes == MM_OCCUPANCY_PROBES){
+                return mm_get_best_fit_free_block_page_family(
+                        vm_page_family, req_size);
+            }
+        } ITERATE_GLTHREAD_END(&vm_page_family->page_bins[bin], curr);
+    }
+    return NULL;
+}
+
+//picks the free block as per the placement policy of the page family, NULL
+//if no free block of the family can hold req_size
+static block_meta_data_t *
+mm_get_free_block_for_allocation(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size){
+
+    block_meta_data_t *block_meta_data = NULL;
+
+    switch(vm_page_family->placement_policy){
+
+        case MM_BEST_FIT:
+            return mm_get_best_fit_free_block_page_family(
+                    vm_page_family, req_size);
+        case MM_FIRST_FIT:
+            return mm_get_first_fit_free_block_page_family(
+                    vm_page_family, req_size);
+        case MM_NEXT_FIT:
+            return mm_get_next_fit_free_block_page_family(
+                    vm_page_family, req_size);
+        case MM_FULLEST_PAGE_FIT:
+            return mm_get_fullest_page_fit_free_block_page_family(
+                    vm_page_family, req_size);
+        case MM_WORST_FIT:
+        default:
+            block_meta_data =
+                mm_get_biggest_free_block_page_family(vm_page_family);
+            if(block_meta_data && block_meta_data->block_size >= req_size)
+                return block_meta_data;
+            return NULL;
+    }
+}
+
+static vm_page_t *
+mm_family_new_page_add(vm_page_family_t *vm_page_family){
+
+    vm_page_t *vm_page = allocate_vm_page(vm_page_family);
+
+    if(!vm_page)
+        return NULL;
+
+    /* The new page is like one free block, add it to the
+     * free block list*/
+    mm_add_free_block_meta_data_to_free_block_list(
+            vm_page_family, &vm_page->block_meta_data);
+    mm_vm_page_update_occupancy_bin(vm_page_family, vm_page);
+
+    return vm_page;
+}
+
+/* Fn to mark block_meta_data as being Allocated for
+ * 'size' bytes of application data. Return TRUE if 
+ * block allocation succeeds*/
+//3 argumnets: pointer to the base family, pointer to meta block of free data block, size of memory requested by application
 
 //internal fragmentation is handled
 //internal fragmentation case1: after allocatting memory, some free memory exists which cant be allocatted to the structure(soft internal fragmentation)- no handling during free
@@ -350,10 +1451,12 @@ mm_split_free_data_block_for_allocation(
     uint32_t remaining_size =
         block_meta_data->block_size - size;
 
+    //once its allocatted remove from free block tree, before the size
+    //(the tree key) is changed
+    mm_remove_free_block_meta_data_from_free_block_list(
+            vm_page_family, block_meta_data);
     block_meta_data->is_free = MM_FALSE;
     block_meta_data->block_size = size;
-    //once its allocatte dremove from priority queue
-    remove_glthread(&block_meta_data->priority_thread_glue);
     /*block_meta_data->offset =  ??*/
 
     //entire free block is used, no residual memory
@@ -364,7 +1467,7 @@ mm_split_free_data_block_for_allocation(
 
     //no more space after allocatting
     /*Case 2 : Partial Split : Soft Internal Fragmentation*/
-    else if(sizeof(block_meta_data_t) < remaining_size &&
+    else if(sizeof(block_meta_data_t) + MM_MIN_DATA_BLOCK_SIZE <= remaining_size &&
             remaining_size < (sizeof(block_meta_data_t) + vm_page_family->struct_size)){
         /*New Meta block is to be created*/
         //initialise the new meta block
@@ -373,10 +1476,12 @@ mm_split_free_data_block_for_allocation(
         next_block_meta_data->block_size =
             remaining_size - sizeof(block_meta_data_t);
 
-        //calculate the offset of the metablock, and also append the metablock to the priority queue
+        //calculate the offset of the metablock, and also append the metablock to the free block tree
         next_block_meta_data->offset = block_meta_data->offset +
             sizeof(block_meta_data_t) + block_meta_data->block_size;
-        init_glthread(&next_block_meta_data->priority_thread_glue);
+        //the rest of a zero block is zero too, only the new meta block is written
+        next_block_meta_data->is_zero = block_meta_data->is_zero;
+        init_avltree_node(MM_FREE_TREE_NODE(next_block_meta_data));
         mm_add_free_block_meta_data_to_free_block_list(
                 vm_page_family, next_block_meta_data);
         //fixes all the linkage problem
@@ -385,7 +1490,7 @@ mm_split_free_data_block_for_allocation(
    
     //hard internal fragmentation
     /*Case 2 : Partial Split : Hard Internal Fragmentation*/
-    else if(remaining_size < sizeof(block_meta_data_t)){
+    else if(remaining_size < sizeof(block_meta_data_t) + MM_MIN_DATA_BLOCK_SIZE){
         /*No need to do anything !!*/
         //the linkages between metablocksare same as before
     }
@@ -399,7 +1504,9 @@ mm_split_free_data_block_for_allocation(
             remaining_size - sizeof(block_meta_data_t);
         next_block_meta_data->offset = block_meta_data->offset +
             sizeof(block_meta_data_t) + block_meta_data->block_size;
-        init_glthread(&next_block_meta_data->priority_thread_glue);
+        //the rest of a zero block is zero too, only the new meta block is written
+        next_block_meta_data->is_zero = block_meta_data->is_zero;
+        init_avltree_node(MM_FREE_TREE_NODE(next_block_meta_data));
         mm_add_free_block_meta_data_to_free_block_list(
                 vm_page_family, next_block_meta_data);
         mm_bind_blocks_for_allocation(block_meta_data, next_block_meta_data);
@@ -409,46 +1516,88 @@ mm_split_free_data_block_for_allocation(
 
 }
 
-void mm_print_memory_usage_stats(vm_page_family_t *vm_page_family) {
-    uint32_t total_memory_allocated = 0;
-    uint32_t total_memory_freed = 0;
-    uint32_t total_memory_in_use = 0;
-    uint32_t total_blocks_allocated = 0;
-    uint32_t total_blocks_freed = 0;
-    uint32_t total_blocks_in_use = 0;
-    // Iterate over all pages in the page family
-    for (vm_page_t *vm_page = vm_page_family->first_page; vm_page != NULL; vm_page = vm_page->next) {
-    // Calculate the address of the first block in the page
-    block_meta_data_t *block = &vm_page->block_meta_data;
-        // Calculate the address of the end of the page
-    block_meta_data_t *end = (block_meta_data_t *)((char *)vm_page + SYSTEM_PAGE_SIZE);
+//carves upto count data blocks of size back to back out of one free block,
+//the remainder goes back to the free block tree only once. Returns the
+//number of blocks carved, at least one
+static uint32_t
+mm_carve_free_data_block(
+        vm_page_family_t *vm_page_family,
+        block_meta_data_t *block_meta_data,
+        uint32_t size,
+        uint32_t count,
+        block_meta_data_t **carved){
 
-    // Iterate over all blocks in the page
-    while (block < end) {
-        total_memory_allocated += block->block_size;
-        total_blocks_allocated++;
+    block_meta_data_t *next_block_meta_data = NULL;
+    uint32_t carved_count = 0;
+    uint32_t remaining_size;
 
-        if (block->is_free) {
-            total_memory_freed += block->block_size;
-            total_blocks_freed++;
-        }
+    assert(block_meta_data->is_free == MM_TRUE &&
+            block_meta_data->block_size >= size);
+
+    mm_remove_free_block_meta_data_from_free_block_list(
+            vm_page_family, block_meta_data);
+
+    while(1){
+
+        remaining_size = block_meta_data->block_size - size;
+        block_meta_data->is_free = MM_FALSE;
+        block_meta_data->block_size = size;
+        carved[carved_count++] = block_meta_data;
+
+        //hard internal fragmentation, nothing left to carve or to free
+        if(remaining_size < sizeof(block_meta_data_t) + MM_MIN_DATA_BLOCK_SIZE)
+            break;
+
+        next_block_meta_data = NEXT_META_BLOCK_BY_SIZE(block_meta_data);
+        next_block_meta_data->is_free = MM_TRUE;
+        next_block_meta_data->block_size =
+            remaining_size - sizeof(block_meta_data_t);
+        next_block_meta_data->offset = block_meta_data->offset +
+            sizeof(block_meta_data_t) + block_meta_data->block_size;
+        next_block_meta_data->is_zero = block_meta_data->is_zero;
+        init_avltree_node(MM_FREE_TREE_NODE(next_block_meta_data));
+        mm_bind_blocks_for_allocation(block_meta_data, next_block_meta_data);
 
-        // Calculate the address of the next block
-        block = (block_meta_data_t *)((char *)block + sizeof(block_meta_data_t) + block->block_size);
+        if(carved_count == count || next_block_meta_data->block_size < size){
+            mm_add_free_block_meta_data_to_free_block_list(
+                    vm_page_family, next_block_meta_data);
+            break;
+        }
+        block_meta_data = next_block_meta_data;
     }
+
+    vm_page_family->next_fit_rover = block_meta_data;
+    mm_vm_page_update_occupancy_bin(vm_page_family,
+            MM_GET_PAGE_FROM_META_BLOCK(block_meta_data));
+    return carved_count;
 }
-    total_memory_in_use = total_memory_allocated - total_memory_freed;
-    total_blocks_in_use = total_blocks_allocated - total_blocks_freed;
 
-    printf("Total memory allocated: %u\n", total_memory_allocated);
-    printf("Total memory freed: %u\n", total_memory_freed);
-    printf("Total memory in use: %u\n", total_memory_in_use);
-    printf("Total blocks allocated: %u\n", total_blocks_allocated);
-    printf("Total blocks freed: %u\n", total_blocks_freed);
-    printf("Total blocks in use: %u\n", total_blocks_in_use);
+//prints the counters of the page family, only on explicit request
+void
+mm_print_memory_usage_stats(vm_page_family_t *vm_page_family){
+
+    mm_page_family_stats_t stats;
+
+    mm_get_page_family_stats(vm_page_family, &stats);
+
+    printf("%s :\n", vm_page_family->struct_name);
+    printf("Total memory in use: %lu\n", (unsigned long)stats.bytes_in_use);
+    printf("Peak memory in use: %lu\n", (unsigned long)stats.peak_bytes_in_use);
+    printf("Total blocks in use: %lu\n", (unsigned long)stats.blocks_in_use);
+    printf("Total VM pages held: %lu\n", (unsigned long)stats.pages_held);
+    printf("Total VM pages retained: %lu\n", (unsigned long)stats.pages_retained);
+    printf("Total VM pages released: %lu\n", (unsigned long)stats.pages_released);
+    printf("VM pages released per minute: %lu\n",
+            (unsigned long)stats.pages_released_per_minute);
+    printf("Total blocks allocated: %lu\n", (unsigned long)stats.alloc_count);
+    printf("Total blocks freed: %lu\n", (unsigned long)stats.free_count);
+    printf("Total bytes zeroed: %lu\n", (unsigned long)stats.bytes_zeroed);
     printf("\n");
 }
 
+static uint32_t
+mm_family_coalesce_pending(vm_page_family_t *pg_family, uint32_t budget);
+
 //allocate free data block for use by the application, returns the starting address of the metablock which guards the data block
 static block_meta_data_t *
 mm_allocate_free_data_block(
@@ -459,149 +1608,336 @@ mm_allocate_free_data_block(
     vm_page_t *vm_page = NULL;
     block_meta_data_t *block_meta_data = NULL;
 
-    block_meta_data_t *biggest_block_meta_data =
-        mm_get_biggest_free_block_page_family(vm_page_family);
+    //deferred frees are paid for a few at a time by allocations
+    mm_family_coalesce_pending(vm_page_family, MM_COALESCE_STEP);
+
+    block_meta_data =
+        mm_get_free_block_for_allocation(vm_page_family, req_size);
+
+    //all pending frees may add up to a big enough block, cheaper than a page
+    if(!block_meta_data &&
+            mm_family_coalesce_pending(vm_page_family, UINT32_MAX)){
+        block_meta_data =
+            mm_get_free_block_for_allocation(vm_page_family, req_size);
+    }
 
-    //if theres no free block or existing free block isnt enough
-    if(!biggest_block_meta_data ||
-            biggest_block_meta_data->block_size < req_size){
+    //if theres no free block big enough as per the placement policy
+    if(!block_meta_data){
 
         //Time to add a new page to Page family to satisfy the request
         vm_page = mm_family_new_page_add(vm_page_family);
 
-        //Allocate the free block from this page now, splits the data block to allocate it
-        status = mm_split_free_data_block_for_allocation(vm_page_family,
-                &vm_page->block_meta_data, req_size);
-
-        if(status){
-            mm_print_memory_usage_stats(vm_page_family);
-            return &vm_page->block_meta_data;
-        }
+        if(!vm_page)
+            return NULL;
 
-        return NULL;
-    }
-    //The biggest block meta data can satisfy the request, this is the metablock we want to allocate
-    if(biggest_block_meta_data){
-        status = mm_split_free_data_block_for_allocation(vm_page_family,
-                biggest_block_meta_data, req_size);
+        block_meta_data = &vm_page->block_meta_data;
     }
 
+    //Allocate the free block found, splits the data block to allocate it
+    status = mm_split_free_data_block_for_allocation(vm_page_family,
+            block_meta_data, req_size);
+
     if(status){
-        mm_print_memory_usage_stats(vm_page_family);
-        return biggest_block_meta_data;
+        vm_page_family->next_fit_rover = block_meta_data;
+        mm_vm_page_update_occupancy_bin(vm_page_family,
+                MM_GET_PAGE_FROM_META_BLOCK(block_meta_data));
+        return block_meta_data;
     }
 
     return NULL;
 }
 
-vm_page_family_t *
-lookup_page_family_by_name(char *struct_name){
+/* Slab pages : a slab page is carved into slots of slab_slot_size
+ * bytes with no meta block in front of them. Free slots are linked
+ * through their first word, slots never handed out yet are carved from
+ * the page by bumping carved_slots. Both alloc and free are O(1)*/
 
-    vm_page_family_t *vm_page_family_curr = NULL;
-    vm_page_for_families_t *vm_page_for_families_curr = NULL;
+//slot size and first slot of the slab pages as per the alignment of the
+//page family, family lock must be held
+static void
+mm_family_update_slab_geometry(vm_page_family_t *vm_page_family){
+
+    uint32_t alignment = vm_page_family->alignment;
+    uint32_t slot_size = vm_page_family->struct_size;
+
+    //slot must be able to hold the free list link
+    if(alignment < sizeof(void *))
+        alignment = sizeof(void *);
+    if(slot_size < sizeof(void *))
+        slot_size = sizeof(void *);
+    slot_size = (slot_size + alignment - 1) & ~(alignment - 1);
+
+    vm_page_family->slab_slot_size = slot_size;
+    vm_page_family->slab_slots_offset =
+        (offset_of(vm_page_t, page_memory) + alignment - 1) & ~(alignment - 1);
+    vm_page_family->slab_slots_per_page =
+        (SYSTEM_PAGE_SIZE - vm_page_family->slab_slots_offset) / slot_size;
+    vm_page_family->slab_occupancy_scale =
+        vm_page_family->slab_slots_per_page ?
+        ((uint64_t)MM_OCCUPANCY_BINS << 32) /
+        vm_page_family->slab_slots_per_page : 0;
+}
 
-    for(vm_page_for_families_curr = first_vm_page_for_families;
-            vm_page_for_families_curr;
-            vm_page_for_families_curr = vm_page_for_families_curr->next){
+//occupancy bin of a slab page with used_slots slots in use, no division on
+//the alloc and free paths
+static inline uint32_t
+mm_slab_occupancy_bin(vm_page_family_t *vm_page_family, uint32_t used_slots){
 
-        ITERATE_PAGE_FAMILIES_BEGIN(vm_page_for_families_curr, vm_page_family_curr){
+    return (uint32_t)((used_slots * vm_page_family->slab_occupancy_scale) >> 32);
+}
 
-            if(strncmp(vm_page_family_curr->struct_name,
-                        struct_name,
-                        MM_MAX_STRUCT_NAME) == 0){
+mm_page_family_handle_t
+mm_page_family_set_slab_mode(
+        vm_page_family_t *vm_page_family,
+        vm_bool_t slab_mode){
 
-                return vm_page_family_curr;
-            }
-        } ITERATE_PAGE_FAMILIES_END(vm_page_for_families_curr, vm_page_family_curr);
-    }
-    return NULL;
-}
+    if(!vm_page_family)
+        return NULL;
 
-// In your memory management system
-void mm_check_for_leaks() {
-    int leak_detected = 0; // Flag to track if a leak is detected
-        // Traverse the linked list of allocated blocks
-    for (Allocation *block = head; block != NULL; block = block->next) {
-        // If the block was not freed, print a warning message
-        if (!block->freed) {
-            printf("Warning: Memory leak detected. Block of size %lu was not freed.\n", block->size);
-            leak_detected = 1; // Set the flag to true
-        }
-    }
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    mm_family_update_slab_geometry(vm_page_family);
 
-    // If no leak was detected, print a message
-    if (!leak_detected) {
-        printf("No memory leaks detected.\n");
-    }
+    //existing slab pages keep serving frees even if slab mode is turned off
+    vm_page_family->slab_mode = slab_mode;
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    return vm_page_family;
 }
 
-/* The public fn to be invoked by the application for Dynamic
- * Memory Allocations.*/
-void *
-xcalloc(char *struct_name, int units){
+mm_page_family_handle_t
+mm_page_family_set_alignment(
+        vm_page_family_t *vm_page_family,
+        uint32_t alignment){
 
-    //search for a page family corresponding to a structure 
-     vm_page_family_t *pg_family =
-             lookup_page_family_by_name(struct_name);
+    if(!vm_page_family)
+        return NULL;
 
-    //return null if page doesnt exist
-     if(!pg_family){
+    if(alignment < sizeof(void *))
+        alignment = sizeof(void *);
 
-         printf("Error : Structure %s not registered with Memory Manager\n",
-                 struct_name);
-         return NULL;
-     }
+    if(alignment > MM_MAX_ALIGNMENT || (alignment & (alignment - 1))){
+        printf("Error : Invalid alignment %u for %s\n",
+                alignment, vm_page_family->struct_name);
+        return NULL;
+    }
 
-    //check if memory which app wants can be given by the existing vm page
-     if(units * pg_family->struct_size > MAX_PAGE_ALLOCATABLE_MEMORY(1)){
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    //free blocks carved as per the old alignment would break the new one
+    if(vm_page_family->first_page || vm_page_family->first_slab_page ||
+            vm_page_family->first_span){
+        pthread_mutex_unlock(&vm_page_family->family_lock);
+        printf("Error : Alignment of %s can only be set before allocating from it\n",
+                vm_page_family->struct_name);
+        return NULL;
+    }
+    vm_page_family->alignment = alignment;
+    mm_family_update_slab_geometry(vm_page_family);
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    return vm_page_family;
+}
 
-         printf("Error : Memory Requested Exceeds Page Size\n");
-         return NULL;
-     }
-     
-     //Find the page which can satisfy the request
-     block_meta_data_t *free_block_meta_data = NULL;
+uint32_t
+mm_page_family_get_alignment(vm_page_family_t *vm_page_family){
 
-    //allocate the free data block which was found
-     free_block_meta_data = mm_allocate_free_data_block(
-             pg_family, units * pg_family->struct_size);
+    return vm_page_family->alignment;
+}
 
+static vm_page_t *
+mm_family_new_slab_page_add(vm_page_family_t *vm_page_family){
 
-     if(free_block_meta_data){
-         memset((char *)(free_block_meta_data + 1), 0, 
-         free_block_meta_data->block_size);
-          // Record the allocation
-        Allocation* alloc = (Allocation*)malloc(sizeof(Allocation));
-        alloc->ptr = (void *)(free_block_meta_data + 1);
-        alloc->size = free_block_meta_data->block_size;
-        alloc->freed = 0; // Mark the block as not freed
-        alloc->next = head;
-        head = alloc;
+    vm_bool_t is_zero = MM_FALSE;
+    vm_page_t *vm_page = mm_family_get_vm_page(vm_page_family, &is_zero);
 
-         return  (void *)(free_block_meta_data + 1);
-     }
+    if(!vm_page)
+        return NULL;
+
+    vm_page->pg_family = vm_page_family;
+    vm_page->page_type = MM_PAGE_SLAB;
+    __atomic_store_n(&vm_page->sampled_objects, 0, __ATOMIC_RELAXED);
+    vm_page_family->stats.pages_held++;
+    vm_page->slab.used_slots = 0;
+    vm_page->slab.carved_slots = 0;
+    vm_page->slab.free_list = NULL;
+    vm_page->slab.is_zero = is_zero;
+    init_glthread(&vm_page->occupancy_glue);
+
+    //insert to the head of slab page list
+    vm_page->prev = NULL;
+    vm_page->next = vm_page_family->first_slab_page;
+    if(vm_page_family->first_slab_page)
+        vm_page_family->first_slab_page->prev = vm_page;
+    vm_page_family->first_slab_page = vm_page;
 
-     return NULL;
+    mm_occupancy_bin_move(vm_page_family->slab_bins,
+            &vm_page_family->slab_bins_mask, 0, vm_page);
+    return vm_page;
 }
 
-//argument: metablock to be freed address, returns meta block which should be formedafter all the merging
-static block_meta_data_t *
-mm_free_blocks(block_meta_data_t *to_be_free_block){
+static void
+mm_slab_page_delete_and_free(vm_page_t *vm_page){
 
-    block_meta_data_t *return_block = NULL;
+    vm_page_family_t *vm_page_family = vm_page->pg_family;
 
-    assert(to_be_free_block->is_free == MM_FALSE);
-    //pointer to page where metablock resides
-    vm_page_t *hosting_page =
-        MM_GET_PAGE_FROM_META_BLOCK(to_be_free_block);
+    remove_glthread(&vm_page->occupancy_glue);
+    mm_family_pages_released(vm_page_family, 1);
 
-    //pointer to virtuial page family
-    vm_page_family_t *vm_page_family = hosting_page->pg_family;
+    if(vm_page_family->first_slab_page == vm_page)
+        vm_page_family->first_slab_page = vm_page->next;
+    if(vm_page->next)
+        vm_page->next->prev = vm_page->prev;
+    if(vm_page->prev)
+        vm_page->prev->next = vm_page->next;
 
-    return_block = to_be_free_block;
+    mm_family_put_vm_page(vm_page_family, (void *)vm_page);
+}
 
-    //mark as free
-    to_be_free_block->is_free = MM_TRUE;
+static void *
+mm_slab_allocate(vm_page_family_t *vm_page_family, vm_bool_t *is_zero){
+
+    vm_page_t *vm_page = NULL;
+    void *slot = NULL;
+    int bin;
+
+    //the fullest page with a free slot, the emptiest ones drain
+    bin = mm_occupancy_fullest_bin(vm_page_family->slab_bins,
+            &vm_page_family->slab_bins_mask);
+    if(bin >= 0){
+        vm_page = glthread_to_occupancy_vm_page(
+                BASE(&vm_page_family->slab_bins[bin]));
+    }
+    else{
+        vm_page = mm_family_new_slab_page_add(vm_page_family);
+        if(!vm_page)
+            return NULL;
+    }
+
+    if(vm_page->slab.free_list){
+        slot = vm_page->slab.free_list;
+        vm_page->slab.free_list = *(void **)slot;
+        *is_zero = MM_FALSE;
+    }
+    else{
+        slot = (char *)vm_page + vm_page_family->slab_slots_offset +
+            (vm_page->slab.carved_slots++ * vm_page_family->slab_slot_size);
+        *is_zero = vm_page->slab.is_zero;
+    }
+
+    vm_page->slab.used_slots++;
+
+    //page is full, no longer a candidate for allocation
+    if(vm_page->slab.used_slots == vm_page_family->slab_slots_per_page){
+        remove_glthread(&vm_page->occupancy_glue);
+    }
+    else{
+        mm_occupancy_bin_move(vm_page_family->slab_bins,
+                &vm_page_family->slab_bins_mask,
+                mm_slab_occupancy_bin(vm_page_family,
+                    vm_page->slab.used_slots), vm_page);
+    }
+
+    return slot;
+}
+
+static void
+mm_slab_free(vm_page_t *vm_page, void *slot){
+
+    vm_page_family_t *vm_page_family = vm_page->pg_family;
+
+    assert(vm_page->slab.used_slots);
+    assert(((char *)slot - (char *)vm_page -
+                vm_page_family->slab_slots_offset) %
+            vm_page_family->slab_slot_size == 0);
+
+    *(void **)slot = vm_page->slab.free_list;
+    vm_page->slab.free_list = slot;
+    vm_page->slab.used_slots--;
+
+    if(!vm_page->slab.used_slots){
+        mm_slab_page_delete_and_free(vm_page);
+        return;
+    }
+
+    //back in the bins if the page was full
+    mm_occupancy_bin_move(vm_page_family->slab_bins,
+            &vm_page_family->slab_bins_mask,
+            mm_slab_occupancy_bin(vm_page_family, vm_page->slab.used_slots),
+            vm_page);
+}
+
+//lock free, the walk starts over if a family was unlinked or a slot reused
+//meanwhile : the slot may have moved to another bucket or been given
+//another name under it
+vm_page_family_t *
+lookup_page_family_by_name(char *struct_name){
+
+    vm_page_family_t **bucket =
+        &page_family_hash_table[mm_hash_struct_name(struct_name)];
+    vm_page_family_t *vm_page_family_curr = NULL;
+    uint64_t words[MM_STRUCT_NAME_WORDS];
+    uint32_t seq;
+
+    mm_struct_name_to_words(struct_name, words);
+    for(;;){
+
+        seq = __atomic_load_n(&page_family_registry_seq, __ATOMIC_ACQUIRE);
+        if(seq & 1)
+            continue;
+
+        vm_page_family_curr = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+        while(vm_page_family_curr &&
+                !mm_page_family_name_equal(vm_page_family_curr, words)){
+
+            vm_page_family_curr = __atomic_load_n(
+                    &vm_page_family_curr->hash_next, __ATOMIC_ACQUIRE);
+        }
+
+        if(__atomic_load_n(&page_family_registry_seq, __ATOMIC_RELAXED) == seq)
+            return vm_page_family_curr;
+    }
+}
+
+vm_page_family_t *
+mm_get_page_family_handle(char *struct_name){
+
+    return lookup_page_family_by_name(struct_name);
+}
+
+uint32_t
+mm_page_family_get_id(vm_page_family_t *vm_page_family){
+
+    return MM_FAMILY_ID(vm_page_family);
+}
+
+uint32_t
+mm_page_family_get_struct_size(vm_page_family_t *vm_page_family){
+
+    return vm_page_family->struct_size;
+}
+
+vm_page_family_t *
+mm_get_page_family_by_id(uint32_t family_id){
+
+    vm_page_family_t *vm_page_family = NULL;
+    uint32_t slot = family_id & (MM_FAMILY_ID_MAX_SLOTS - 1);
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    if(slot < page_family_count)
+        vm_page_family = page_families_by_id[slot];
+    //per thread families, unused slots and the ids of families unregistered
+    //from the slot are not handed out
+    if(vm_page_family && (!vm_page_family->struct_size ||
+                vm_page_family->parent_family ||
+                MM_FAMILY_ID(vm_page_family) != family_id)){
+        vm_page_family = NULL;
+    }
+    pthread_mutex_unlock(&page_family_registry_lock);
+    return vm_page_family;
+}
+
+//the block being freed takes back the hard internally fragmented memory
+//left behind it when it was allocated
+static void
+mm_reclaim_hard_internal_frag(vm_page_t *hosting_page,
+        block_meta_data_t *to_be_free_block){
 
     //obtaining address of next metablock
     block_meta_data_t *next_block = NEXT_META_BLOCK(to_be_free_block);
@@ -632,11 +1968,40 @@ mm_free_blocks(block_meta_data_t *to_be_free_block){
         //add internal fragmented memory to the now freed block
         to_be_free_block->block_size += internal_mem_fragmentation;
     }
+}
+
+//argument: metablock to be freed address, returns meta block which should be formedafter all the merging
+static block_meta_data_t *
+mm_free_blocks(block_meta_data_t *to_be_free_block){
+
+    block_meta_data_t *return_block = NULL;
+
+    assert(to_be_free_block->is_free == MM_FALSE);
+    //pointer to page where metablock resides
+    vm_page_t *hosting_page =
+        MM_GET_PAGE_FROM_META_BLOCK(to_be_free_block);
+
+    //pointer to virtuial page family
+    vm_page_family_t *vm_page_family = hosting_page->pg_family;
+
+    return_block = to_be_free_block;
+
+    //mark as free, the application has written to it
+    to_be_free_block->is_free = MM_TRUE;
+    to_be_free_block->is_zero = MM_FALSE;
+
+    //obtaining address of next metablock
+    block_meta_data_t *next_block = NEXT_META_BLOCK(to_be_free_block);
+
+    mm_reclaim_hard_internal_frag(hosting_page, to_be_free_block);
 
     //Now perform Merging
     //next block is null and is free, union with current block
     if(next_block && next_block->is_free == MM_TRUE){
-        /*Union two free blocks*/
+        /*Union two free blocks, next block stops being a free block
+         * of its own*/
+        mm_remove_free_block_meta_data_from_free_block_list(
+                vm_page_family, next_block);
         mm_union_free_blocks(to_be_free_block, next_block);
         return_block = to_be_free_block;
     }
@@ -645,6 +2010,9 @@ mm_free_blocks(block_meta_data_t *to_be_free_block){
 
     //prev block is present and prev  block is free
     if(prev_block && prev_block->is_free){
+        //prev block grows so it is reinserted with its new size below
+        mm_remove_free_block_meta_data_from_free_block_list(
+                vm_page_family, prev_block);
         mm_union_free_blocks(prev_block, to_be_free_block);
         return_block = prev_block;
     }
@@ -655,17 +2023,178 @@ mm_free_blocks(block_meta_data_t *to_be_free_block){
         return NULL;
     }
 
-    //add the metablock to the priority queue to make it available for allocation in the future.
+    //add the metablock to the free block tree to make it available for allocation in the future.
     mm_add_free_block_meta_data_to_free_block_list(
             hosting_page->pg_family, return_block);
+    mm_vm_page_update_occupancy_bin(vm_page_family, hosting_page);
 
     return return_block;
 }
 
 
-//argument: pointer to data block which must be dleted
-void
-xfree(void *app_data){
+/* Spans : an allocation too big for one vm page gets its own mapping
+ * of contiguous system pages, sized to the request. The span is laid
+ * out like a vm page with a single allocated data block covering all
+ * of it, and is unmapped as soon as that block is freed*/
+
+static void *
+mm_span_allocate(vm_page_family_t *vm_page_family, uint64_t size){
+
+    uint32_t pages = mm_span_pages_needed(size);
+    vm_page_t *vm_page = mm_get_new_vm_page_from_kernel(pages);
+
+    if(!vm_page)
+        return NULL;
+
+    vm_page->pg_family = vm_page_family;
+    vm_page->page_type = MM_PAGE_SPAN;
+    __atomic_store_n(&vm_page->sampled_objects, 0, __ATOMIC_RELAXED);
+    vm_page_family->stats.pages_held += pages;
+    MARK_VM_PAGE_EMPTY(vm_page);
+    vm_page->block_meta_data.is_free = MM_FALSE;
+    vm_page->block_meta_data.block_size = mm_max_page_allocatable_memory(pages);
+    vm_page->block_meta_data.offset = offset_of(vm_page_t, block_meta_data);
+    vm_page->block_meta_data.is_zero = MM_TRUE;
+    init_avltree_node(MM_FREE_TREE_NODE(&vm_page->block_meta_data));
+
+    //insert to the head of the span list
+    vm_page->prev = NULL;
+    vm_page->next = vm_page_family->first_span;
+    if(vm_page_family->first_span)
+        vm_page_family->first_span->prev = vm_page;
+    vm_page_family->first_span = vm_page;
+
+    return (void *)(&vm_page->block_meta_data + 1);
+}
+
+static void
+mm_span_free(vm_page_t *vm_page){
+
+    vm_page_family_t *vm_page_family = vm_page->pg_family;
+
+    assert(vm_page->block_meta_data.is_free == MM_FALSE);
+    mm_family_pages_released(vm_page_family, MM_SPAN_PAGES(vm_page));
+
+    if(vm_page_family->first_span == vm_page)
+        vm_page_family->first_span = vm_page->next;
+    if(vm_page->next)
+        vm_page->next->prev = vm_page->prev;
+    if(vm_page->prev)
+        vm_page->prev->next = vm_page->next;
+
+    mm_return_vm_page_to_kernel((void *)vm_page, MM_SPAN_PAGES(vm_page));
+}
+
+//block counters of the page family, family lock must be held
+static inline void
+mm_family_account_alloc(vm_page_family_t *pg_family, uint64_t size){
+
+    pg_family->stats.blocks_in_use++;
+    pg_family->stats.bytes_in_use += size;
+    if(pg_family->stats.bytes_in_use > pg_family->stats.peak_bytes_in_use)
+        pg_family->stats.peak_bytes_in_use = pg_family->stats.bytes_in_use;
+}
+
+static inline void
+mm_family_account_free(vm_page_family_t *pg_family, uint64_t size){
+
+    pg_family->stats.blocks_in_use--;
+    pg_family->stats.bytes_in_use -= size;
+}
+
+//data block size for size bytes of the page family, padded so the data
+//block of the next meta block in the page stays aligned
+static inline uint64_t
+mm_family_block_size(vm_page_family_t *pg_family, uint64_t size){
+
+    uint64_t alignment = pg_family->alignment;
+
+    if(size < MM_MIN_DATA_BLOCK_SIZE)
+        size = MM_MIN_DATA_BLOCK_SIZE;
+
+    return ((size + sizeof(block_meta_data_t) + alignment - 1) &
+            ~(alignment - 1)) - sizeof(block_meta_data_t);
+}
+
+//every single unit allocation of the page family, slab slot or data block,
+//is accounted with this size
+static inline uint64_t
+mm_family_unit_block_size(vm_page_family_t *pg_family){
+
+    return mm_family_block_size(pg_family, pg_family->struct_size);
+}
+
+//allocates units of the page family, family lock must be held. is_zero
+//tells whether the data is known to be zero filled already, if the caller
+//is going to zero it(zero) the bytes it has to memset are counted
+static void *
+mm_family_allocate(vm_page_family_t *pg_family,
+        int units,
+        vm_bool_t zero,
+        vm_bool_t *is_zero){
+
+     block_meta_data_t *free_block_meta_data = NULL;
+     uint64_t size = (uint64_t)units * pg_family->struct_size;
+     uint64_t block_size = mm_family_block_size(pg_family, size);
+     void *app_data = NULL;
+
+     *is_zero = MM_FALSE;
+
+     //too big for a vm page, give it a span of its own
+     if(block_size > MAX_PAGE_ALLOCATABLE_MEMORY(1)){
+         app_data = mm_span_allocate(pg_family, size);
+         if(app_data){
+             mm_family_account_alloc(pg_family,
+                     ((block_meta_data_t *)app_data - 1)->block_size);
+             *is_zero = MM_TRUE;
+         }
+         return app_data;
+     }
+
+     //single unit of a slab mode family, no meta block needed
+     if(units == 1 && pg_family->slab_mode){
+         app_data = mm_slab_allocate(pg_family, is_zero);
+         block_size = mm_family_unit_block_size(pg_family);
+     }
+     else{
+         //allocate the free data block which was found
+         free_block_meta_data = mm_allocate_free_data_block(
+                 pg_family, (uint32_t)block_size);
+
+         if(free_block_meta_data){
+             app_data = (void *)(free_block_meta_data + 1);
+             *is_zero = free_block_meta_data->is_zero;
+         }
+     }
+
+     if(!app_data)
+         return NULL;
+
+     mm_family_account_alloc(pg_family, block_size);
+     if(zero && !*is_zero)
+         pg_family->stats.bytes_zeroed += size;
+     return app_data;
+}
+
+//returns application data to its page family, family lock must be held
+static void
+mm_family_free(vm_page_t *hosting_page, void *app_data){
+
+    vm_page_family_t *pg_family = hosting_page->pg_family;
+
+    if(hosting_page->page_type == MM_PAGE_SLAB){
+        mm_family_account_free(pg_family,
+                mm_family_unit_block_size(pg_family));
+        mm_slab_free(hosting_page, app_data);
+        return;
+    }
+
+    if(hosting_page->page_type == MM_PAGE_SPAN){
+        mm_family_account_free(pg_family,
+                hosting_page->block_meta_data.block_size);
+        mm_span_free(hosting_page);
+        return;
+    }
 
     //size of meta block=datablock starting address-metablock size
     block_meta_data_t *block_meta_data =
@@ -673,137 +2202,3139 @@ xfree(void *app_data){
 
     //it should be full if we want to delete it
     assert(block_meta_data->is_free == MM_FALSE);
+    mm_family_account_free(pg_family, block_meta_data->block_size);
     //to empty
     mm_free_blocks(block_meta_data);
-
-        // Mark the allocation as freed in the list
-    Allocation* current = head;
-    while (current) {
-        if (current->ptr == app_data) {
-            // Mark the block as freed
-            current->freed = 1;
-            break;
-        } else {
-            current = current->next;
-        }
-    }
 }
-//if next and previous is null and is filled is false then only page is empty
-vm_bool_t
-mm_is_vm_page_empty(vm_page_t *vm_page){
 
-    if(vm_page->block_meta_data.next_block == NULL &&
-            vm_page->block_meta_data.prev_block == NULL &&
-            vm_page->block_meta_data.is_free == MM_TRUE){
+//xfree() of a deferred coalescing family, takes no lock. Data blocks are
+//at least pointer sized so the first word links the pending list
+static inline void
+mm_family_defer_free(vm_page_family_t *pg_family, void *app_data){
 
-        return MM_TRUE;
-    }
-    return MM_FALSE;
+    void *head = __atomic_load_n(&pg_family->pending_frees, __ATOMIC_RELAXED);
+
+    do{
+        *(void **)app_data = head;
+    } while(!__atomic_compare_exchange_n(&pg_family->pending_frees, &head,
+                app_data, MM_TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
+//coalesces upto budget pending frees of the page family, returns the
+//number coalesced. Family lock must be held
+static uint32_t
+mm_family_coalesce_pending(vm_page_family_t *pg_family, uint32_t budget){
 
+    uint32_t coalesced = 0;
+    void *app_data = NULL;
 
-//print meta block data, for each page family prints occupied free meta block, occupied metablock and total metablock(fbc+obc=tbc)
+    while(coalesced < budget){
 
-//appmemusage: (size of metablock=48), size of datablocks+their metablocks, free meta block isnt used in calculation
-void
-mm_print_block_usage(){
+        //take the whole pending list at once, pushes go on a fresh one
+        if(!pg_family->coalesce_queue){
+            if(!__atomic_load_n(&pg_family->pending_frees, __ATOMIC_RELAXED))
+                break;
+            pg_family->coalesce_queue = __atomic_exchange_n(
+                    &pg_family->pending_frees, NULL, __ATOMIC_ACQUIRE);
+        }
 
-    vm_page_t *vm_page_curr;
-    vm_page_family_t *vm_page_family_curr;
-    block_meta_data_t *block_meta_data_curr;
-    uint32_t total_block_count, free_block_count,
-             occupied_block_count;
-    uint32_t application_memory_usage;
+        app_data = pg_family->coalesce_queue;
+        pg_family->coalesce_queue = *(void **)app_data;
+        mm_family_free(MM_GET_PAGE_FROM_DATA(app_data, SYSTEM_PAGE_SIZE),
+                app_data);
+        pg_family->stats.free_count++;
+        coalesced++;
+    }
+    return coalesced;
+}
 
-    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+//allocates count single units of the page family, is_zero tells which of
+//them are known zero. Returns the number allocated, family lock must be held
+static uint32_t
+mm_family_allocate_batch(vm_page_family_t *pg_family,
+        uint32_t count,
+        vm_bool_t zero,
+        void **out,
+        vm_bool_t *is_zero){
+
+    uint64_t block_size =
+        mm_family_block_size(pg_family, pg_family->struct_size);
+    block_meta_data_t *carved[MM_BATCH_CHUNK];
+    block_meta_data_t *block_meta_data = NULL;
+    vm_page_t *vm_page = NULL;
+    uint32_t allocated = 0, carved_count, i;
 
-        total_block_count = 0;
-        free_block_count = 0;
-        application_memory_usage = 0;
-        occupied_block_count = 0;
-        ITERATE_VM_PAGE_BEGIN(vm_page_family_curr, vm_page_curr){
+    assert(count <= MM_BATCH_CHUNK);
+
+    //spans and slab slots have no free block to carve from
+    if(block_size > MAX_PAGE_ALLOCATABLE_MEMORY(1) || pg_family->slab_mode){
+        for(; allocated < count; allocated++){
+            out[allocated] = mm_family_allocate(pg_family, 1, zero,
+                    &is_zero[allocated]);
+            if(!out[allocated])
+                break;
+        }
+        return allocated;
+    }
 
-            ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page_curr, block_meta_data_curr){
+    mm_family_coalesce_pending(pg_family, MM_COALESCE_STEP);
 
-                total_block_count++;
+    while(allocated < count){
 
-                /*Sanity Checks*/
-                if(block_meta_data_curr->is_free == MM_FALSE){
-                    assert(IS_GLTHREAD_LIST_EMPTY(&block_meta_data_curr->\
-                                priority_thread_glue));
-                }
-                if(block_meta_data_curr->is_free == MM_TRUE){
-                    assert(!IS_GLTHREAD_LIST_EMPTY(&block_meta_data_curr->\
-                                priority_thread_glue));
-                }
+        block_meta_data = mm_get_free_block_for_allocation(pg_family,
+                (uint32_t)block_size);
 
-                if(block_meta_data_curr->is_free == MM_TRUE){
-                    free_block_count++;
-                }
-                else{
-                    application_memory_usage +=
-                        block_meta_data_curr->block_size + \
-                        sizeof(block_meta_data_t);
-                    occupied_block_count++;
-                }
-            } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page_curr, block_meta_data_curr);
-        } ITERATE_VM_PAGE_END(vm_page_family_curr, vm_page_curr);
+        if(!block_meta_data &&
+                mm_family_coalesce_pending(pg_family, UINT32_MAX)){
+            block_meta_data = mm_get_free_block_for_allocation(pg_family,
+                    (uint32_t)block_size);
+        }
 
-        printf("%-20s   TBC : %-4u    FBC : %-4u    OBC : %-4u AppMemUsage : %u\n",
-                vm_page_family_curr->struct_name, total_block_count,
-                free_block_count, occupied_block_count, application_memory_usage);
+        if(!block_meta_data){
+            vm_page = mm_family_new_page_add(pg_family);
+            if(!vm_page)
+                break;
+            block_meta_data = &vm_page->block_meta_data;
+        }
 
-    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+        carved_count = mm_carve_free_data_block(pg_family, block_meta_data,
+                (uint32_t)block_size, count - allocated, carved);
+
+        for(i = 0; i < carved_count; i++, allocated++){
+            out[allocated] = (void *)(carved[i] + 1);
+            is_zero[allocated] = carved[i]->is_zero;
+            mm_family_account_alloc(pg_family, block_size);
+            if(zero && !is_zero[allocated])
+                pg_family->stats.bytes_zeroed += pg_family->struct_size;
+        }
+    }
+    return allocated;
 }
 
-//iterates over all pge family, and for all page family it prints all the vm page meta blocks
-void
-mm_print_memory_usage(char *struct_name){
+//frees data blocks of one meta block page, sorted by address. Every run
+//of free blocks they end up in is merged and inserted in the free block
+//tree once. Family lock must be held
+static void
+mm_free_page_blocks(vm_page_t *hosting_page, void **app_data, uint32_t count){
+
+    vm_page_family_t *pg_family = hosting_page->pg_family;
+    block_meta_data_t *block_meta_data = NULL,
+                      *first = NULL,
+                      *next = NULL;
+    char *run_end = NULL;
+    uint32_t i;
+
+    for(i = 0; i < count; i++){
+
+        block_meta_data = (block_meta_data_t *)app_data[i] - 1;
+        assert(block_meta_data->is_free == MM_FALSE);
+        mm_family_account_free(pg_family, block_meta_data->block_size);
+        block_meta_data->is_free = MM_TRUE;
+        block_meta_data->is_zero = MM_FALSE;
+        //not in the tree yet, compact meta blocks keep their node in the data
+        init_avltree_node(MM_FREE_TREE_NODE(block_meta_data));
+        mm_reclaim_hard_internal_frag(hosting_page, block_meta_data);
+    }
 
-    uint32_t i = 0;
-    vm_page_t *vm_page = NULL;
-    vm_page_family_t *vm_page_family_curr;
-    uint32_t number_of_struct_families = 0;
-    uint32_t cumulative_vm_pages_claimed_from_kernel = 0;
+    for(i = 0; i < count; i++){
 
-    printf("\nPage Size = %zu Bytes\n", SYSTEM_PAGE_SIZE);
+        block_meta_data = (block_meta_data_t *)app_data[i] - 1;
 
-    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+        //merged into the run of a lower block already
+        if((char *)block_meta_data < run_end)
+            continue;
 
-        if(struct_name){
-            if(strncmp(struct_name, vm_page_family_curr->struct_name,
-                        strlen(vm_page_family_curr->struct_name))){
-                continue;
-            }
+        //free blocks are never adjacent, so at most one free block before
+        first = block_meta_data;
+        if(PREV_META_BLOCK(first) && PREV_META_BLOCK(first)->is_free)
+            first = PREV_META_BLOCK(first);
+
+        mm_remove_free_block_meta_data_from_free_block_list(pg_family, first);
+        while((next = NEXT_META_BLOCK(first)) && next->is_free == MM_TRUE){
+            mm_remove_free_block_meta_data_from_free_block_list(
+                    pg_family, next);
+            mm_union_free_blocks(first, next);
         }
+        run_end = (char *)(first + 1) + first->block_size;
 
-        number_of_struct_families++;
+        if(mm_is_vm_page_empty(hosting_page)){
+            mm_vm_page_delete_and_free(hosting_page);
+            return;
+        }
+        mm_add_free_block_meta_data_to_free_block_list(pg_family, first);
+    }
+    mm_vm_page_update_occupancy_bin(pg_family, hosting_page);
+}
 
-        printf(ANSI_COLOR_GREEN "vm_page_family : %s, struct size = %u\n"
-                ANSI_COLOR_RESET,
-                vm_page_family_curr->struct_name,
-                vm_page_family_curr->struct_size);
-        i = 0;
+mm_page_family_handle_t
+mm_page_family_set_deferred_coalescing(
+        vm_page_family_t *vm_page_family,
+        vm_bool_t deferred_coalescing){
 
-        ITERATE_VM_PAGE_BEGIN(vm_page_family_curr, vm_page){
+    if(!vm_page_family)
+        return NULL;
 
-            cumulative_vm_pages_claimed_from_kernel++;
-            mm_print_vm_page_details(vm_page);
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    vm_page_family->deferred_coalescing = deferred_coalescing;
+    if(!deferred_coalescing)
+        mm_family_coalesce_pending(vm_page_family, UINT32_MAX);
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    return vm_page_family;
+}
 
-        } ITERATE_VM_PAGE_END(vm_page_family_curr, vm_page);
-        printf("\n");
-    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+uint32_t
+mm_maintenance(uint32_t budget){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+    vm_page_family_t *thread_family = NULL;
+    uint64_t now_ms = mm_now_ms();
+    uint32_t coalesced = 0;
+    glthread_t released;
+
+    init_glthread(&released);
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family_curr, thread_family){
+
+            pthread_mutex_lock(&thread_family->family_lock);
+            if(coalesced < budget){
+                coalesced += mm_family_coalesce_pending(thread_family,
+                        budget - coalesced);
+            }
+            //pooled pages decay even when no page becomes empty
+            if(__atomic_load_n(&page_pool_decay_ms, __ATOMIC_RELAXED)){
+                mm_page_pool_shrink(&thread_family->page_pool,
+                        thread_family->page_pool.count, now_ms,
+                        &released);
+            }
+            pthread_mutex_unlock(&thread_family->family_lock);
+        } ITERATE_THREAD_FAMILIES_END(vm_page_family_curr, thread_family);
+    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_mutex_unlock(&page_family_registry_lock);
+
+    //decays the global pool as well
+    mm_global_page_pool_take(&released, now_ms);
+    return coalesced;
+}
+
+static void *
+mm_maintenance_thread_fn(void *arg){
+
+    struct timespec deadline;
+
+    pthread_mutex_lock(&maintenance_lock);
+    while(maintenance_thread_running){
+
+        pthread_mutex_unlock(&maintenance_lock);
+        mm_maintenance(maintenance_budget);
+        pthread_mutex_lock(&maintenance_lock);
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += maintenance_interval_ms / 1000;
+        deadline.tv_nsec += (long)(maintenance_interval_ms % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        if(maintenance_thread_running){
+            pthread_cond_timedwait(&maintenance_cond, &maintenance_lock,
+                    &deadline);
+        }
+    }
+    pthread_mutex_unlock(&maintenance_lock);
+    return NULL;
+}
+
+vm_bool_t
+mm_start_maintenance_thread(uint32_t interval_ms, uint32_t budget){
+
+    vm_bool_t started = MM_FALSE;
+
+    pthread_mutex_lock(&maintenance_lock);
+    if(!maintenance_thread_running){
+        maintenance_interval_ms = interval_ms;
+        maintenance_budget = budget;
+        maintenance_thread_running = MM_TRUE;
+        if(pthread_create(&maintenance_thread, NULL,
+                    mm_maintenance_thread_fn, NULL) == 0){
+            started = MM_TRUE;
+        }
+        else{
+            maintenance_thread_running = MM_FALSE;
+            printf("Error : Could not start the maintenance thread\n");
+        }
+    }
+    pthread_mutex_unlock(&maintenance_lock);
+    return started;
+}
+
+void
+mm_stop_maintenance_thread(){
+
+    pthread_mutex_lock(&maintenance_lock);
+    if(!maintenance_thread_running){
+        pthread_mutex_unlock(&maintenance_lock);
+        return;
+    }
+    maintenance_thread_running = MM_FALSE;
+    pthread_cond_signal(&maintenance_cond);
+    pthread_mutex_unlock(&maintenance_lock);
+
+    pthread_join(maintenance_thread, NULL);
+}
+
+/* Per thread caches : every thread keeps a magazine of single unit
+ * data blocks per page family with thread cache enabled. xcalloc_h()
+ * and xfree() of one unit only touch the magazine of the calling
+ * thread, the family lock is taken once per MM_MAGAZINE_BATCH blocks
+ * to refill an empty magazine or flush a full one. A block freed by
+ * a thread other than the allocating one simply lands in the magazine
+ * of the freeing thread, blocks belong to the family and not to the
+ * thread. Magazines are flushed back to the families when the thread
+ * exits*/
+
+//carve internal memory for the thread cache, never comes from malloc
+static void *
+mm_thread_cache_carve(mm_thread_cache_t *thread_cache, uint32_t size){
+
+    void *mem = NULL;
+
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if(thread_cache->carve_left < size){
+
+        //first word of every internal page links it for release at exit
+        void **internal_page = mm_get_new_vm_page_from_kernel(1);
+
+        if(!internal_page)
+            return NULL;
+
+        *internal_page = thread_cache->internal_pages;
+        thread_cache->internal_pages = internal_page;
+        thread_cache->carve_ptr = (char *)(internal_page + 1);
+        thread_cache->carve_left = SYSTEM_PAGE_SIZE - sizeof(void *);
+    }
+
+    mem = thread_cache->carve_ptr;
+    thread_cache->carve_ptr += size;
+    thread_cache->carve_left -= size;
+    return mem;
+}
+
+//magazine counters are written by the owning thread only, but read by
+//other threads collecting stats
+#define MM_MAGAZINE_SET(field, value)  \
+    __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+static void
+mm_magazine_flush(vm_page_family_t *pg_family,
+        mm_magazine_t *magazine,
+        uint32_t keep){
+
+    pthread_mutex_lock(&pg_family->family_lock);
+    while(magazine->count > keep){
+        MM_MAGAZINE_SET(magazine->count, magazine->count - 1);
+        void *app_data = magazine->slots[magazine->count];
+        mm_family_free(MM_GET_PAGE_FROM_DATA(app_data, SYSTEM_PAGE_SIZE),
+                app_data);
+    }
+    pthread_mutex_unlock(&pg_family->family_lock);
+}
+
+static void
+mm_thread_cache_flush_all(mm_thread_cache_t *thread_cache){
+
+    uint32_t family_id;
+
+    for(family_id = 0; family_id < thread_cache->magazines_count; family_id++){
+
+        mm_magazine_t *magazine = thread_cache->magazines[family_id];
+
+        if(magazine && magazine->count)
+            mm_magazine_flush(magazine->pg_family, magazine, 0);
+    }
+}
+
+static void
+mm_thread_cache_destroy(void *_thread_cache){
+
+    mm_thread_cache_t *thread_cache = (mm_thread_cache_t *)_thread_cache;
+    void **internal_page, **next_internal_page;
+    uint32_t family_id;
+
+    mm_thread_cache_flush_all(thread_cache);
+
+    //magazine counters outlive the thread in the family counters, folded in
+    //under the list lock so stats never see them twice or not at all
+    pthread_mutex_lock(&thread_cache_list_lock);
+    for(family_id = 0; family_id < thread_cache->magazines_count; family_id++){
+
+        mm_magazine_t *magazine = thread_cache->magazines[family_id];
+
+        if(!magazine)
+            continue;
+
+        pthread_mutex_lock(&magazine->pg_family->family_lock);
+        magazine->pg_family->stats.alloc_count += magazine->alloc_count;
+        magazine->pg_family->stats.free_count += magazine->free_count;
+        magazine->pg_family->stats.bytes_zeroed += magazine->bytes_zeroed;
+        //blocks outliving the thread stay in its per thread family, which
+        //is handed to the next thread needing one
+        if(magazine->thread_family){
+            magazine->thread_family->next_spare_thread_family =
+                magazine->pg_family->spare_thread_families;
+            magazine->pg_family->spare_thread_families =
+                magazine->thread_family;
+        }
+        pthread_mutex_unlock(&magazine->pg_family->family_lock);
+    }
+    remove_glthread(&thread_cache->thread_cache_glue);
+    pthread_mutex_unlock(&thread_cache_list_lock);
+
+    for(internal_page = thread_cache->internal_pages; internal_page;
+            internal_page = next_internal_page){
+        next_internal_page = *internal_page;
+        mm_return_vm_page_to_kernel(internal_page, 1);
+    }
+
+    if(thread_cache->magazines){
+        mm_return_vm_page_to_kernel(thread_cache->magazines,
+                thread_cache->magazines_pages);
+    }
+    mm_return_vm_page_to_kernel(thread_cache, 1);
+    mm_thread_cache = NULL;
+}
+
+static void
+mm_thread_cache_key_init(){
+
+    pthread_key_create(&thread_cache_key, mm_thread_cache_destroy);
+}
+
+static mm_thread_cache_t *
+mm_get_thread_cache(){
+
+    mm_thread_cache_t *thread_cache = mm_thread_cache;
+
+    if(thread_cache)
+        return thread_cache;
+
+    pthread_once(&thread_cache_key_once, mm_thread_cache_key_init);
+
+    thread_cache = mm_get_new_vm_page_from_kernel(1);
+    if(!thread_cache)
+        return NULL;
+
+    init_glthread(&thread_cache->thread_cache_glue);
+    pthread_mutex_lock(&thread_cache_list_lock);
+    glthread_add_next(&thread_cache_list, &thread_cache->thread_cache_glue);
+    pthread_mutex_unlock(&thread_cache_list_lock);
+
+    //destructor flushes the magazines when the thread exits
+    pthread_setspecific(thread_cache_key, thread_cache);
+    mm_thread_cache = thread_cache;
+    return thread_cache;
+}
+
+//magazine of the calling thread for the page family, created on first use
+static mm_magazine_t *
+mm_get_magazine(vm_page_family_t *pg_family){
+
+    mm_thread_cache_t *thread_cache = mm_get_thread_cache();
+    uint32_t family_id = pg_family->family_id;
+
+    if(!thread_cache)
+        return NULL;
+
+    if(family_id < thread_cache->magazines_count &&
+            thread_cache->magazines[family_id]){
+        return thread_cache->magazines[family_id];
+    }
+
+    //grow the magazine table to cover this family id
+    if(family_id >= thread_cache->magazines_count){
+
+        uint32_t pages = thread_cache->magazines_pages ?
+            thread_cache->magazines_pages : 1;
+
+        while(pages * SYSTEM_PAGE_SIZE / sizeof(mm_magazine_t *) <= family_id)
+            pages *= 2;
+
+        mm_magazine_t **magazines = mm_get_new_vm_page_from_kernel(pages);
+        if(!magazines)
+            return NULL;
+
+        //leak check reads the tables of all threads under the list lock
+        pthread_mutex_lock(&thread_cache_list_lock);
+        if(thread_cache->magazines){
+            memcpy(magazines, thread_cache->magazines,
+                    thread_cache->magazines_count * sizeof(mm_magazine_t *));
+            mm_return_vm_page_to_kernel(thread_cache->magazines,
+                    thread_cache->magazines_pages);
+        }
+
+        thread_cache->magazines = magazines;
+        thread_cache->magazines_pages = pages;
+        thread_cache->magazines_count =
+            pages * SYSTEM_PAGE_SIZE / sizeof(mm_magazine_t *);
+        pthread_mutex_unlock(&thread_cache_list_lock);
+    }
+
+    mm_magazine_t *magazine =
+        mm_thread_cache_carve(thread_cache, sizeof(mm_magazine_t));
+    if(!magazine)
+        return NULL;
+
+    magazine->pg_family = pg_family;
+    magazine->count = 0;
+    magazine->alloc_count = 0;
+    magazine->free_count = 0;
+    magazine->bytes_zeroed = 0;
+    magazine->thread_family = NULL;
+    //stats and snapshots read the magazines of other threads
+    __atomic_store_n(&thread_cache->magazines[family_id], magazine,
+            __ATOMIC_RELEASE);
+    return magazine;
+}
+
+//new per thread family with the configuration of the registered family
+static vm_page_family_t *
+mm_spawn_thread_family(vm_page_family_t *pg_family){
+
+    vm_page_family_t *thread_family = NULL;
+    uint32_t family_id, generation;
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    //per thread families of unregistered families are reused first
+    if(free_thread_families){
+        thread_family = free_thread_families;
+        free_thread_families = thread_family->next_free_family;
+    }
+    else{
+        if(thread_family_carve_left < sizeof(vm_page_family_t)){
+
+            thread_family_carve_ptr = mm_get_new_vm_page_from_kernel(1);
+            if(!thread_family_carve_ptr){
+                thread_family_carve_left = 0;
+                pthread_mutex_unlock(&page_family_registry_lock);
+                return NULL;
+            }
+            thread_family_carve_left = SYSTEM_PAGE_SIZE;
+        }
+
+        thread_family = (vm_page_family_t *)thread_family_carve_ptr;
+        if(!mm_page_family_assign_id(thread_family)){
+            pthread_mutex_unlock(&page_family_registry_lock);
+            return NULL;
+        }
+        thread_family_carve_ptr += sizeof(vm_page_family_t);
+        thread_family_carve_left -= sizeof(vm_page_family_t);
+    }
+
+    family_id = thread_family->family_id;
+    generation = thread_family->generation;
+    pthread_mutex_lock(&pg_family->family_lock);
+    *thread_family = *pg_family;
+    pthread_mutex_unlock(&pg_family->family_lock);
+
+    thread_family->family_id = family_id;
+    thread_family->generation = generation;
+    mm_init_page_family_state(thread_family);
+    thread_family->thread_affinity = MM_FALSE;
+    thread_family->parent_family = pg_family;
+    thread_family->next_thread_family = pg_family->thread_families;
+    pg_family->thread_families = thread_family;
+    pthread_mutex_unlock(&page_family_registry_lock);
+    return thread_family;
+}
+
+//per thread family of the calling thread for a thread affinity page family,
+//one left by an exited thread is reused before spawning a new one
+static vm_page_family_t *
+mm_get_thread_family(vm_page_family_t *pg_family){
+
+    mm_magazine_t *magazine = mm_get_magazine(pg_family);
+    vm_page_family_t *thread_family = NULL;
+
+    //without a thread cache the thread shares the registered family
+    if(!magazine)
+        return pg_family;
+
+    if(magazine->thread_family)
+        return magazine->thread_family;
+
+    pthread_mutex_lock(&pg_family->family_lock);
+    thread_family = pg_family->spare_thread_families;
+    if(thread_family){
+        pg_family->spare_thread_families =
+            thread_family->next_spare_thread_family;
+        thread_family->next_spare_thread_family = NULL;
+    }
+    pthread_mutex_unlock(&pg_family->family_lock);
+
+    if(!thread_family)
+        thread_family = mm_spawn_thread_family(pg_family);
+
+    if(!thread_family)
+        return pg_family;
+
+    magazine->thread_family = thread_family;
+    return thread_family;
+}
+
+/* Unregistration : all the pages of the family and of its per thread
+ * families go back to the global page pool, or the kernel for spans, and
+ * the slots are kept for the next registrations. A reused slot keeps its
+ * index, ids carry the generation of the slot on top of it*/
+
+//empties the magazine of the family id in every thread cache, its blocks
+//live in pages being released. Thread cache list lock must be held
+static void
+mm_thread_caches_forget_family(uint32_t family_id){
+
+    glthread_t *curr = NULL;
+
+    ITERATE_GLTHREAD_BEGIN(&thread_cache_list, curr){
+
+        mm_thread_cache_t *thread_cache = glthread_to_thread_cache(curr);
+        mm_magazine_t *magazine = NULL;
+
+        if(family_id >= thread_cache->magazines_count)
+            continue;
+
+        //the magazine stays, it serves the next family of this slot
+        magazine = thread_cache->magazines[family_id];
+        if(!magazine)
+            continue;
+
+        MM_MAGAZINE_SET(magazine->count, 0);
+        MM_MAGAZINE_SET(magazine->alloc_count, 0);
+        MM_MAGAZINE_SET(magazine->free_count, 0);
+        MM_MAGAZINE_SET(magazine->bytes_zeroed, 0);
+        magazine->thread_family = NULL;
+    } ITERATE_GLTHREAD_END(&thread_cache_list, curr);
+}
+
+//moves every page of the family to released, spans are unmapped right
+//away. Family lock must be held
+static void
+mm_family_release_all_pages(vm_page_family_t *vm_page_family,
+        uint64_t now_ms,
+        glthread_t *released){
+
+    vm_page_t *vm_page_curr = NULL;
+    mm_pooled_page_t *pooled_page = NULL;
+
+    ITERATE_VM_PAGE_BEGIN(vm_page_family, vm_page_curr){
+
+        pooled_page = (mm_pooled_page_t *)vm_page_curr;
+        pooled_page->pooled_at_ms = now_ms;
+        init_glthread(&pooled_page->pool_glue);
+        glthread_add_next(released, &pooled_page->pool_glue);
+    } ITERATE_VM_PAGE_END(vm_page_family, vm_page_curr);
+
+    ITERATE_VM_SLAB_PAGE_BEGIN(vm_page_family, vm_page_curr){
+
+        pooled_page = (mm_pooled_page_t *)vm_page_curr;
+        pooled_page->pooled_at_ms = now_ms;
+        init_glthread(&pooled_page->pool_glue);
+        glthread_add_next(released, &pooled_page->pool_glue);
+    } ITERATE_VM_SLAB_PAGE_END(vm_page_family, vm_page_curr);
+
+    ITERATE_VM_SPAN_BEGIN(vm_page_family, vm_page_curr){
+
+        mm_return_vm_page_to_kernel((void *)vm_page_curr,
+                MM_SPAN_PAGES(vm_page_curr));
+    } ITERATE_VM_SPAN_END(vm_page_family, vm_page_curr);
+
+    mm_page_pool_shrink(&vm_page_family->page_pool, 0, 0, released);
+
+    vm_page_family->first_page = NULL;
+    vm_page_family->first_slab_page = NULL;
+    vm_page_family->first_span = NULL;
+    vm_page_family->pending_frees = NULL;
+    vm_page_family->coalesce_queue = NULL;
+}
+
+//drops the family from the registry hash bucket of its name, lock free
+//lookups walking the registry meanwhile start over
+static void
+mm_unlink_page_family(vm_page_family_t *vm_page_family){
+
+    vm_page_family_t **link = &page_family_hash_table[
+        mm_hash_struct_name(vm_page_family->struct_name)];
+
+    for(; *link; link = &(*link)->hash_next){
+
+        if(*link == vm_page_family){
+            mm_registry_write_begin();
+            __atomic_store_n(link, vm_page_family->hash_next,
+                    __ATOMIC_RELEASE);
+            mm_registry_write_end();
+            return;
+        }
+    }
+}
+
+static void
+mm_profile_forget_family(vm_page_family_t *vm_page_family);
+
+vm_bool_t
+mm_unregister_page_family(vm_page_family_t *vm_page_family){
+
+    vm_page_family_t *thread_family = NULL,
+                     *next_thread_family = NULL;
+    vm_bool_t has_arena_pages = MM_FALSE;
+    uint64_t now_ms = mm_now_ms();
+    glthread_t released;
+
+    if(!vm_page_family || vm_page_family->parent_family){
+        printf("Error : Only registered page families can be unregistered\n");
+        return MM_FALSE;
+    }
+
+    init_glthread(&released);
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    if(!vm_page_family->struct_size){
+        pthread_mutex_unlock(&page_family_registry_lock);
+        printf("Error : Page family is not registered\n");
+        return MM_FALSE;
+    }
+
+    //arenas point to the families they allocate from
+    ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family, thread_family){
+
+        pthread_mutex_lock(&thread_family->family_lock);
+        if(thread_family->first_arena_page)
+            has_arena_pages = MM_TRUE;
+        pthread_mutex_unlock(&thread_family->family_lock);
+    } ITERATE_THREAD_FAMILIES_END(vm_page_family, thread_family);
+
+    if(has_arena_pages){
+        pthread_mutex_unlock(&page_family_registry_lock);
+        printf("Error : %s has objects in arenas, destroy them first\n",
+                vm_page_family->struct_name);
+        return MM_FALSE;
+    }
+
+    mm_unlink_page_family(vm_page_family);
+
+    pthread_mutex_lock(&thread_cache_list_lock);
+    ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family, thread_family){
+
+        mm_thread_caches_forget_family(thread_family->family_id);
+    } ITERATE_THREAD_FAMILIES_END(vm_page_family, thread_family);
+    pthread_mutex_unlock(&thread_cache_list_lock);
+
+    //samples of blocks still allocated would outlive their pages
+    mm_profile_forget_family(vm_page_family);
+
+    ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family, thread_family){
+
+        pthread_mutex_lock(&thread_family->family_lock);
+        mm_family_release_all_pages(thread_family, now_ms, &released);
+        pthread_mutex_unlock(&thread_family->family_lock);
+    } ITERATE_THREAD_FAMILIES_END(vm_page_family, thread_family);
+
+    //the slots wait for the next registrations
+    for(thread_family = vm_page_family->thread_families; thread_family;
+            thread_family = next_thread_family){
+
+        next_thread_family = thread_family->next_thread_family;
+        thread_family->struct_size = 0;
+        thread_family->next_free_family = free_thread_families;
+        free_thread_families = thread_family;
+    }
+    vm_page_family->thread_families = NULL;
+    vm_page_family->spare_thread_families = NULL;
+    vm_page_family->struct_size = 0;
+    vm_page_family->generation++;
+    vm_page_family->next_free_family = NULL;
+    if(free_page_families_tail)
+        free_page_families_tail->next_free_family = vm_page_family;
+    else
+        free_page_families = vm_page_family;
+    free_page_families_tail = vm_page_family;
+    pthread_mutex_unlock(&page_family_registry_lock);
+
+    if(!IS_GLTHREAD_LIST_EMPTY(&released))
+        mm_global_page_pool_take(&released, now_ms);
+    return MM_TRUE;
+}
+
+//magazines do not remember which blocks are known zero, their blocks are
+//always zeroed by xcalloc
+static void *
+mm_thread_cache_allocate(vm_page_family_t *pg_family,
+        vm_bool_t zero,
+        vm_bool_t *is_zero){
+
+    mm_magazine_t *magazine = mm_get_magazine(pg_family);
+    void *app_data = NULL;
+    vm_bool_t blocks_zero[MM_MAGAZINE_BATCH];
+
+    if(!magazine){
+        pthread_mutex_lock(&pg_family->family_lock);
+        app_data = mm_family_allocate(pg_family, 1, zero, is_zero);
+        if(app_data)
+            pg_family->stats.alloc_count++;
+        pthread_mutex_unlock(&pg_family->family_lock);
+        return app_data;
+    }
+
+    //empty magazine, refill a batch under one family lock, carved from as
+    //few free blocks as can be
+    if(!magazine->count){
+
+        pthread_mutex_lock(&pg_family->family_lock);
+        MM_MAGAZINE_SET(magazine->count,
+                mm_family_allocate_batch(pg_family, MM_MAGAZINE_BATCH,
+                    MM_FALSE, magazine->slots, blocks_zero));
+        pthread_mutex_unlock(&pg_family->family_lock);
+
+        if(!magazine->count)
+            return NULL;
+    }
+
+    MM_MAGAZINE_SET(magazine->count, magazine->count - 1);
+    MM_MAGAZINE_SET(magazine->alloc_count, magazine->alloc_count + 1);
+    if(zero)
+        MM_MAGAZINE_SET(magazine->bytes_zeroed,
+                magazine->bytes_zeroed + pg_family->struct_size);
+    *is_zero = MM_FALSE;
+    return magazine->slots[magazine->count];
+}
+
+static void
+mm_thread_cache_free(vm_page_family_t *pg_family, void *app_data){
+
+    mm_magazine_t *magazine = mm_get_magazine(pg_family);
+
+    if(!magazine){
+        pthread_mutex_lock(&pg_family->family_lock);
+        mm_family_free(MM_GET_PAGE_FROM_DATA(app_data, SYSTEM_PAGE_SIZE),
+                app_data);
+        pg_family->stats.free_count++;
+        pthread_mutex_unlock(&pg_family->family_lock);
+        return;
+    }
+
+    //full magazine, hand a batch back to the family under one lock
+    if(magazine->count == MM_MAGAZINE_SIZE)
+        mm_magazine_flush(pg_family, magazine,
+                MM_MAGAZINE_SIZE - MM_MAGAZINE_BATCH);
+
+    magazine->slots[magazine->count] = app_data;
+    MM_MAGAZINE_SET(magazine->count, magazine->count + 1);
+    MM_MAGAZINE_SET(magazine->free_count, magazine->free_count + 1);
+}
+
+//is the data block exactly one unit, so it can be cached and handed out again
+static inline vm_bool_t
+mm_is_single_unit(vm_page_t *hosting_page, void *app_data){
+
+    if(hosting_page->page_type == MM_PAGE_SLAB)
+        return MM_TRUE;
+
+    //spans are never cached, they go back to the kernel right away
+    if(hosting_page->page_type == MM_PAGE_SPAN)
+        return MM_FALSE;
+
+    block_meta_data_t *block_meta_data =
+        (block_meta_data_t *)((char *)app_data - sizeof(block_meta_data_t));
+
+    return block_meta_data->block_size ==
+        mm_family_unit_block_size(hosting_page->pg_family) ?
+        MM_TRUE : MM_FALSE;
+}
+
+void
+mm_thread_cache_flush(){
+
+    if(mm_thread_cache)
+        mm_thread_cache_flush_all(mm_thread_cache);
+}
+
+mm_page_family_handle_t
+mm_page_family_set_thread_cache(
+        vm_page_family_t *vm_page_family,
+        vm_bool_t thread_cache){
+
+    if(!vm_page_family)
+        return NULL;
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    //magazines of other threads are theirs alone and cannot be drained
+    //from here, blocks would be stuck in them once caching is off
+    if(vm_page_family->thread_cache != thread_cache &&
+            (vm_page_family->first_page || vm_page_family->first_slab_page ||
+             vm_page_family->first_span || vm_page_family->thread_families)){
+        pthread_mutex_unlock(&vm_page_family->family_lock);
+        printf("Error : Thread cache of %s can only be set before allocating from it\n",
+                vm_page_family->struct_name);
+        return NULL;
+    }
+    vm_page_family->thread_cache = thread_cache;
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    return vm_page_family;
+}
+
+mm_page_family_handle_t
+mm_page_family_set_thread_affinity(
+        vm_page_family_t *vm_page_family,
+        vm_bool_t thread_affinity){
+
+    if(!vm_page_family || vm_page_family->parent_family)
+        return NULL;
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    //blocks of per thread families would be left behind once affinity is
+    //off, and pages of the family itself once it is on
+    if(vm_page_family->thread_affinity != thread_affinity &&
+            (vm_page_family->first_page || vm_page_family->first_slab_page ||
+             vm_page_family->first_span || vm_page_family->thread_families)){
+        pthread_mutex_unlock(&vm_page_family->family_lock);
+        printf("Error : Thread affinity of %s can only be set before allocating from it\n",
+                vm_page_family->struct_name);
+        return NULL;
+    }
+    vm_page_family->thread_affinity = thread_affinity;
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    return vm_page_family;
+}
+
+//sums up the magazines of all threads for the page family, blocks_in_use
+//is the number of blocks cached. Thread cache list lock must be held. Exact
+//only while no other thread is allocating from the family
+static void
+mm_thread_cache_family_counters(vm_page_family_t *pg_family,
+        mm_page_family_stats_t *counters){
+
+    glthread_t *curr = NULL;
+
+    memset(counters, 0, sizeof(mm_page_family_stats_t));
+
+    ITERATE_GLTHREAD_BEGIN(&thread_cache_list, curr){
+
+        mm_thread_cache_t *thread_cache = glthread_to_thread_cache(curr);
+        mm_magazine_t *magazine = NULL;
+
+        if(pg_family->family_id >= thread_cache->magazines_count)
+            continue;
+
+        magazine = __atomic_load_n(
+                &thread_cache->magazines[pg_family->family_id],
+                __ATOMIC_ACQUIRE);
+        if(!magazine)
+            continue;
+
+        counters->blocks_in_use +=
+            __atomic_load_n(&magazine->count, __ATOMIC_RELAXED);
+        counters->alloc_count +=
+            __atomic_load_n(&magazine->alloc_count, __ATOMIC_RELAXED);
+        counters->free_count +=
+            __atomic_load_n(&magazine->free_count, __ATOMIC_RELAXED);
+        counters->bytes_zeroed +=
+            __atomic_load_n(&magazine->bytes_zeroed, __ATOMIC_RELAXED);
+    } ITERATE_GLTHREAD_END(&thread_cache_list, curr);
+}
+
+//adds up the counters of one page family, thread cache list lock must be held
+static void
+mm_page_family_add_stats(vm_page_family_t *pg_family,
+        mm_page_family_stats_t *stats){
+
+    mm_page_family_stats_t family, magazines;
+    vm_page_t *vm_page = NULL;
+
+    pthread_mutex_lock(&pg_family->family_lock);
+    //pending frees are not in use anymore
+    mm_family_coalesce_pending(pg_family, UINT32_MAX);
+    family = pg_family->stats;
+    family.pages_retained = pg_family->page_pool.count;
+    family.pages_released_per_minute =
+        mm_family_pages_released_per_minute(pg_family);
+    ITERATE_VM_ARENA_PAGE_BEGIN(pg_family, vm_page){
+
+        uint32_t objects =
+            __atomic_load_n(&vm_page->arena.objects, __ATOMIC_RELAXED);
+
+        family.blocks_in_use += objects;
+        if(objects){
+            family.bytes_in_use +=
+                __atomic_load_n(&vm_page->arena.used, __ATOMIC_RELAXED) -
+                MM_ARENA_DATA_OFFSET;
+        }
+    } ITERATE_VM_ARENA_PAGE_END(pg_family, vm_page);
+    pthread_mutex_unlock(&pg_family->family_lock);
+
+    mm_thread_cache_family_counters(pg_family, &magazines);
+
+    //cached blocks are single units already freed by the application
+    stats->bytes_in_use += family.bytes_in_use - magazines.blocks_in_use *
+        mm_family_unit_block_size(pg_family);
+    stats->peak_bytes_in_use += family.peak_bytes_in_use;
+    stats->blocks_in_use += family.blocks_in_use - magazines.blocks_in_use;
+    stats->pages_held += family.pages_held;
+    stats->pages_retained += family.pages_retained;
+    stats->alloc_count += family.alloc_count + magazines.alloc_count;
+    stats->free_count += family.free_count + magazines.free_count;
+    stats->bytes_zeroed += family.bytes_zeroed + magazines.bytes_zeroed;
+    stats->pages_released += family.pages_released;
+    stats->pages_released_per_minute += family.pages_released_per_minute;
+}
+
+//counters of a thread affinity family add up its per thread families, the
+//peak is the sum of their peaks
+void
+mm_get_page_family_stats(vm_page_family_t *pg_family,
+        mm_page_family_stats_t *stats){
+
+    vm_page_family_t *thread_family = NULL;
+
+    memset(stats, 0, sizeof(mm_page_family_stats_t));
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    pthread_mutex_lock(&thread_cache_list_lock);
+    ITERATE_THREAD_FAMILIES_BEGIN(pg_family, thread_family){
+
+        mm_page_family_add_stats(thread_family, stats);
+    } ITERATE_THREAD_FAMILIES_END(pg_family, thread_family);
+    pthread_mutex_unlock(&thread_cache_list_lock);
+    pthread_mutex_unlock(&page_family_registry_lock);
+}
+
+/* Leak check needs no bookkeeping on the allocation path : every data
+ * block still marked allocated in the pages of a family, minus the ones
+ * parked in thread cache magazines, was never freed by the application*/
+void
+mm_check_for_leaks(){
+
+    int leak_detected = 0; // Flag to track if a leak is detected
+    vm_page_family_t *vm_page_family_curr = NULL;
+    vm_page_family_t *thread_family = NULL;
+    vm_page_t *vm_page_curr = NULL;
+    block_meta_data_t *block_meta_data_curr = NULL;
+    uint32_t leaked_blocks;
+    uint64_t leaked_bytes;
+    mm_page_family_stats_t magazines;
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        leaked_blocks = 0;
+        leaked_bytes = 0;
+
+        ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family_curr, thread_family){
+
+            pthread_mutex_lock(&thread_family->family_lock);
+            //pending frees were freed by the application
+            mm_family_coalesce_pending(thread_family, UINT32_MAX);
+            ITERATE_VM_PAGE_BEGIN(thread_family, vm_page_curr){
+
+                ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page_curr, block_meta_data_curr){
+
+                    if(block_meta_data_curr->is_free == MM_FALSE){
+                        leaked_blocks++;
+                        leaked_bytes += block_meta_data_curr->block_size;
+                    }
+                } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page_curr, block_meta_data_curr);
+            } ITERATE_VM_PAGE_END(thread_family, vm_page_curr);
+
+            ITERATE_VM_SLAB_PAGE_BEGIN(thread_family, vm_page_curr){
+
+                leaked_blocks += vm_page_curr->slab.used_slots;
+                leaked_bytes += (uint64_t)vm_page_curr->slab.used_slots *
+                    mm_family_unit_block_size(thread_family);
+            } ITERATE_VM_SLAB_PAGE_END(thread_family, vm_page_curr);
+
+            ITERATE_VM_SPAN_BEGIN(thread_family, vm_page_curr){
+
+                leaked_blocks++;
+                leaked_bytes += vm_page_curr->block_meta_data.block_size;
+            } ITERATE_VM_SPAN_END(thread_family, vm_page_curr);
+            pthread_mutex_unlock(&thread_family->family_lock);
+
+            //cached blocks are single units, freed by the application
+            pthread_mutex_lock(&thread_cache_list_lock);
+            mm_thread_cache_family_counters(thread_family, &magazines);
+            pthread_mutex_unlock(&thread_cache_list_lock);
+            leaked_blocks -= magazines.blocks_in_use;
+            leaked_bytes -= magazines.blocks_in_use *
+                mm_family_unit_block_size(thread_family);
+        } ITERATE_THREAD_FAMILIES_END(vm_page_family_curr, thread_family);
+
+        // If blocks were not freed, print a warning message
+        if(leaked_blocks){
+            printf("Warning: Memory leak detected. %u blocks of %s "
+                    "(%lu bytes) were not freed.\n",
+                    leaked_blocks, vm_page_family_curr->struct_name,
+                    (unsigned long)leaked_bytes);
+            leak_detected = 1; // Set the flag to true
+        }
+    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_mutex_unlock(&page_family_registry_lock);
+
+    // If no leak was detected, print a message
+    if (!leak_detected) {
+        printf("No memory leaks detected.\n");
+    }
+}
+
+/*Sampling heap profiler : every thread counts down the bytes it has left
+ * till its next sample, so an allocation which is not sampled costs a
+ * load and a subtraction. A sampled object is counted in the header of its
+ * page, xfree() looks the object up only on pages with such a count.
+ * Stacks and objects live in pages from the kernel and nothing is printed
+ * under the profile lock, so the profiler never calls malloc() while
+ * holding it, malloc() may be this memory manager itself*/
+
+//mean bytes between two samples, 0 while the profiler is stopped
+static uint64_t profile_sample_bytes = 0;
+//interval of the last mm_profiler_start(), the samples still tracked after
+//a stop were taken at it. 0 once reset
+static uint64_t profile_last_sample_bytes = 0;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+//guarded by profile lock
+static mm_profile_stack_t *profile_stacks[MM_PROFILE_HASH_BUCKETS];
+static mm_profile_object_t *profile_objects[MM_PROFILE_HASH_BUCKETS];
+static mm_profile_object_t *free_profile_objects = NULL;
+static uint32_t profile_stacks_count = 0;
+//pages stacks and objects are carved from, linked through their first word
+static void *profile_pages = NULL;
+static char *profile_carve_ptr = NULL;
+static uint32_t profile_carve_left = 0;
+
+//bytes the calling thread may still allocate before its next sample
+static __thread int64_t profile_bytes_left = 0;
+//xorshift state of the sampling intervals, 0 till the first allocation
+static __thread uint64_t profile_random = 0;
+
+static void __attribute__((noinline))
+mm_profile_sample(void *app_data, uint64_t size);
+
+static inline void
+mm_profile_account(void *app_data, uint64_t size){
+
+    if(__builtin_expect(
+                !__atomic_load_n(&profile_sample_bytes, __ATOMIC_RELAXED), 1))
+        return;
+
+    profile_bytes_left -= (int64_t)size;
+    if(__builtin_expect(profile_bytes_left < 0, 0))
+        mm_profile_sample(app_data, size);
+}
+
+//exponentially distributed with mean sample_bytes, so that every byte
+//allocated is equally likely to be the sampled one
+static int64_t
+mm_profile_next_interval(uint64_t sample_bytes){
+
+    double uniform;
+
+    if(!profile_random){
+        profile_random = ((uintptr_t)&profile_random ^
+                (uint64_t)pthread_self() ^ mm_now_ms()) | 1;
+    }
+    profile_random ^= profile_random >> 12;
+    profile_random ^= profile_random << 25;
+    profile_random ^= profile_random >> 27;
+    //53 random bits, in (0, 1]
+    uniform = ((profile_random * 0x2545F4914F6CDD1DULL >> 11) + 1) *
+        (1.0 / 9007199254740992.0);
+    return (int64_t)(-log(uniform) * sample_bytes) + 1;
+}
+
+static inline uint32_t
+mm_profile_object_bucket(void *app_data){
+
+    return (uint32_t)((((uintptr_t)app_data >> 4) * 0x9E3779B97F4A7C15ULL)
+            >> 32) & (MM_PROFILE_HASH_BUCKETS - 1);
+}
+
+//profile lock must be held
+static void *
+mm_profile_carve(uint32_t size){
+
+    void *ptr = NULL;
+
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if(profile_carve_left < size){
+
+        char *page = mm_get_new_vm_page_from_kernel(1);
+
+        if(!page)
+            return NULL;
+        *(void **)page = profile_pages;
+        profile_pages = page;
+        profile_carve_ptr = page + sizeof(void *);
+        profile_carve_left = SYSTEM_PAGE_SIZE - sizeof(void *);
+    }
+    ptr = profile_carve_ptr;
+    profile_carve_ptr += size;
+    profile_carve_left -= size;
+    return ptr;
+}
+
+//stack with these frames, added if new. Profile lock must be held
+static mm_profile_stack_t *
+mm_profile_get_stack(void **frames, uint32_t depth){
+
+    mm_profile_stack_t *stack = NULL;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint32_t i, bucket;
+
+    for(i = 0; i < depth; i++)
+        hash = (hash ^ (uintptr_t)frames[i]) * 0x100000001B3ULL;
+    bucket = (uint32_t)(hash >> 32) & (MM_PROFILE_HASH_BUCKETS - 1);
+
+    for(stack = profile_stacks[bucket]; stack; stack = stack->next){
+        if(stack->hash == hash && stack->depth == depth &&
+                !memcmp(stack->frames, frames, depth * sizeof(void *)))
+            return stack;
+    }
+
+    stack = mm_profile_carve(sizeof(mm_profile_stack_t));
+    if(!stack)
+        return NULL;
+    memset(stack, 0, sizeof(mm_profile_stack_t));
+    stack->hash = hash;
+    stack->depth = depth;
+    memcpy(stack->frames, frames, depth * sizeof(void *));
+    stack->next = profile_stacks[bucket];
+    profile_stacks[bucket] = stack;
+    profile_stacks_count++;
+    return stack;
+}
+
+//unlinks the sampled object from its stack, profile lock must be held
+static void
+mm_profile_drop_object(mm_profile_object_t **link){
+
+    mm_profile_object_t *object = *link;
+
+    object->stack->live_objects--;
+    object->stack->live_bytes -= object->size;
+    object->stack->live_estimated_bytes -= object->estimated_bytes;
+    *link = object->next;
+    object->next = free_profile_objects;
+    free_profile_objects = object;
+}
+
+static void __attribute__((noinline))
+mm_profile_sample(void *app_data, uint64_t size){
+
+    uint64_t sample_bytes =
+        __atomic_load_n(&profile_sample_bytes, __ATOMIC_RELAXED);
+    void *frames[MM_PROFILE_MAX_FRAMES + 1];
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_DATA(app_data, SYSTEM_PAGE_SIZE);
+    mm_profile_stack_t *stack = NULL;
+    mm_profile_object_t *object = NULL;
+    double probability;
+    uint32_t bucket;
+    int depth;
+
+    if(!sample_bytes)
+        return;
+
+    //the count down of a thread starts with its first allocation
+    if(!profile_random){
+        profile_bytes_left =
+            mm_profile_next_interval(sample_bytes) - (int64_t)size;
+        if(profile_bytes_left >= 0)
+            return;
+    }
+    profile_bytes_left = mm_profile_next_interval(sample_bytes);
+
+    //the first frame is this function
+    depth = backtrace(frames, MM_PROFILE_MAX_FRAMES + 1) - 1;
+    if(depth <= 0)
+        return;
+
+    //an object of size bytes is sampled with this probability
+    probability = 1.0 - exp(-(double)size / sample_bytes);
+    bucket = mm_profile_object_bucket(app_data);
+
+    pthread_mutex_lock(&profile_lock);
+    stack = mm_profile_get_stack(frames + 1, (uint32_t)depth);
+    object = free_profile_objects;
+    if(object)
+        free_profile_objects = object->next;
+    else
+        object = mm_profile_carve(sizeof(mm_profile_object_t));
+
+    if(stack && object){
+        object->app_data = app_data;
+        object->size = size;
+        object->estimated_bytes = size / probability;
+        object->stack = stack;
+        object->next = profile_objects[bucket];
+        profile_objects[bucket] = object;
+        stack->live_objects++;
+        stack->live_bytes += size;
+        stack->live_estimated_bytes += object->estimated_bytes;
+        stack->alloc_objects++;
+        stack->alloc_bytes += size;
+        __atomic_add_fetch(&vm_page->sampled_objects, 1, __ATOMIC_RELAXED);
+    }
+    else if(object){
+        object->next = free_profile_objects;
+        free_profile_objects = object;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+//the object is being freed, forgets it if it was sampled
+static void
+mm_profile_free(vm_page_t *vm_page, void *app_data){
+
+    mm_profile_object_t **link = NULL;
+
+    pthread_mutex_lock(&profile_lock);
+    for(link = &profile_objects[mm_profile_object_bucket(app_data)]; *link;
+            link = &(*link)->next){
+
+        if((*link)->app_data == app_data){
+            mm_profile_drop_object(link);
+            __atomic_sub_fetch(&vm_page->sampled_objects, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+static inline void
+mm_profile_free_check(vm_page_t *vm_page, void *app_data){
+
+    if(__builtin_expect(
+                __atomic_load_n(&vm_page->sampled_objects, __ATOMIC_RELAXED) != 0, 0))
+        mm_profile_free(vm_page, app_data);
+}
+
+//a sampled object resized in place keeps its sample with the new size
+static void
+mm_profile_resize(void *app_data, uint64_t size){
+
+    mm_profile_object_t *object = NULL;
+    double scale;
+
+    pthread_mutex_lock(&profile_lock);
+    for(object = profile_objects[mm_profile_object_bucket(app_data)]; object;
+            object = object->next){
+
+        if(object->app_data == app_data){
+            scale = object->estimated_bytes / object->size;
+            object->stack->live_bytes += size - object->size;
+            object->stack->live_estimated_bytes +=
+                (size - (double)object->size) * scale;
+            object->estimated_bytes = size * scale;
+            object->size = size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+//the pages of the family are about to be released with the objects still
+//on them, registry lock must be held
+static void
+mm_profile_forget_family(vm_page_family_t *vm_page_family){
+
+    mm_profile_object_t **link = NULL;
+    vm_page_family_t *pg_family = NULL;
+    vm_page_t *vm_page = NULL;
+    uint32_t bucket;
+
+    pthread_mutex_lock(&profile_lock);
+    for(bucket = 0; bucket < MM_PROFILE_HASH_BUCKETS; bucket++){
+
+        link = &profile_objects[bucket];
+        while(*link){
+
+            vm_page = MM_GET_PAGE_FROM_DATA((*link)->app_data,
+                    SYSTEM_PAGE_SIZE);
+            pg_family = vm_page->pg_family;
+            if(pg_family == vm_page_family ||
+                    pg_family->parent_family == vm_page_family){
+                mm_profile_drop_object(link);
+                __atomic_sub_fetch(&vm_page->sampled_objects, 1,
+                        __ATOMIC_RELAXED);
+            }
+            else
+                link = &(*link)->next;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+vm_bool_t
+mm_profiler_start(uint64_t sample_bytes){
+
+    void *frame;
+
+    if(!sample_bytes || sample_bytes > INT64_MAX / 64){
+        printf("Error : Invalid profiler sampling interval of %lu bytes\n",
+                (unsigned long)sample_bytes);
+        return MM_FALSE;
+    }
+
+    //the first backtrace() loads the unwinder, which may allocate
+    backtrace(&frame, 1);
+    __atomic_store_n(&profile_last_sample_bytes, sample_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile_sample_bytes, sample_bytes, __ATOMIC_RELAXED);
+    return MM_TRUE;
+}
+
+void
+mm_profiler_stop(){
+
+    __atomic_store_n(&profile_sample_bytes, 0, __ATOMIC_RELAXED);
+}
+
+void
+mm_profiler_reset(){
+
+    mm_profile_object_t *object = NULL;
+    vm_page_t *vm_page = NULL;
+    void *page = NULL;
+    uint32_t bucket;
+
+    mm_profiler_stop();
+
+    pthread_mutex_lock(&profile_lock);
+    for(bucket = 0; bucket < MM_PROFILE_HASH_BUCKETS; bucket++){
+
+        for(object = profile_objects[bucket]; object; object = object->next){
+            vm_page = MM_GET_PAGE_FROM_DATA(object->app_data, SYSTEM_PAGE_SIZE);
+            __atomic_sub_fetch(&vm_page->sampled_objects, 1, __ATOMIC_RELAXED);
+        }
+        profile_objects[bucket] = NULL;
+        profile_stacks[bucket] = NULL;
+    }
+
+    while(profile_pages){
+        page = profile_pages;
+        profile_pages = *(void **)page;
+        mm_return_vm_page_to_kernel(page, 1);
+    }
+    free_profile_objects = NULL;
+    profile_stacks_count = 0;
+    profile_carve_ptr = NULL;
+    profile_carve_left = 0;
+    pthread_mutex_unlock(&profile_lock);
+    __atomic_store_n(&profile_last_sample_bytes, 0, __ATOMIC_RELAXED);
+}
+
+//frames of a folded stack, root first
+static void
+mm_profile_folded_frame(FILE *fp, void *frame){
+
+    Dl_info info;
+    const char *module = NULL;
+
+    if(!dladdr(frame, &info)){
+        fprintf(fp, "0x%lx", (unsigned long)(uintptr_t)frame);
+        return;
+    }
+    if(info.dli_sname){
+        fputs(info.dli_sname, fp);
+        return;
+    }
+    if(info.dli_fname){
+        module = strrchr(info.dli_fname, '/');
+        fprintf(fp, "%s+0x%lx", module ? module + 1 : info.dli_fname,
+                (unsigned long)((char *)frame - (char *)info.dli_fbase));
+        return;
+    }
+    fprintf(fp, "0x%lx", (unsigned long)(uintptr_t)frame);
+}
+
+vm_bool_t
+mm_profiler_dump(char *path, mm_profile_format_t format){
+
+    mm_profile_stack_t *stacks = NULL, *stack = NULL;
+    uint64_t live_objects = 0, live_bytes = 0,
+             alloc_objects = 0, alloc_bytes = 0;
+    uint64_t sample_bytes = 0;
+    uint32_t count = 0, pages = 0, bucket, i, j;
+    char buffer[4096];
+    size_t bytes;
+    FILE *fp = NULL, *maps = NULL;
+    vm_bool_t ok;
+
+    //a copy of the stacks is printed, outside the profile lock
+    pthread_mutex_lock(&profile_lock);
+    if(profile_stacks_count){
+        pages = (profile_stacks_count * sizeof(mm_profile_stack_t) +
+                SYSTEM_PAGE_SIZE - 1) / SYSTEM_PAGE_SIZE;
+        stacks = mm_get_new_vm_page_from_kernel(pages);
+        if(!stacks){
+            pthread_mutex_unlock(&profile_lock);
+            return MM_FALSE;
+        }
+        for(bucket = 0; bucket < MM_PROFILE_HASH_BUCKETS; bucket++){
+            for(stack = profile_stacks[bucket]; stack; stack = stack->next)
+                stacks[count++] = *stack;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    fp = path ? fopen(path, "w") : stdout;
+    if(!fp){
+        printf("Error : Could not open %s for the heap profile\n", path);
+        if(stacks)
+            mm_return_vm_page_to_kernel(stacks, pages);
+        return MM_FALSE;
+    }
+
+    if(format == MM_PROFILE_PPROF){
+
+        for(i = 0; i < count; i++){
+            live_objects += stacks[i].live_objects;
+            live_bytes += stacks[i].live_bytes;
+            alloc_objects += stacks[i].alloc_objects;
+            alloc_bytes += stacks[i].alloc_bytes;
+        }
+        //pprof scales the samples up by the interval they were taken at,
+        //which a stop leaves as it was
+        sample_bytes = __atomic_load_n(&profile_last_sample_bytes,
+                __ATOMIC_RELAXED);
+        fprintf(fp, "heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%lu\n",
+                (unsigned long)live_objects, (unsigned long)live_bytes,
+                (unsigned long)alloc_objects, (unsigned long)alloc_bytes,
+                (unsigned long)(sample_bytes ? sample_bytes :
+                    MM_PROFILE_DEFAULT_SAMPLE_BYTES));
+        for(i = 0; i < count; i++){
+            fprintf(fp, "%lu: %lu [%lu: %lu] @",
+                    (unsigned long)stacks[i].live_objects,
+                    (unsigned long)stacks[i].live_bytes,
+                    (unsigned long)stacks[i].alloc_objects,
+                    (unsigned long)stacks[i].alloc_bytes);
+            for(j = 0; j < stacks[i].depth; j++)
+                fprintf(fp, " %p", stacks[i].frames[j]);
+            fprintf(fp, "\n");
+        }
+
+        //lets pprof map the addresses to the binary and its libraries
+        fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+        maps = fopen("/proc/self/maps", "r");
+        if(maps){
+            while((bytes = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+                fwrite(buffer, 1, bytes, fp);
+            fclose(maps);
+        }
+    }
+    else{
+        for(i = 0; i < count; i++){
+
+            if(!stacks[i].live_objects)
+                continue;
+            for(j = stacks[i].depth; j > 0; j--){
+                mm_profile_folded_frame(fp, stacks[i].frames[j - 1]);
+                fputc(j > 1 ? ';' : ' ', fp);
+            }
+            fprintf(fp, "%lu\n",
+                    (unsigned long)(stacks[i].live_estimated_bytes + 0.5));
+        }
+    }
+
+    if(stacks)
+        mm_return_vm_page_to_kernel(stacks, pages);
+
+    ok = ferror(fp) ? MM_FALSE : MM_TRUE;
+    if(path && fclose(fp))
+        ok = MM_FALSE;
+    else if(!path)
+        fflush(fp);
+    return ok;
+}
+
+//allocates units of the page family, zeroing the memory if asked unless
+//it is known to be zero filled already
+static void *
+mm_allocate(vm_page_family_t *pg_family, int units, vm_bool_t zero){
+
+     void *app_data = NULL;
+     vm_bool_t is_zero = MM_FALSE;
+     uint64_t size = (uint64_t)units * pg_family->struct_size;
+
+     //block size of a span is 32 bit
+     if(units <= 0 || size > UINT32_MAX - SYSTEM_PAGE_SIZE){
+
+         printf("Error : Invalid Memory Request of %d units of %s\n",
+                 units, pg_family->struct_name);
+         return NULL;
+     }
+
+     if(pg_family->thread_affinity)
+         pg_family = mm_get_thread_family(pg_family);
+
+     if(units == 1 && pg_family->thread_cache &&
+             size <= MAX_PAGE_ALLOCATABLE_MEMORY(1)){
+         app_data = mm_thread_cache_allocate(pg_family, zero, &is_zero);
+     }
+     else{
+         pthread_mutex_lock(&pg_family->family_lock);
+         app_data = mm_family_allocate(pg_family, units, zero, &is_zero);
+         if(app_data)
+             pg_family->stats.alloc_count++;
+         pthread_mutex_unlock(&pg_family->family_lock);
+     }
+
+     if(!app_data)
+         return NULL;
+
+     //fresh kernel memory is not touched, it gets faulted in on first use
+     if(zero && !is_zero)
+         memset(app_data, 0, size);
+     mm_profile_account(app_data, size);
+     return app_data;
+}
+
+//search for a page family corresponding to a structure
+static vm_page_family_t *
+mm_lookup_page_family_for_allocation(char *struct_name){
+
+     vm_page_family_t *pg_family =
+             lookup_page_family_by_name(struct_name);
+
+    //return null if page doesnt exist
+     if(!pg_family){
+
+         printf("Error : Structure %s not registered with Memory Manager\n",
+                 struct_name);
+         return NULL;
+     }
+     return pg_family;
+}
+
+/* The public fn to be invoked by the application for Dynamic
+ * Memory Allocations.*/
+void *
+xcalloc(char *struct_name, int units){
+
+     vm_page_family_t *pg_family =
+         mm_lookup_page_family_for_allocation(struct_name);
+
+     if(!pg_family)
+         return NULL;
+
+     return mm_allocate(pg_family, units, MM_TRUE);
+}
+
+/* Same as xcalloc() but takes the page family handle returned at
+ * registration, so no struct name lookup is done at all*/
+void *
+xcalloc_h(vm_page_family_t *pg_family, int units){
+
+     return mm_allocate(pg_family, units, MM_TRUE);
+}
+
+void *
+xmalloc(char *struct_name, int units){
+
+     vm_page_family_t *pg_family =
+         mm_lookup_page_family_for_allocation(struct_name);
+
+     if(!pg_family)
+         return NULL;
+
+     return mm_allocate(pg_family, units, MM_FALSE);
+}
+
+void *
+xmalloc_h(vm_page_family_t *pg_family, int units){
+
+     return mm_allocate(pg_family, units, MM_FALSE);
+}
+
+//argument: pointer to data block which must be dleted
+void
+xfree(void *app_data){
+
+    vm_page_t *hosting_page =
+        MM_GET_PAGE_FROM_DATA(app_data, SYSTEM_PAGE_SIZE);
+    vm_page_family_t *pg_family = hosting_page->pg_family;
+
+    //released together with the arena
+    if(hosting_page->page_type == MM_PAGE_ARENA)
+        return;
+
+    mm_profile_free_check(hosting_page, app_data);
+
+    if(pg_family->thread_cache &&
+            mm_is_single_unit(hosting_page, app_data)){
+        mm_thread_cache_free(pg_family, app_data);
+    }
+    else if(pg_family->deferred_coalescing &&
+            hosting_page->page_type == MM_PAGE_BLOCKS){
+        mm_family_defer_free(pg_family, app_data);
+    }
+    else{
+        pthread_mutex_lock(&pg_family->family_lock);
+        mm_family_free(hosting_page, app_data);
+        pg_family->stats.free_count++;
+        pthread_mutex_unlock(&pg_family->family_lock);
+    }
+}
+int
+xcalloc_batch(vm_page_family_t *pg_family, int n, void **out){
+
+    vm_bool_t is_zero[MM_BATCH_CHUNK];
+    uint32_t chunk, allocated_chunk, i;
+    int allocated = 0;
+
+    if(!pg_family || n < 0){
+        printf("Error : Invalid batch allocation of %d units\n", n);
+        return 0;
+    }
+
+    if(pg_family->thread_affinity)
+        pg_family = mm_get_thread_family(pg_family);
+
+    while(allocated < n){
+
+        chunk = (uint32_t)(n - allocated) < MM_BATCH_CHUNK ?
+            (uint32_t)(n - allocated) : MM_BATCH_CHUNK;
+
+        pthread_mutex_lock(&pg_family->family_lock);
+        allocated_chunk = mm_family_allocate_batch(pg_family, chunk, MM_TRUE,
+                out + allocated, is_zero);
+        pg_family->stats.alloc_count += allocated_chunk;
+        pthread_mutex_unlock(&pg_family->family_lock);
+
+        //zeroed outside the lock, like xcalloc()
+        for(i = 0; i < allocated_chunk; i++){
+            if(!is_zero[i])
+                memset(out[allocated + i], 0, pg_family->struct_size);
+            mm_profile_account(out[allocated + i], pg_family->struct_size);
+        }
+        allocated += allocated_chunk;
+
+        if(allocated_chunk < chunk){
+            xfree_batch(out, allocated);
+            return 0;
+        }
+    }
+    return n;
+}
+
+static int
+mm_address_comparison_function(const void *_app_data1,
+        const void *_app_data2){
+
+    uintptr_t app_data1 = (uintptr_t)*(void * const *)_app_data1;
+    uintptr_t app_data2 = (uintptr_t)*(void * const *)_app_data2;
+
+    if(app_data1 < app_data2)
+        return -1;
+    if(app_data1 > app_data2)
+        return 1;
+    return 0;
+}
+
+void
+xfree_batch(void **ptrs, int n){
+
+    vm_page_family_t *locked_family = NULL;
+    vm_page_family_t *pg_family = NULL;
+    vm_page_t *hosting_page = NULL;
+    int i = 0, j, k;
+
+    if(n <= 0)
+        return;
+
+    //blocks of one page end up next to each other, teardown of objects
+    //allocated in one go is often in address order already
+    for(i = 1; i < n && (uintptr_t)ptrs[i - 1] <= (uintptr_t)ptrs[i]; i++);
+    if(i < n)
+        qsort(ptrs, n, sizeof(void *), mm_address_comparison_function);
+    i = 0;
+
+    while(i < n){
+
+        hosting_page = MM_GET_PAGE_FROM_DATA(ptrs[i], SYSTEM_PAGE_SIZE);
+        pg_family = hosting_page->pg_family;
+
+        for(j = i + 1; j < n &&
+                MM_GET_PAGE_FROM_DATA(ptrs[j], SYSTEM_PAGE_SIZE) == hosting_page;
+                j++);
+
+        if(hosting_page->page_type == MM_PAGE_ARENA){
+            i = j;
+            continue;
+        }
+
+        for(k = i; k < j; k++)
+            mm_profile_free_check(hosting_page, ptrs[k]);
+
+        //consecutive pages of one family are freed under one lock
+        if(pg_family != locked_family){
+            if(locked_family)
+                pthread_mutex_unlock(&locked_family->family_lock);
+            pthread_mutex_lock(&pg_family->family_lock);
+            locked_family = pg_family;
+        }
+
+        if(hosting_page->page_type == MM_PAGE_BLOCKS){
+            mm_free_page_blocks(hosting_page, ptrs + i, (uint32_t)(j - i));
+        }
+        else{
+            for(k = i; k < j; k++)
+                mm_family_free(hosting_page, ptrs[k]);
+        }
+        pg_family->stats.free_count += j - i;
+        i = j;
+    }
+    if(locked_family)
+        pthread_mutex_unlock(&locked_family->family_lock);
+}
+
+//cuts the data block of a meta block page down to size, the tail becomes
+//a free block merged with its free neighbour. Family lock must be held
+static void
+mm_shrink_data_block(block_meta_data_t *block_meta_data, uint32_t size){
+
+    block_meta_data_t *tail = NULL;
+    uint32_t remaining_size = block_meta_data->block_size - size;
+
+    //too small for a meta block, stays hard internal fragmentation
+    if(remaining_size < sizeof(block_meta_data_t) + MM_MIN_DATA_BLOCK_SIZE)
+        return;
+
+    block_meta_data->block_size = size;
+    tail = NEXT_META_BLOCK_BY_SIZE(block_meta_data);
+    tail->is_free = MM_FALSE;
+    tail->is_zero = MM_FALSE;
+    tail->block_size = remaining_size - sizeof(block_meta_data_t);
+    tail->offset = block_meta_data->offset + sizeof(block_meta_data_t) + size;
+    init_avltree_node(MM_FREE_TREE_NODE(tail));
+    mm_bind_blocks_for_allocation(block_meta_data, tail);
+    mm_free_blocks(tail);
+}
+
+//resizes the data block of a meta block page without moving it, growing
+//into the free block after it if needed. Family lock must be held
+static vm_bool_t
+mm_resize_data_block(vm_page_t *hosting_page,
+        block_meta_data_t *block_meta_data,
+        uint32_t size){
+
+    vm_page_family_t *pg_family = hosting_page->pg_family;
+    block_meta_data_t *next_block = NULL;
+    uint32_t old_block_size = block_meta_data->block_size;
+
+    if(size > block_meta_data->block_size){
+
+        //the hard internal fragmentation behind the block comes first
+        mm_reclaim_hard_internal_frag(hosting_page, block_meta_data);
+
+        next_block = NEXT_META_BLOCK(block_meta_data);
+        if(block_meta_data->block_size < size && next_block &&
+                next_block->is_free == MM_TRUE &&
+                block_meta_data->block_size + sizeof(block_meta_data_t) +
+                next_block->block_size >= size){
+
+            mm_remove_free_block_meta_data_from_free_block_list(
+                    pg_family, next_block);
+            block_meta_data->block_size +=
+                sizeof(block_meta_data_t) + next_block->block_size;
+            SET_NEXT_META_BLOCK(block_meta_data, NEXT_META_BLOCK(next_block));
+            if(NEXT_META_BLOCK(next_block))
+                SET_PREV_META_BLOCK(NEXT_META_BLOCK(next_block), block_meta_data);
+            if(pg_family->next_fit_rover == next_block)
+                pg_family->next_fit_rover = block_meta_data;
+        }
+    }
+
+    if(block_meta_data->block_size >= size)
+        mm_shrink_data_block(block_meta_data, size);
+    mm_vm_page_update_occupancy_bin(pg_family, hosting_page);
+
+    pg_family->stats.bytes_in_use +=
+        (int64_t)block_meta_data->block_size - old_block_size;
+    if(pg_family->stats.bytes_in_use > pg_family->stats.peak_bytes_in_use)
+        pg_family->stats.peak_bytes_in_use = pg_family->stats.bytes_in_use;
+
+    return block_meta_data->block_size >= size ? MM_TRUE : MM_FALSE;
+}
+
+void *
+xrealloc(void *app_data, int units){
+
+    vm_page_t *hosting_page = NULL;
+    vm_page_family_t *pg_family = NULL;
+    block_meta_data_t *block_meta_data = NULL;
+    uint64_t size, block_size, old_size;
+    vm_bool_t resized = MM_FALSE;
+    void *new_app_data = NULL;
+
+    if(!app_data){
+        printf("Error : xrealloc() needs a data block to find its page family\n");
+        return NULL;
+    }
+
+    hosting_page = MM_GET_PAGE_FROM_DATA(app_data, SYSTEM_PAGE_SIZE);
+    pg_family = hosting_page->pg_family;
+    size = (uint64_t)units * pg_family->struct_size;
+
+    if(units <= 0 || size > UINT32_MAX - SYSTEM_PAGE_SIZE){
+
+        printf("Error : Invalid Memory Request of %d units of %s\n",
+                units, pg_family->struct_name);
+        return NULL;
+    }
+
+    if(hosting_page->page_type == MM_PAGE_ARENA){
+        printf("Error : Objects of an arena can not be resized\n");
+        return NULL;
+    }
+
+    block_size = mm_family_block_size(pg_family, size);
+    block_meta_data = (block_meta_data_t *)app_data - 1;
+
+    pthread_mutex_lock(&pg_family->family_lock);
+    switch(hosting_page->page_type){
+
+        case MM_PAGE_SLAB:
+            old_size = pg_family->struct_size;
+            resized = (units == 1) ? MM_TRUE : MM_FALSE;
+            break;
+        case MM_PAGE_SPAN:
+            //a smaller size which fits a page moves out to give pages back
+            old_size = block_meta_data->block_size;
+            resized = (block_size > MAX_PAGE_ALLOCATABLE_MEMORY(1) &&
+                    size <= block_meta_data->block_size) ? MM_TRUE : MM_FALSE;
+            break;
+        case MM_PAGE_BLOCKS:
+        default:
+            old_size = block_meta_data->block_size;
+            if(block_size <= MAX_PAGE_ALLOCATABLE_MEMORY(1)){
+                resized = mm_resize_data_block(hosting_page, block_meta_data,
+                        (uint32_t)block_size);
+            }
+            break;
+    }
+    pthread_mutex_unlock(&pg_family->family_lock);
+
+    if(resized){
+        if(__atomic_load_n(&hosting_page->sampled_objects, __ATOMIC_RELAXED))
+            mm_profile_resize(app_data, size);
+        return app_data;
+    }
+
+    new_app_data = mm_allocate(pg_family, units, MM_FALSE);
+    if(!new_app_data)
+        return NULL;
+
+    memcpy(new_app_data, app_data, size < old_size ? size : old_size);
+    xfree(app_data);
+    return new_app_data;
+}
+
+uint32_t
+mm_usable_size(void *app_data){
+
+    vm_page_t *hosting_page = NULL;
+
+    if(!app_data)
+        return 0;
+
+    hosting_page = MM_GET_PAGE_FROM_DATA(app_data, SYSTEM_PAGE_SIZE);
+    switch(hosting_page->page_type){
+
+        case MM_PAGE_SLAB:
+            return hosting_page->pg_family->struct_size;
+        case MM_PAGE_ARENA:
+            return 0;
+        case MM_PAGE_SPAN:
+        case MM_PAGE_BLOCKS:
+        default:
+            //the block is allocated, its size does not change under us
+            return ((block_meta_data_t *)app_data - 1)->block_size;
+    }
+}
+
+/* Arenas : an arena keeps pages of its own for every page family it
+ * allocates from, objects are bumped one after the other in a page and
+ * have no meta block. The pages hang off their page family too, so the
+ * objects are reported with the family, and go back to the family page
+ * pool all at once when the arena is destroyed*/
+
+mm_arena_t *
+mm_arena_create(){
+
+    mm_arena_t *arena = mm_get_new_vm_page_from_kernel(1);
+
+    if(!arena)
+        return NULL;
+
+    arena->families_count = 0;
+    arena->last_family = NULL;
+    return arena;
+}
+
+//pages of the page family in the arena, added on first use
+static mm_arena_family_t *
+mm_arena_get_family(mm_arena_t *arena, vm_page_family_t *pg_family){
+
+    mm_arena_family_t *arena_family = arena->last_family;
+    uint32_t i;
+
+    if(arena_family && arena_family->pg_family == pg_family)
+        return arena_family;
+
+    for(i = 0; i < arena->families_count; i++){
+        if(arena->families[i].pg_family == pg_family){
+            arena->last_family = &arena->families[i];
+            return arena->last_family;
+        }
+    }
+
+    if(arena->families_count == MAX_FAMILIES_PER_ARENA){
+        printf("Error : Arena can not hold objects of more than %lu "
+                "page families\n", (unsigned long)MAX_FAMILIES_PER_ARENA);
+        return NULL;
+    }
+
+    arena_family = &arena->families[arena->families_count++];
+    arena_family->pg_family = pg_family;
+    arena_family->first_page = NULL;
+    arena_family->current_page = NULL;
+    arena_family->first_big_page = NULL;
+    arena->last_family = arena_family;
+    return arena_family;
+}
+
+//new arena page of the page family, pages more than 1 for one big object
+static vm_page_t *
+mm_arena_page_new(vm_page_family_t *pg_family, uint32_t pages){
+
+    vm_page_t *vm_page = NULL;
+    vm_bool_t is_zero = MM_TRUE;
+
+    pthread_mutex_lock(&pg_family->family_lock);
+    if(pages == 1)
+        vm_page = mm_family_get_vm_page(pg_family, &is_zero);
+    else
+        vm_page = mm_get_new_vm_page_from_kernel(pages);
+
+    if(!vm_page){
+        pthread_mutex_unlock(&pg_family->family_lock);
+        return NULL;
+    }
+
+    vm_page->pg_family = pg_family;
+    vm_page->page_type = MM_PAGE_ARENA;
+    __atomic_store_n(&vm_page->sampled_objects, 0, __ATOMIC_RELAXED);
+    vm_page->arena.next_page = NULL;
+    vm_page->arena.used = MM_ARENA_DATA_OFFSET;
+    vm_page->arena.objects = 0;
+    vm_page->arena.pages = pages;
+    vm_page->arena.is_zero = is_zero;
+
+    vm_page->prev = NULL;
+    vm_page->next = pg_family->first_arena_page;
+    if(pg_family->first_arena_page)
+        pg_family->first_arena_page->prev = vm_page;
+    pg_family->first_arena_page = vm_page;
+    pg_family->stats.pages_held += pages;
+    pthread_mutex_unlock(&pg_family->family_lock);
+    return vm_page;
+}
+
+//hands a list of arena pages of the page family back, family lock held
+static void
+mm_arena_pages_release(vm_page_family_t *pg_family, vm_page_t *vm_page){
+
+    vm_page_t *next_page = NULL;
+
+    for(; vm_page; vm_page = next_page){
+
+        next_page = vm_page->arena.next_page;
+
+        if(pg_family->first_arena_page == vm_page)
+            pg_family->first_arena_page = vm_page->next;
+        if(vm_page->next)
+            vm_page->next->prev = vm_page->prev;
+        if(vm_page->prev)
+            vm_page->prev->next = vm_page->next;
+        mm_family_pages_released(pg_family, vm_page->arena.pages);
+
+        if(vm_page->arena.pages == 1)
+            mm_family_put_vm_page(pg_family, (void *)vm_page);
+        else
+            mm_return_vm_page_to_kernel((void *)vm_page, vm_page->arena.pages);
+    }
+}
+
+void *
+xcalloc_in_h(mm_arena_t *arena, vm_page_family_t *pg_family, int units){
+
+    uint64_t size = (uint64_t)units * pg_family->struct_size;
+    uint32_t alignment = pg_family->alignment;
+    mm_arena_family_t *arena_family = NULL;
+    vm_page_t *vm_page = NULL;
+    uint64_t offset = 0;
+
+    if(units <= 0 || size > UINT32_MAX - SYSTEM_PAGE_SIZE){
+
+        printf("Error : Invalid Memory Request of %d units of %s\n",
+                units, pg_family->struct_name);
+        return NULL;
+    }
+
+    arena_family = mm_arena_get_family(arena, pg_family);
+    if(!arena_family)
+        return NULL;
+
+    //bigger than a page, pages of its own released by the next reset
+    if(MM_ARENA_DATA_OFFSET + size > SYSTEM_PAGE_SIZE){
+
+        vm_page = mm_arena_page_new(pg_family,
+                (uint32_t)((MM_ARENA_DATA_OFFSET + size + SYSTEM_PAGE_SIZE - 1) /
+                    SYSTEM_PAGE_SIZE));
+        if(!vm_page)
+            return NULL;
+
+        vm_page->arena.next_page = arena_family->first_big_page;
+        arena_family->first_big_page = vm_page;
+        MM_ARENA_PAGE_SET(vm_page->arena.used,
+                (uint32_t)(MM_ARENA_DATA_OFFSET + size));
+        MM_ARENA_PAGE_SET(vm_page->arena.objects, 1);
+        return (char *)vm_page + MM_ARENA_DATA_OFFSET;
+    }
+
+    //pages past the current one are empty, left by a reset
+    for(vm_page = arena_family->current_page; vm_page;
+            vm_page = vm_page->arena.next_page){
+
+        offset = (vm_page->arena.used + alignment - 1) & ~(alignment - 1);
+        if(offset + size <= SYSTEM_PAGE_SIZE)
+            break;
+    }
+
+    if(!vm_page){
+
+        vm_page = mm_arena_page_new(pg_family, 1);
+        if(!vm_page)
+            return NULL;
+
+        if(arena_family->current_page)
+            arena_family->current_page->arena.next_page = vm_page;
+        else
+            arena_family->first_page = vm_page;
+        offset = MM_ARENA_DATA_OFFSET;
+    }
+
+    arena_family->current_page = vm_page;
+    MM_ARENA_PAGE_SET(vm_page->arena.used, (uint32_t)(offset + size));
+    MM_ARENA_PAGE_SET(vm_page->arena.objects, vm_page->arena.objects + 1);
+
+    if(!vm_page->arena.is_zero)
+        memset((char *)vm_page + offset, 0, size);
+    return (char *)vm_page + offset;
+}
+
+void *
+xcalloc_in(mm_arena_t *arena, char *struct_name, int units){
+
+     vm_page_family_t *pg_family =
+         mm_lookup_page_family_for_allocation(struct_name);
+
+     if(!pg_family)
+         return NULL;
+
+     return xcalloc_in_h(arena, pg_family, units);
+}
+
+void
+mm_arena_reset(mm_arena_t *arena){
+
+    mm_arena_family_t *arena_family = NULL;
+    vm_page_t *vm_page = NULL;
+    uint32_t i;
+
+    for(i = 0; i < arena->families_count; i++){
+
+        arena_family = &arena->families[i];
+
+        if(arena_family->first_big_page){
+            pthread_mutex_lock(&arena_family->pg_family->family_lock);
+            mm_arena_pages_release(arena_family->pg_family,
+                    arena_family->first_big_page);
+            pthread_mutex_unlock(&arena_family->pg_family->family_lock);
+            arena_family->first_big_page = NULL;
+        }
+
+        //pages are rewound and need zeroing from now on, untouched ones stay zero
+        for(vm_page = arena_family->first_page; vm_page;
+                vm_page = vm_page->arena.next_page){
+
+            if(vm_page->arena.used == MM_ARENA_DATA_OFFSET)
+                continue;
+            vm_page->arena.is_zero = MM_FALSE;
+            MM_ARENA_PAGE_SET(vm_page->arena.objects, 0);
+            MM_ARENA_PAGE_SET(vm_page->arena.used,
+                    (uint32_t)MM_ARENA_DATA_OFFSET);
+        }
+        arena_family->current_page = arena_family->first_page;
+    }
+}
+
+void
+mm_arena_destroy(mm_arena_t *arena){
+
+    mm_arena_family_t *arena_family = NULL;
+    uint32_t i;
+
+    for(i = 0; i < arena->families_count; i++){
+
+        arena_family = &arena->families[i];
+
+        pthread_mutex_lock(&arena_family->pg_family->family_lock);
+        mm_arena_pages_release(arena_family->pg_family,
+                arena_family->first_big_page);
+        mm_arena_pages_release(arena_family->pg_family,
+                arena_family->first_page);
+        pthread_mutex_unlock(&arena_family->pg_family->family_lock);
+    }
+    mm_return_vm_page_to_kernel(arena, 1);
+}
+
+//if next and previous is null and is filled is false then only page is empty
+vm_bool_t
+mm_is_vm_page_empty(vm_page_t *vm_page){
+
+    if(NEXT_META_BLOCK(&vm_page->block_meta_data) == NULL &&
+            PREV_META_BLOCK(&vm_page->block_meta_data) == NULL &&
+            vm_page->block_meta_data.is_free == MM_TRUE){
+
+        return MM_TRUE;
+    }
+    return MM_FALSE;
+}
+
+
+
+//print meta block data, for each page family prints occupied free meta block, occupied metablock and total metablock(fbc+obc=tbc)
+
+//appmemusage: (size of metablock=48), size of datablocks+their metablocks, free meta block isnt used in calculation
+void
+mm_print_block_usage(){
+
+    vm_page_t *vm_page_curr;
+    vm_page_family_t *vm_page_family_curr;
+    vm_page_family_t *thread_family;
+    block_meta_data_t *block_meta_data_curr;
+    uint32_t total_block_count, free_block_count,
+             occupied_block_count;
+    uint32_t application_memory_usage;
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        total_block_count = 0;
+        free_block_count = 0;
+        application_memory_usage = 0;
+        occupied_block_count = 0;
+
+        ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family_curr, thread_family){
+
+            pthread_mutex_lock(&thread_family->family_lock);
+            mm_family_coalesce_pending(thread_family, UINT32_MAX);
+            ITERATE_VM_PAGE_BEGIN(thread_family, vm_page_curr){
+
+                ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page_curr, block_meta_data_curr){
+
+                    total_block_count++;
+
+                    /*Sanity Checks*/
+#ifndef MM_COMPACT_BLOCK_HEADER
+                    //compact meta blocks have no tree node once allocated
+                    if(block_meta_data_curr->is_free == MM_FALSE){
+                        assert(!AVLTREE_IS_NODE_IN_TREE(
+                                    MM_FREE_TREE_NODE(block_meta_data_curr)));
+                    }
+#endif
+                    if(block_meta_data_curr->is_free == MM_TRUE){
+                        assert(AVLTREE_IS_NODE_IN_TREE(
+                                    MM_FREE_TREE_NODE(block_meta_data_curr)));
+                    }
+
+                    if(block_meta_data_curr->is_free == MM_TRUE){
+                        free_block_count++;
+                    }
+                    else{
+                        application_memory_usage +=
+                            block_meta_data_curr->block_size + \
+                            sizeof(block_meta_data_t);
+                        occupied_block_count++;
+                    }
+                } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page_curr, block_meta_data_curr);
+            } ITERATE_VM_PAGE_END(thread_family, vm_page_curr);
+
+            //every slot of a slab page counts as a block with no meta block
+            ITERATE_VM_SLAB_PAGE_BEGIN(thread_family, vm_page_curr){
+
+                total_block_count += thread_family->slab_slots_per_page;
+                free_block_count += thread_family->slab_slots_per_page -
+                    vm_page_curr->slab.used_slots;
+                occupied_block_count += vm_page_curr->slab.used_slots;
+                application_memory_usage += vm_page_curr->slab.used_slots *
+                    thread_family->slab_slot_size;
+            } ITERATE_VM_SLAB_PAGE_END(thread_family, vm_page_curr);
+
+            //objects of arenas are occupied blocks with no meta block
+            ITERATE_VM_ARENA_PAGE_BEGIN(thread_family, vm_page_curr){
+
+                uint32_t objects = __atomic_load_n(
+                        &vm_page_curr->arena.objects, __ATOMIC_RELAXED);
+
+                total_block_count += objects;
+                occupied_block_count += objects;
+                if(objects){
+                    application_memory_usage += __atomic_load_n(
+                            &vm_page_curr->arena.used, __ATOMIC_RELAXED) -
+                        MM_ARENA_DATA_OFFSET;
+                }
+            } ITERATE_VM_ARENA_PAGE_END(thread_family, vm_page_curr);
+
+            //a span is one occupied block
+            ITERATE_VM_SPAN_BEGIN(thread_family, vm_page_curr){
+
+                total_block_count++;
+                occupied_block_count++;
+                application_memory_usage +=
+                    vm_page_curr->block_meta_data.block_size +
+                    sizeof(block_meta_data_t);
+            } ITERATE_VM_SPAN_END(thread_family, vm_page_curr);
+            pthread_mutex_unlock(&thread_family->family_lock);
+        } ITERATE_THREAD_FAMILIES_END(vm_page_family_curr, thread_family);
+
+        printf("%-20s   TBC : %-4u    FBC : %-4u    OBC : %-4u AppMemUsage : %u\n",
+                vm_page_family_curr->struct_name, total_block_count,
+                free_block_count, occupied_block_count, application_memory_usage);
+
+    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_mutex_unlock(&page_family_registry_lock);
+}
+
+//iterates over all pge family, and for all page family it prints all the vm page meta blocks
+void
+mm_print_memory_usage(char *struct_name){
+
+    vm_page_t *vm_page = NULL;
+    vm_page_family_t *vm_page_family_curr;
+    vm_page_family_t *thread_family;
+    uint32_t number_of_struct_families = 0;
+    uint32_t cumulative_vm_pages_claimed_from_kernel = 0;
+
+    printf("\nPage Size = %zu Bytes\n", SYSTEM_PAGE_SIZE);
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        if(struct_name){
+            if(strncmp(struct_name, vm_page_family_curr->struct_name,
+                        strlen(vm_page_family_curr->struct_name))){
+                continue;
+            }
+        }
+
+        number_of_struct_families++;
+
+        printf(ANSI_COLOR_GREEN "vm_page_family : %s, struct size = %u\n"
+                ANSI_COLOR_RESET,
+                vm_page_family_curr->struct_name,
+                vm_page_family_curr->struct_size);
+
+        //pages of per thread families are listed with their registered family
+        ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family_curr, thread_family){
+
+            pthread_mutex_lock(&thread_family->family_lock);
+            mm_family_coalesce_pending(thread_family, UINT32_MAX);
+            ITERATE_VM_PAGE_BEGIN(thread_family, vm_page){
+
+                cumulative_vm_pages_claimed_from_kernel++;
+                mm_print_vm_page_details(vm_page);
+
+            } ITERATE_VM_PAGE_END(thread_family, vm_page);
+
+            ITERATE_VM_SLAB_PAGE_BEGIN(thread_family, vm_page){
+
+                cumulative_vm_pages_claimed_from_kernel++;
+                mm_print_vm_page_details(vm_page);
+
+            } ITERATE_VM_SLAB_PAGE_END(thread_family, vm_page);
+
+            ITERATE_VM_ARENA_PAGE_BEGIN(thread_family, vm_page){
+
+                cumulative_vm_pages_claimed_from_kernel += vm_page->arena.pages;
+                mm_print_vm_page_details(vm_page);
+
+            } ITERATE_VM_ARENA_PAGE_END(thread_family, vm_page);
+
+            ITERATE_VM_SPAN_BEGIN(thread_family, vm_page){
+
+                cumulative_vm_pages_claimed_from_kernel += MM_SPAN_PAGES(vm_page);
+                mm_print_vm_page_details(vm_page);
+
+            } ITERATE_VM_SPAN_END(thread_family, vm_page);
+            pthread_mutex_unlock(&thread_family->family_lock);
+        } ITERATE_THREAD_FAMILIES_END(vm_page_family_curr, thread_family);
+        printf("\n");
+    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_mutex_unlock(&page_family_registry_lock);
 
     printf(ANSI_COLOR_MAGENTA "# Of VM Pages in Use : %u (%lu Bytes)\n" \
             ANSI_COLOR_RESET,
             cumulative_vm_pages_claimed_from_kernel,
             SYSTEM_PAGE_SIZE * cumulative_vm_pages_claimed_from_kernel);
 
-    float memory_app_use_to_total_memory_ratio = 0.0;
-
     printf("Total Memory being used by Memory Manager = %lu Bytes\n",
             cumulative_vm_pages_claimed_from_kernel * SYSTEM_PAGE_SIZE);
 }
 
 
+
+/*Heap snapshot*/
+
+_Static_assert(sizeof(((mm_family_snapshot_t *)0)->struct_name) ==
+        MM_MAX_STRUCT_NAME, "snapshot struct name must fit a family name");
+_Static_assert((int)MM_SNAPSHOT_PAGE_BLOCKS == (int)MM_PAGE_BLOCKS &&
+        (int)MM_SNAPSHOT_PAGE_SLAB == (int)MM_PAGE_SLAB &&
+        (int)MM_SNAPSHOT_PAGE_SPAN == (int)MM_PAGE_SPAN &&
+        (int)MM_SNAPSHOT_PAGE_ARENA == (int)MM_PAGE_ARENA,
+        "snapshot page types must match the vm page types");
+
+//growable array of pages from the kernel. Snapshots are built under the
+//family locks and never call malloc(), which may be served by this memory
+//manager itself
+typedef struct mm_snapshot_array_{
+
+    char *data;
+    uint32_t count;
+    uint32_t pages;
+    uint32_t elem_size;
+} mm_snapshot_array_t;
+
+//zero filled room for one more element, NULL if out of memory
+static void *
+mm_snapshot_array_add(mm_snapshot_array_t *array){
+
+    if((uint64_t)(array->count + 1) * array->elem_size >
+            (uint64_t)array->pages * SYSTEM_PAGE_SIZE){
+
+        uint32_t pages = array->pages ? array->pages * 2 : 1;
+        char *data = mm_get_new_vm_page_from_kernel(pages);
+
+        if(!data)
+            return NULL;
+
+        if(array->data){
+            memcpy(data, array->data,
+                    (size_t)array->count * array->elem_size);
+            mm_return_vm_page_to_kernel(array->data, array->pages);
+        }
+        array->data = data;
+        array->pages = pages;
+    }
+    return array->data + (size_t)array->count++ * array->elem_size;
+}
+
+static void
+mm_snapshot_array_release(mm_snapshot_array_t *array){
+
+    if(array->data)
+        mm_return_vm_page_to_kernel(array->data, array->pages);
+    array->data = NULL;
+    array->count = 0;
+    array->pages = 0;
+}
+
+//zero filled snapshot with room for the families and pages in one mapping
+static mm_heap_snapshot_t *
+mm_heap_snapshot_alloc(uint32_t families_count, uint32_t pages_count){
+
+    uint64_t families_offset = (sizeof(mm_heap_snapshot_t) + 7) & ~7UL;
+    uint64_t pages_offset = families_offset +
+        (uint64_t)families_count * sizeof(mm_family_snapshot_t);
+    uint64_t size = pages_offset +
+        (uint64_t)pages_count * sizeof(mm_page_snapshot_t);
+    uint64_t pages = (size + SYSTEM_PAGE_SIZE - 1) / SYSTEM_PAGE_SIZE;
+    mm_heap_snapshot_t *snapshot = NULL;
+
+    if(pages > INT32_MAX)
+        return NULL;
+
+    snapshot = mm_get_new_vm_page_from_kernel((int)pages);
+    if(!snapshot)
+        return NULL;
+
+    snapshot->size = pages * SYSTEM_PAGE_SIZE;
+    snapshot->page_size = (uint32_t)SYSTEM_PAGE_SIZE;
+    snapshot->families_count = families_count;
+    snapshot->pages_count = pages_count;
+    snapshot->families =
+        (mm_family_snapshot_t *)((char *)snapshot + families_offset);
+    snapshot->pages = (mm_page_snapshot_t *)((char *)snapshot + pages_offset);
+    return snapshot;
+}
+
+void
+mm_heap_snapshot_free(mm_heap_snapshot_t *snapshot){
+
+    if(snapshot)
+        mm_return_vm_page_to_kernel(snapshot,
+                (int)(snapshot->size / SYSTEM_PAGE_SIZE));
+}
+
+static inline uint32_t
+mm_snapshot_histogram_bucket(uint64_t size){
+
+    return size ? 63 - __builtin_clzll(size) : 0;
+}
+
+static inline double
+mm_external_frag_index(uint64_t free_bytes, uint64_t largest_free_block){
+
+    return free_bytes ? 1.0 - (double)largest_free_block / free_bytes : 0;
+}
+
+static void
+mm_snapshot_page_free_blocks(mm_page_snapshot_t *page,
+        uint32_t size, uint32_t count){
+
+    page->free_blocks += count;
+    page->free_bytes += size * count;
+    page->free_block_histogram[mm_snapshot_histogram_bucket(size)] += count;
+    if(size > page->largest_free_block)
+        page->largest_free_block = size;
+}
+
+//family lock must be held
+static void
+mm_snapshot_page(vm_page_family_t *pg_family, vm_page_t *vm_page,
+        mm_page_snapshot_t *page){
+
+    block_meta_data_t *curr = NULL;
+    uint32_t unit_size = (uint32_t)mm_family_unit_block_size(pg_family);
+    uint32_t slots = pg_family->slab_slots_per_page;
+    uint32_t used, objects;
+
+    page->address = (uintptr_t)vm_page;
+    page->page_type = vm_page->page_type;
+    page->system_pages = 1;
+
+    switch(vm_page->page_type){
+
+        case MM_PAGE_BLOCKS:
+            ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page, curr){
+
+                block_meta_data_t *next_block = NEXT_META_BLOCK(curr);
+                char *end = next_block ? (char *)next_block :
+                    (char *)vm_page + SYSTEM_PAGE_SIZE;
+
+                page->meta_bytes += sizeof(block_meta_data_t);
+                page->hard_internal_frag_bytes +=
+                    end - (char *)NEXT_META_BLOCK_BY_SIZE(curr);
+                if(curr->is_free == MM_TRUE){
+                    mm_snapshot_page_free_blocks(page, curr->block_size, 1);
+                    if(curr->block_size < unit_size)
+                        page->soft_internal_frag_bytes += curr->block_size;
+                }
+                else{
+                    page->occupied_blocks++;
+                    page->occupied_bytes += curr->block_size;
+                }
+            } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page, curr);
+            break;
+
+        case MM_PAGE_SLAB:
+            page->occupied_blocks = vm_page->slab.used_slots;
+            page->occupied_bytes =
+                vm_page->slab.used_slots * pg_family->slab_slot_size;
+            if(slots > vm_page->slab.used_slots){
+                mm_snapshot_page_free_blocks(page, pg_family->slab_slot_size,
+                        slots - vm_page->slab.used_slots);
+            }
+            page->hard_internal_frag_bytes = SYSTEM_PAGE_SIZE -
+                pg_family->slab_slots_offset -
+                slots * pg_family->slab_slot_size;
+            break;
+
+        case MM_PAGE_SPAN:
+            page->system_pages = MM_SPAN_PAGES(vm_page);
+            page->occupied_blocks = 1;
+            page->occupied_bytes = vm_page->block_meta_data.block_size;
+            page->meta_bytes = sizeof(block_meta_data_t);
+            page->hard_internal_frag_bytes =
+                page->system_pages * SYSTEM_PAGE_SIZE -
+                MM_FIRST_DATA_BLOCK_OFFSET - page->occupied_bytes;
+            break;
+
+        case MM_PAGE_ARENA:
+            //the bump space left is one free block, usable by the arena only
+            page->system_pages = vm_page->arena.pages;
+            objects = __atomic_load_n(&vm_page->arena.objects,
+                    __ATOMIC_RELAXED);
+            used = __atomic_load_n(&vm_page->arena.used, __ATOMIC_RELAXED);
+            page->occupied_blocks = objects;
+            page->occupied_bytes = used - MM_ARENA_DATA_OFFSET;
+            if(page->system_pages * SYSTEM_PAGE_SIZE > used){
+                mm_snapshot_page_free_blocks(page,
+                        page->system_pages * SYSTEM_PAGE_SIZE - used, 1);
+            }
+            break;
+    }
+
+    page->external_frag_index =
+        mm_external_frag_index(page->free_bytes, page->largest_free_block);
+}
+
+//adds a page to the totals of its family
+static void
+mm_snapshot_family_add_page(mm_family_snapshot_t *family,
+        mm_page_snapshot_t *page){
+
+    uint32_t i;
+
+    family->pages_count++;
+    family->system_pages += page->system_pages;
+    family->occupied_blocks += page->occupied_blocks;
+    family->free_blocks += page->free_blocks;
+    family->occupied_bytes += page->occupied_bytes;
+    family->free_bytes += page->free_bytes;
+    family->meta_bytes += page->meta_bytes;
+    family->soft_internal_frag_bytes += page->soft_internal_frag_bytes;
+    family->hard_internal_frag_bytes += page->hard_internal_frag_bytes;
+    if(page->largest_free_block > family->largest_free_block)
+        family->largest_free_block = page->largest_free_block;
+    for(i = 0; i < MM_SNAPSHOT_HISTOGRAM_BUCKETS; i++)
+        family->free_block_histogram[i] += page->free_block_histogram[i];
+}
+
+//pages of one list of a family, family lock must be held
+#define MM_SNAPSHOT_PAGE_LIST(pg_family, first, family, pages, failed)      \
+{                                                                           \
+    vm_page_t *_vm_page;                                                    \
+    mm_page_snapshot_t *_page;                                              \
+    for(_vm_page = first; _vm_page && !failed; _vm_page = _vm_page->next){  \
+        _page = mm_snapshot_array_add(pages);                               \
+        if(!_page){                                                         \
+            failed = MM_TRUE;                                               \
+            break;                                                          \
+        }                                                                   \
+        mm_snapshot_page(pg_family, _vm_page, _page);                       \
+        mm_snapshot_family_add_page(family, _page);                         \
+    }                                                                       \
+}
+
+mm_heap_snapshot_t *
+mm_heap_snapshot_take(){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+    vm_page_family_t *thread_family = NULL;
+    mm_family_snapshot_t *family = NULL;
+    mm_heap_snapshot_t *snapshot = NULL;
+    mm_page_family_stats_t magazines;
+    mm_snapshot_array_t families = {NULL, 0, 0, sizeof(mm_family_snapshot_t)};
+    mm_snapshot_array_t pages = {NULL, 0, 0, sizeof(mm_page_snapshot_t)};
+    vm_bool_t failed = MM_FALSE;
+    struct timespec ts;
+    uint32_t i, first_page;
+
+    pthread_mutex_lock(&page_family_registry_lock);
+    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        //the registry walk is a nested loop, skip the rest once failed
+        if(failed)
+            continue;
+        family = mm_snapshot_array_add(&families);
+        if(!family){
+            failed = MM_TRUE;
+            continue;
+        }
+        memcpy(family->struct_name, vm_page_family_curr->struct_name,
+                MM_MAX_STRUCT_NAME);
+        family->family_id = MM_FAMILY_ID(vm_page_family_curr);
+        family->struct_size = vm_page_family_curr->struct_size;
+
+        ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family_curr, thread_family){
+
+            pthread_mutex_lock(&thread_family->family_lock);
+            mm_family_coalesce_pending(thread_family, UINT32_MAX);
+            family->pages_retained += thread_family->page_pool.count;
+            MM_SNAPSHOT_PAGE_LIST(thread_family, thread_family->first_page,
+                    family, &pages, failed);
+            MM_SNAPSHOT_PAGE_LIST(thread_family,
+                    thread_family->first_slab_page, family, &pages, failed);
+            MM_SNAPSHOT_PAGE_LIST(thread_family, thread_family->first_span,
+                    family, &pages, failed);
+            MM_SNAPSHOT_PAGE_LIST(thread_family,
+                    thread_family->first_arena_page, family, &pages, failed);
+            pthread_mutex_unlock(&thread_family->family_lock);
+
+            pthread_mutex_lock(&thread_cache_list_lock);
+            mm_thread_cache_family_counters(thread_family, &magazines);
+            pthread_mutex_unlock(&thread_cache_list_lock);
+            family->cached_blocks += magazines.blocks_in_use;
+        } ITERATE_THREAD_FAMILIES_END(vm_page_family_curr, thread_family);
+
+        family->external_frag_index = mm_external_frag_index(
+                family->free_bytes, family->largest_free_block);
+    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_mutex_unlock(&page_family_registry_lock);
+
+    if(!failed)
+        snapshot = mm_heap_snapshot_alloc(families.count, pages.count);
+
+    if(snapshot){
+        clock_gettime(CLOCK_REALTIME, &ts);
+        snapshot->taken_at_ms =
+            (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        if(families.count){
+            memcpy(snapshot->families, families.data,
+                    (size_t)families.count * sizeof(mm_family_snapshot_t));
+        }
+        if(pages.count){
+            memcpy(snapshot->pages, pages.data,
+                    (size_t)pages.count * sizeof(mm_page_snapshot_t));
+        }
+        for(i = 0, first_page = 0; i < snapshot->families_count; i++){
+            snapshot->families[i].pages = snapshot->pages + first_page;
+            first_page += snapshot->families[i].pages_count;
+        }
+    }
+
+    mm_snapshot_array_release(&families);
+    mm_snapshot_array_release(&pages);
+    return snapshot;
+}
+
+//struct names are registered by the application, escape them for JSON
+static void
+mm_snapshot_json_string(FILE *fp, const char *str, size_t max_len){
+
+    size_t i;
+
+    fputc('"', fp);
+    for(i = 0; i < max_len && str[i]; i++){
+        unsigned char c = (unsigned char)str[i];
+        if(c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if(c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+//non zero buckets as [smallest size of the bucket, blocks] pairs
+static void
+mm_snapshot_json_histogram(FILE *fp, const uint64_t *buckets64,
+        const uint16_t *buckets16){
+
+    uint32_t i;
+    const char *sep = "";
+
+    fprintf(fp, "\"free_block_histogram\":[");
+    for(i = 0; i < MM_SNAPSHOT_HISTOGRAM_BUCKETS; i++){
+        uint64_t count = buckets64 ? buckets64[i] : buckets16[i];
+        if(!count)
+            continue;
+        fprintf(fp, "%s[%llu,%llu]", sep, 1ULL << i,
+                (unsigned long long)count);
+        sep = ",";
+    }
+    fprintf(fp, "]");
+}
+
+static const char *mm_snapshot_page_type_names[] = {
+    "blocks", "slab", "span", "arena"};
+
+vm_bool_t
+mm_heap_snapshot_write_json(mm_heap_snapshot_t *snapshot, char *path){
+
+    FILE *fp = path ? fopen(path, "w") : stdout;
+    mm_family_snapshot_t *family = NULL;
+    mm_page_snapshot_t *page = NULL;
+    uint32_t i, j;
+    vm_bool_t ok;
+
+    if(!fp){
+        printf("Error : Could not open %s for the heap snapshot\n", path);
+        return MM_FALSE;
+    }
+
+    fprintf(fp, "{\"taken_at_ms\":%llu,\"page_size\":%u,\"families\":[",
+            (unsigned long long)snapshot->taken_at_ms, snapshot->page_size);
+
+    for(i = 0; i < snapshot->families_count; i++){
+
+        family = &snapshot->families[i];
+        fprintf(fp, "%s\n{\"struct_name\":", i ? "," : "");
+        mm_snapshot_json_string(fp, family->struct_name, MM_MAX_STRUCT_NAME);
+        fprintf(fp, ",\"family_id\":%u,\"struct_size\":%u,"
+                "\"system_pages\":%llu,\"pages_retained\":%u,"
+                "\"cached_blocks\":%llu,"
+                "\"occupied_blocks\":%llu,\"free_blocks\":%llu,"
+                "\"occupied_bytes\":%llu,\"free_bytes\":%llu,"
+                "\"meta_bytes\":%llu,\"largest_free_block\":%llu,"
+                "\"soft_internal_frag_bytes\":%llu,"
+                "\"hard_internal_frag_bytes\":%llu,"
+                "\"external_frag_index\":%.4f,",
+                family->family_id, family->struct_size,
+                (unsigned long long)family->system_pages,
+                family->pages_retained,
+                (unsigned long long)family->cached_blocks,
+                (unsigned long long)family->occupied_blocks,
+                (unsigned long long)family->free_blocks,
+                (unsigned long long)family->occupied_bytes,
+                (unsigned long long)family->free_bytes,
+                (unsigned long long)family->meta_bytes,
+                (unsigned long long)family->largest_free_block,
+                (unsigned long long)family->soft_internal_frag_bytes,
+                (unsigned long long)family->hard_internal_frag_bytes,
+                family->external_frag_index);
+        mm_snapshot_json_histogram(fp, family->free_block_histogram, NULL);
+        fprintf(fp, ",\"pages\":[");
+
+        for(j = 0; j < family->pages_count; j++){
+
+            page = &family->pages[j];
+            fprintf(fp, "%s\n {\"address\":\"0x%llx\",\"type\":\"%s\","
+                    "\"system_pages\":%u,"
+                    "\"occupied_blocks\":%u,\"free_blocks\":%u,"
+                    "\"occupied_bytes\":%u,\"free_bytes\":%u,"
+                    "\"meta_bytes\":%u,\"largest_free_block\":%u,"
+                    "\"soft_internal_frag_bytes\":%u,"
+                    "\"hard_internal_frag_bytes\":%u,"
+                    "\"external_frag_index\":%.4f,",
+                    j ? "," : "",
+                    (unsigned long long)page->address,
+                    page->page_type <= MM_SNAPSHOT_PAGE_ARENA ?
+                        mm_snapshot_page_type_names[page->page_type] : "",
+                    page->system_pages,
+                    page->occupied_blocks, page->free_blocks,
+                    page->occupied_bytes, page->free_bytes,
+                    page->meta_bytes, page->largest_free_block,
+                    page->soft_internal_frag_bytes,
+                    page->hard_internal_frag_bytes,
+                    page->external_frag_index);
+            mm_snapshot_json_histogram(fp, NULL, page->free_block_histogram);
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "]}\n");
+
+    ok = ferror(fp) ? MM_FALSE : MM_TRUE;
+    if(path && fclose(fp))
+        ok = MM_FALSE;
+    else if(!path)
+        fflush(fp);
+    return ok;
+}
+
+/*Binary snapshot : "MMHS", version, the header fields, the family records
+ * then the page records of all the families. Integers are little endian
+ * and as wide as the struct fields, a histogram is a 32 bit mask of the
+ * non zero buckets followed by their counts*/
+#define MM_SNAPSHOT_MAGIC       "MMHS"
+#define MM_SNAPSHOT_VERSION     1
+#define MM_SNAPSHOT_HEADER_SIZE 28
+
+typedef struct mm_snapshot_field_{
+
+    uint32_t offset;
+    uint32_t size;
+} mm_snapshot_field_t;
+
+#define MM_SNAPSHOT_FIELD(type, field)  \
+    {offset_of(type, field), sizeof(((type *)0)->field)}
+
+static const mm_snapshot_field_t mm_family_snapshot_fields[] = {
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, family_id),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, struct_size),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, pages_count),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, pages_retained),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, system_pages),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, cached_blocks),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, occupied_blocks),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, free_blocks),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, occupied_bytes),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, free_bytes),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, meta_bytes),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, largest_free_block),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, soft_internal_frag_bytes),
+    MM_SNAPSHOT_FIELD(mm_family_snapshot_t, hard_internal_frag_bytes),
+};
+
+static const mm_snapshot_field_t mm_page_snapshot_fields[] = {
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, address),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, page_type),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, system_pages),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, occupied_blocks),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, free_blocks),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, occupied_bytes),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, free_bytes),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, meta_bytes),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, largest_free_block),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, soft_internal_frag_bytes),
+    MM_SNAPSHOT_FIELD(mm_page_snapshot_t, hard_internal_frag_bytes),
+};
+
+#define MM_SNAPSHOT_FIELDS_COUNT(fields)    \
+    (sizeof(fields) / sizeof(fields[0]))
+
+static vm_bool_t
+mm_snapshot_put(FILE *fp, uint64_t value, uint32_t size){
+
+    unsigned char bytes[8];
+    uint32_t i;
+
+    for(i = 0; i < size; i++)
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    return fwrite(bytes, 1, size, fp) == size ? MM_TRUE : MM_FALSE;
+}
+
+static vm_bool_t
+mm_snapshot_get(FILE *fp, uint64_t *value, uint32_t size){
+
+    unsigned char bytes[8];
+    uint32_t i;
+
+    if(fread(bytes, 1, size, fp) != size)
+        return MM_FALSE;
+    for(*value = 0, i = 0; i < size; i++)
+        *value |= (uint64_t)bytes[i] << (8 * i);
+    return MM_TRUE;
+}
+
+//integer field of size bytes of a snapshot record
+static inline uint64_t
+mm_snapshot_field_load(const void *record, const mm_snapshot_field_t *field){
+
+    const char *ptr = (const char *)record + field->offset;
+
+    switch(field->size){
+        case 2: return *(const uint16_t *)ptr;
+        case 4: return *(const uint32_t *)ptr;
+        default: return *(const uint64_t *)ptr;
+    }
+}
+
+static inline void
+mm_snapshot_field_store(void *record, const mm_snapshot_field_t *field,
+        uint64_t value){
+
+    char *ptr = (char *)record + field->offset;
+
+    switch(field->size){
+        case 2: *(uint16_t *)ptr = (uint16_t)value; break;
+        case 4: *(uint32_t *)ptr = (uint32_t)value; break;
+        default: *(uint64_t *)ptr = value; break;
+    }
+}
+
+static vm_bool_t
+mm_snapshot_put_record(FILE *fp, const void *record,
+        const mm_snapshot_field_t *fields, uint32_t count){
+
+    uint32_t i;
+
+    for(i = 0; i < count; i++){
+        if(!mm_snapshot_put(fp,
+                    mm_snapshot_field_load(record, &fields[i]), fields[i].size))
+            return MM_FALSE;
+    }
+    return MM_TRUE;
+}
+
+static vm_bool_t
+mm_snapshot_get_record(FILE *fp, void *record,
+        const mm_snapshot_field_t *fields, uint32_t count){
+
+    uint64_t value;
+    uint32_t i;
+
+    for(i = 0; i < count; i++){
+        if(!mm_snapshot_get(fp, &value, fields[i].size))
+            return MM_FALSE;
+        mm_snapshot_field_store(record, &fields[i], value);
+    }
+    return MM_TRUE;
+}
+
+//buckets are 8 bytes wide for families and 2 bytes for pages
+static vm_bool_t
+mm_snapshot_put_histogram(FILE *fp, const void *buckets, uint32_t size){
+
+    mm_snapshot_field_t bucket = {0, size};
+    uint32_t mask = 0, i;
+
+    for(i = 0; i < MM_SNAPSHOT_HISTOGRAM_BUCKETS; i++){
+        bucket.offset = i * size;
+        if(mm_snapshot_field_load(buckets, &bucket))
+            mask |= 1U << i;
+    }
+    if(!mm_snapshot_put(fp, mask, sizeof(mask)))
+        return MM_FALSE;
+    for(i = 0; i < MM_SNAPSHOT_HISTOGRAM_BUCKETS; i++){
+        bucket.offset = i * size;
+        if((mask & (1U << i)) &&
+                !mm_snapshot_put(fp, mm_snapshot_field_load(buckets, &bucket),
+                    size))
+            return MM_FALSE;
+    }
+    return MM_TRUE;
+}
+
+static vm_bool_t
+mm_snapshot_get_histogram(FILE *fp, void *buckets, uint32_t size){
+
+    mm_snapshot_field_t bucket = {0, size};
+    uint64_t mask, value;
+    uint32_t i;
+
+    if(!mm_snapshot_get(fp, &mask, sizeof(uint32_t)))
+        return MM_FALSE;
+    for(i = 0; i < MM_SNAPSHOT_HISTOGRAM_BUCKETS; i++){
+        if(!(mask & (1U << i)))
+            continue;
+        if(!mm_snapshot_get(fp, &value, size))
+            return MM_FALSE;
+        bucket.offset = i * size;
+        mm_snapshot_field_store(buckets, &bucket, value);
+    }
+    return MM_TRUE;
+}
+
+vm_bool_t
+mm_heap_snapshot_write_binary(mm_heap_snapshot_t *snapshot, char *path){
+
+    FILE *fp = fopen(path, "wb");
+    vm_bool_t ok = MM_TRUE;
+    uint32_t i;
+
+    if(!fp){
+        printf("Error : Could not open %s for the heap snapshot\n", path);
+        return MM_FALSE;
+    }
+
+    ok = fwrite(MM_SNAPSHOT_MAGIC, 1, 4, fp) == 4 &&
+        mm_snapshot_put(fp, MM_SNAPSHOT_VERSION, 4) &&
+        mm_snapshot_put(fp, snapshot->taken_at_ms, 8) &&
+        mm_snapshot_put(fp, snapshot->page_size, 4) &&
+        mm_snapshot_put(fp, snapshot->families_count, 4) &&
+        mm_snapshot_put(fp, snapshot->pages_count, 4);
+
+    for(i = 0; ok && i < snapshot->families_count; i++){
+        mm_family_snapshot_t *family = &snapshot->families[i];
+        ok = fwrite(family->struct_name, 1, MM_MAX_STRUCT_NAME, fp) ==
+                MM_MAX_STRUCT_NAME &&
+            mm_snapshot_put_record(fp, family, mm_family_snapshot_fields,
+                    MM_SNAPSHOT_FIELDS_COUNT(mm_family_snapshot_fields)) &&
+            mm_snapshot_put_histogram(fp, family->free_block_histogram,
+                    sizeof(family->free_block_histogram[0]));
+    }
+
+    for(i = 0; ok && i < snapshot->pages_count; i++){
+        mm_page_snapshot_t *page = &snapshot->pages[i];
+        ok = mm_snapshot_put_record(fp, page, mm_page_snapshot_fields,
+                    MM_SNAPSHOT_FIELDS_COUNT(mm_page_snapshot_fields)) &&
+            mm_snapshot_put_histogram(fp, page->free_block_histogram,
+                    sizeof(page->free_block_histogram[0]));
+    }
+
+    if(fclose(fp))
+        ok = MM_FALSE;
+    if(!ok)
+        printf("Error : Could not write the heap snapshot to %s\n", path);
+    return ok;
+}
+
+mm_heap_snapshot_t *
+mm_heap_snapshot_read_binary(char *path){
+
+    FILE *fp = fopen(path, "rb");
+    mm_heap_snapshot_t *snapshot = NULL;
+    char magic[4];
+    uint64_t version, taken_at_ms, page_size, families_count, pages_count;
+    uint64_t first_page = 0;
+    long file_size;
+    vm_bool_t ok;
+    uint32_t i;
+
+    if(!fp){
+        printf("Error : Could not open the heap snapshot %s\n", path);
+        return NULL;
+    }
+
+    ok = fread(magic, 1, 4, fp) == 4 &&
+        !memcmp(magic, MM_SNAPSHOT_MAGIC, 4) &&
+        mm_snapshot_get(fp, &version, 4) &&
+        version == MM_SNAPSHOT_VERSION &&
+        mm_snapshot_get(fp, &taken_at_ms, 8) &&
+        mm_snapshot_get(fp, &page_size, 4) &&
+        mm_snapshot_get(fp, &families_count, 4) &&
+        mm_snapshot_get(fp, &pages_count, 4);
+
+    //every record takes more than a byte, bounds counts of a corrupt file
+    if(ok && !fseek(fp, 0, SEEK_END) && (file_size = ftell(fp)) >= 0 &&
+            families_count <= (uint64_t)file_size &&
+            pages_count <= (uint64_t)file_size &&
+            !fseek(fp, MM_SNAPSHOT_HEADER_SIZE, SEEK_SET))
+        snapshot = mm_heap_snapshot_alloc(families_count, pages_count);
+
+    ok = ok && snapshot;
+    if(ok){
+        snapshot->taken_at_ms = taken_at_ms;
+        snapshot->page_size = (uint32_t)page_size;
+    }
+
+    for(i = 0; ok && i < snapshot->families_count; i++){
+        mm_family_snapshot_t *family = &snapshot->families[i];
+        ok = fread(family->struct_name, 1, MM_MAX_STRUCT_NAME, fp) ==
+                MM_MAX_STRUCT_NAME &&
+            mm_snapshot_get_record(fp, family, mm_family_snapshot_fields,
+                    MM_SNAPSHOT_FIELDS_COUNT(mm_family_snapshot_fields)) &&
+            mm_snapshot_get_histogram(fp, family->free_block_histogram,
+                    sizeof(family->free_block_histogram[0]));
+        if(!ok)
+            break;
+        family->struct_name[MM_MAX_STRUCT_NAME - 1] = '\0';
+        family->external_frag_index = mm_external_frag_index(
+                family->free_bytes, family->largest_free_block);
+        family->pages = snapshot->pages + first_page;
+        first_page += family->pages_count;
+        ok = first_page <= snapshot->pages_count;
+    }
+    ok = ok && first_page == snapshot->pages_count;
+
+    for(i = 0; ok && i < snapshot->pages_count; i++){
+        mm_page_snapshot_t *page = &snapshot->pages[i];
+        ok = mm_snapshot_get_record(fp, page, mm_page_snapshot_fields,
+                    MM_SNAPSHOT_FIELDS_COUNT(mm_page_snapshot_fields)) &&
+            mm_snapshot_get_histogram(fp, page->free_block_histogram,
+                    sizeof(page->free_block_histogram[0]));
+        if(ok){
+            page->external_frag_index = mm_external_frag_index(
+                    page->free_bytes, page->largest_free_block);
+        }
+    }
+    fclose(fp);
+
+    if(!ok){
+        printf("Error : %s is not a valid heap snapshot\n", path);
+        mm_heap_snapshot_free(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
@@ -2,111 +2,483 @@
 #define __MM__
 
 #include "gluethread/glthread.h"
+#include "avltree/avltree.h"
+#include "uapi_mm.h"
 #include <stdint.h> /*uint32_t*/
+#include <pthread.h>
 
-//enumeration for data type true and false
-typedef enum{
+//gives offset of page
+#define offset_of(container_structure, field_name)  \
+    ((size_t)&(((container_structure *)0)->field_name))
+
+/* Compile with -DMM_COMPACT_BLOCK_HEADER for 16 byte meta blocks instead
+ * of 64 byte ones : neighbour meta blocks are linked by 16 bit offsets
+ * from the start of the page, and a free block keeps its free block tree
+ * node in its own data, so no data block is smaller than the node.
+ * Needs system pages of at most 64KB*/
+#ifdef MM_COMPACT_BLOCK_HEADER
+
+typedef struct block_meta_data_{
+
+    uint32_t block_size;
+    uint16_t offset;        /*offset from the start of the page*/
+    uint16_t prev_offset;   /*offsets of the neighbour meta blocks, 0 if none*/
+    uint16_t next_offset;
+    uint8_t is_free;
+    uint8_t is_zero;        /*data block is known to be zero filled, no need to memset*/
+    uint32_t reserved;      /*keeps the meta block 16 bytes*/
+} block_meta_data_t;
+
+//free block tree node of a free block, overlays its data
+#define MM_FREE_TREE_NODE(block_meta_data_ptr)  \
+    ((avltree_node_t *)((block_meta_data_ptr) + 1))
+#define MM_FREE_TREE_NODE_OFFSET    ((int)sizeof(block_meta_data_t))
+#define MM_MIN_DATA_BLOCK_SIZE      ((uint32_t)sizeof(avltree_node_t))
+
+static inline block_meta_data_t *
+avltree_to_block_meta_data(avltree_node_t *avlnode_ptr){
 
-    MM_FALSE,
-    MM_TRUE
-} vm_bool_t;
+    return (block_meta_data_t *)avlnode_ptr - 1;
+}
+
+static inline uint16_t
+mm_meta_block_page_offset(block_meta_data_t *block_meta_data_ptr){
+
+    return block_meta_data_ptr ? (uint16_t)block_meta_data_ptr->offset : 0;
+}
+
+#define MM_META_BLOCK_AT_PAGE_OFFSET(block_meta_data_ptr, page_offset)   \
+    ((page_offset) ? (block_meta_data_t *)                                 \
+        ((char *)(block_meta_data_ptr) - (block_meta_data_ptr)->offset +   \
+         (page_offset)) : NULL)
+#define NEXT_META_BLOCK(block_meta_data_ptr)                \
+    MM_META_BLOCK_AT_PAGE_OFFSET(block_meta_data_ptr,       \
+            (block_meta_data_ptr)->next_offset)
+#define PREV_META_BLOCK(block_meta_data_ptr)                \
+    MM_META_BLOCK_AT_PAGE_OFFSET(block_meta_data_ptr,       \
+            (block_meta_data_ptr)->prev_offset)
+#define SET_NEXT_META_BLOCK(block_meta_data_ptr, next_ptr)  \
+    ((block_meta_data_ptr)->next_offset = mm_meta_block_page_offset(next_ptr))
+#define SET_PREV_META_BLOCK(block_meta_data_ptr, prev_ptr)  \
+    ((block_meta_data_ptr)->prev_offset = mm_meta_block_page_offset(prev_ptr))
+
+#else
 
+/* 64 bytes, 16 more than when free blocks were kept in a priority list :
+ * the tree node needs the lowest addressed node of its subtree, for the
+ * O(log n) first fit, and its height on top of the two links a glthread_t
+ * had. The header stays a multiple of 16 bytes, so the data following it
+ * keeps the alignment of the meta block. Build with MM_COMPACT_BLOCK_HEADER
+ * where the 16 bytes per block matter more than the index*/
 typedef struct block_meta_data_{
 
     vm_bool_t is_free;
     uint32_t block_size;
     uint32_t offset;    /*offset from the start of the page*/
-    glthread_t priority_thread_glue;
+    vm_bool_t is_zero;  /*data block is known to be zero filled, no need to memset*/
+    avltree_node_t free_tree_node;  /*links free block in family free block tree*/
     struct block_meta_data_ *prev_block;
     struct block_meta_data_ *next_block;
 } block_meta_data_t;
-GLTHREAD_TO_STRUCT(glthread_to_block_meta_data,
-    block_meta_data_t, priority_thread_glue, glthread_ptr);
+AVLTREE_TO_STRUCT(avltree_to_block_meta_data,
+    block_meta_data_t, free_tree_node, avlnode_ptr);
 
-//gives offset of page
-#define offset_of(container_structure, field_name)  \
-    ((size_t)&(((container_structure *)0)->field_name))
+#define MM_FREE_TREE_NODE(block_meta_data_ptr)  \
+    (&(block_meta_data_ptr)->free_tree_node)
+#define MM_FREE_TREE_NODE_OFFSET    \
+    ((int)offset_of(block_meta_data_t, free_tree_node))
+#define MM_MIN_DATA_BLOCK_SIZE      1
+
+//gives next meta block address from the meta data
+#define NEXT_META_BLOCK(block_meta_data_ptr)                \
+    ((block_meta_data_ptr)->next_block)
+//gives prev meta block address from the meta data
+#define PREV_META_BLOCK(block_meta_data_ptr)    \
+    ((block_meta_data_ptr)->prev_block)
+#define SET_NEXT_META_BLOCK(block_meta_data_ptr, next_ptr)  \
+    ((block_meta_data_ptr)->next_block = (next_ptr))
+#define SET_PREV_META_BLOCK(block_meta_data_ptr, prev_ptr)  \
+    ((block_meta_data_ptr)->prev_block = (prev_ptr))
+
+#endif /* MM_COMPACT_BLOCK_HEADER */
+
+//data blocks of a page family are aligned to its alignment, at most
+//MM_MAX_ALIGNMENT(a power of 2)
+#define MM_DEFAULT_ALIGNMENT    sizeof(void *)
+#define MM_MAX_ALIGNMENT        64
 
 /*Forward Declaration*/
 //
 struct vm_page_family_;
 
+typedef enum{
+
+    MM_PAGE_BLOCKS, /*variable sized data blocks, each guarded by a meta block*/
+    MM_PAGE_SLAB,   /*equal sized slots with no meta block*/
+    MM_PAGE_SPAN,   /*several contiguous system pages holding one data block*/
+    MM_PAGE_ARENA   /*bump allocated objects of one arena, no meta block*/
+} vm_page_type_t;
+
+//bookkeeping of a slab page, slots are carved from the page starting at
+//slab_slots_offset of the page family
+typedef struct vm_slab_{
+
+    uint32_t used_slots;    /*slots handed out to the application*/
+    uint32_t carved_slots;  /*slots ever handed out, the rest are untouched*/
+    void *free_list;        /*freed slots, linked through their first word*/
+    vm_bool_t is_zero;      /*slots not carved yet are zero filled*/
+} vm_slab_t;
+
+//bookkeeping of an arena page, objects are bumped from the start of the
+//data till the end of the page. Written by the arena owner thread only
+typedef struct vm_arena_page_{
+
+    struct vm_page_ *next_page; /*next page of the same family in the arena*/
+    uint32_t used;              /*offset of the bump pointer in the page*/
+    uint32_t objects;           /*objects allocated from the page*/
+    uint32_t pages;             /*system pages, more for an object bigger than a page*/
+    vm_bool_t is_zero;          /*memory past the bump pointer is zero filled*/
+} vm_arena_page_t;
+
+//page header fields before the meta block
+#define MM_PAGE_HEADER_SIZE     \
+    (3 * sizeof(void *) + sizeof(glthread_t) + 6 * sizeof(uint32_t))
+//pads the page header so the data block of the first meta block starts
+//MM_MAX_ALIGNMENT aligned
+#define MM_PAGE_HEADER_PAD      \
+    ((MM_MAX_ALIGNMENT - (MM_PAGE_HEADER_SIZE + sizeof(block_meta_data_t)) % \
+      MM_MAX_ALIGNMENT) % MM_MAX_ALIGNMENT)
+
 //each page points to the first page(page family), the previous page and next page
 typedef struct vm_page_{
     struct vm_page_ *next;
     struct vm_page_ *prev;
     struct vm_page_family_ *pg_family; //back pointer
-    block_meta_data_t block_meta_data;
+    vm_page_type_t page_type;
+    uint32_t sampled_objects;   //objects of the page tracked by the heap profiler
+    //in an occupancy bin of the family while the page has room for a unit
+    glthread_t occupancy_glue;
+    uint32_t occupancy_bin;
+    /*meta block pages only : data bytes of the free blocks, no free block
+     * is bigger than largest_free, and the free block at fit_offset from
+     * the start of the page(0 if none) is tried first*/
+    uint32_t free_bytes;
+    uint32_t largest_free;
+    uint32_t fit_offset;
+    char page_header_pad[MM_PAGE_HEADER_PAD];
+    union{
+        block_meta_data_t block_meta_data;  /*MM_PAGE_BLOCKS, MM_PAGE_SPAN*/
+        vm_slab_t slab;                     /*MM_PAGE_SLAB*/
+        vm_arena_page_t arena;              /*MM_PAGE_ARENA*/
+    };
     char page_memory[0];
 } vm_page_t;
+GLTHREAD_TO_STRUCT(glthread_to_occupancy_vm_page,
+    vm_page_t, occupancy_glue, glthread_ptr);
+
+#define MM_VM_PAGE_IN_OCCUPANCY_BIN(vm_page_ptr)  \
+    ((vm_page_ptr)->occupancy_glue.left != NULL)
 
+//data block of the first meta block of a page, MM_MAX_ALIGNMENT aligned
+#define MM_FIRST_DATA_BLOCK_OFFSET  \
+    (offset_of(vm_page_t, block_meta_data) + sizeof(block_meta_data_t))
+
+//first object of an arena page, MM_MAX_ALIGNMENT aligned
+#define MM_ARENA_DATA_OFFSET    \
+    ((sizeof(vm_page_t) + MM_MAX_ALIGNMENT - 1) & ~(MM_MAX_ALIGNMENT - 1))
+
+//arena page counters are read by other threads collecting stats
+#define MM_ARENA_PAGE_SET(field, value)    \
+    __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+//pages are mapped page aligned, and every pointer handed to the application
+//lies in the first system page of its vm page
+#define MM_GET_PAGE_FROM_DATA(app_data_ptr, page_size)   \
+    ((vm_page_t *)((uintptr_t)(app_data_ptr) & ~((uintptr_t)(page_size) - 1)))
 //subtract offset to get starting address of hosting memory page
 #define MM_GET_PAGE_FROM_META_BLOCK(block_meta_data_ptr)    \
     ((void * )((char *)block_meta_data_ptr - block_meta_data_ptr->offset))
-//gives next meta block address from the meta data
-#define NEXT_META_BLOCK(block_meta_data_ptr)                \
-    (block_meta_data_ptr->next_block)
 //gives the address of next metablock using size of current meta block
 #define NEXT_META_BLOCK_BY_SIZE(block_meta_data_ptr)        \
     (block_meta_data_t *)((char *)(block_meta_data_ptr + 1) \
         + block_meta_data_ptr->block_size)
-//gives prev meta block address from the meta data
-#define PREV_META_BLOCK(block_meta_data_ptr)    \
-    (block_meta_data_ptr->prev_block)
 //splitting a block and its consequent pointers
 #define mm_bind_blocks_for_allocation(allocated_meta_block, free_meta_block)  \
-    free_meta_block->prev_block = allocated_meta_block;        \
-    free_meta_block->next_block = allocated_meta_block->next_block;    \
-    allocated_meta_block->next_block = free_meta_block;                \
-    if (free_meta_block->next_block)                                   \
-    free_meta_block->next_block->prev_block = free_meta_block
+    SET_PREV_META_BLOCK(free_meta_block, allocated_meta_block);        \
+    SET_NEXT_META_BLOCK(free_meta_block, NEXT_META_BLOCK(allocated_meta_block)); \
+    SET_NEXT_META_BLOCK(allocated_meta_block, free_meta_block);                \
+    if (NEXT_META_BLOCK(free_meta_block))                                   \
+    SET_PREV_META_BLOCK(NEXT_META_BLOCK(free_meta_block), free_meta_block)
 //returns true if page is empty false if page is not empty
 vm_bool_t
 mm_is_vm_page_empty(vm_page_t *vm_page);
 
 #define MM_MAX_STRUCT_NAME 32
+
+//pages of a family are binned by occupancy, allocations go to the fullest
+//page with room so that the emptiest ones drain and get released
+#define MM_OCCUPANCY_BINS   4
+//pages of the bins looked at by an allocation before it settles for the
+//best fit free block of the family
+#define MM_OCCUPANCY_PROBES 8
+//pages released per minute are counted over a sliding window
+#define MM_RELEASE_WINDOW_MS    (60 * 1000)
+//an empty page retained by a page pool instead of being unmapped,
+//overlays the start of the page
+typedef struct mm_pooled_page_{
+
+    glthread_t pool_glue;
+    uint64_t pooled_at_ms;      //for time based decay
+} mm_pooled_page_t;
+GLTHREAD_TO_STRUCT(glthread_to_pooled_page, mm_pooled_page_t, pool_glue, glthreadptr);
+
+//empty pages kept mapped for reuse, most recently pooled first. Once the
+//pool grows beyond high watermark it is trimmed down to low watermark
+typedef struct mm_page_pool_{
+
+    glthread_t pages;
+    uint32_t count;
+    uint32_t high_watermark;
+    uint32_t low_watermark;
+} mm_page_pool_t;
+
+#define MM_FAMILY_POOL_HIGH_WATERMARK   4
+#define MM_FAMILY_POOL_LOW_WATERMARK    2
+#define MM_GLOBAL_POOL_HIGH_WATERMARK   64
+#define MM_GLOBAL_POOL_LOW_WATERMARK    32
+
+//single pages are carved out of regions mapped in one go, a region is
+//aligned to its size so the region of a page is found by masking. The
+//first page of the region holds this header
+#define MM_REGION_SIZE  (2 * 1024 * 1024)
+
+typedef struct mm_region_{
+
+    glthread_t region_glue;     //in the list of regions with free pages
+    uint32_t pages_in_use;
+    uint32_t carved_pages;      //pages handed out at least once, bump index
+    void *free_pages;           //returned pages linked through their first word
+} mm_region_t;
+GLTHREAD_TO_STRUCT(glthread_to_region, mm_region_t, region_glue, glthreadptr);
+
+#define MM_GET_REGION_FROM_PAGE(vm_page_ptr)    \
+    ((mm_region_t *)((uintptr_t)(vm_page_ptr) & ~((uintptr_t)MM_REGION_SIZE - 1)))
+
 //has the struct name and its size, also points to the first page
 typedef struct vm_page_family_{
 
     char struct_name[MM_MAX_STRUCT_NAME];
     uint32_t struct_size;
+    uint32_t alignment;         //of data blocks and slots, power of 2
     vm_page_t *first_page;
-    glthread_t free_block_priority_list_head;
+    avltree_t free_block_tree;  //free blocks of all pages ordered by size
+    /*meta block pages with room for a unit by occupancy, the fullest in
+     * the last bin. Pages in lower bins are left to drain*/
+    glthread_t page_bins[MM_OCCUPANCY_BINS];
+    uint32_t page_bins_mask;    //bit of every bin which may hold pages
+    mm_placement_policy_t placement_policy;
+    block_meta_data_t *next_fit_rover;  //block of the last allocation(next fit)
+    vm_bool_t slab_mode;        //single unit allocations are served from slab pages
+    uint32_t slab_slot_size;
+    uint32_t slab_slots_offset; //offset of the first slot from the start of the page
+    uint32_t slab_slots_per_page;
+    vm_page_t *first_slab_page;
+    glthread_t slab_bins[MM_OCCUPANCY_BINS];  //slab pages with free slots by occupancy
+    uint32_t slab_bins_mask;
+    uint64_t slab_occupancy_scale;  //occupancy bin of used slots in 32.32 fixed point
+    vm_page_t *first_span;      //multi page allocations, one data block each
+    vm_page_t *first_arena_page;    //pages of arenas holding objects of the family
+    struct vm_page_family_ *hash_next; //next family in the same registry hash bucket
+    /*index of the slot the family lives in, indexes thread cache
+     * magazines. Stays the same for the life of the family, a family
+     * registered in the slot of an unregistered one takes it*/
+    uint32_t family_id;
+    /*of the slot, bumped when the family is unregistered. Ids handed out
+     * carry it, so ids of an unregistered family do not name the next
+     * family of the slot*/
+    uint32_t generation;
+    struct vm_page_family_ *next_free_family;   //in the list of unused slots
+    vm_bool_t thread_cache;     //single unit allocations go through thread caches
+    pthread_mutex_t family_lock;    //guards the pages and free blocks of the family
+    /*counts blocks in thread caches as in use, alloc and free counts
+     * exclude the ones served by thread caches*/
+    mm_page_family_stats_t stats;
+    //pages released in the current minute long window and the one before
+    uint64_t release_window_ms;
+    uint32_t released_window;
+    uint32_t released_prev_window;
+    mm_page_pool_t page_pool;   //empty pages of the family, guarded by family lock
+    /*thread affinity : every thread allocates from its own per thread
+     * family, a copy of the registered one, so that blocks of different
+     * threads never share a page*/
+    vm_bool_t thread_affinity;
+    struct vm_page_family_ *parent_family;  //registered family of a per thread family
+    struct vm_page_family_ *thread_families;    //all per thread families spawned
+    struct vm_page_family_ *next_thread_family;
+    //per thread families of exited threads, guarded by family lock
+    struct vm_page_family_ *spare_thread_families;
+    struct vm_page_family_ *next_spare_thread_family;
+    /*deferred coalescing : xfree() of a meta block page only pushes the
+     * data block on a lock free pending list, merging with the neighbours
+     * is done a few blocks at a time by allocations and mm_maintenance()*/
+    vm_bool_t deferred_coalescing;
+    void *pending_frees;        //freed data blocks linked through their first word
+    void *coalesce_queue;       //pending frees taken by a coalescer, guarded by family lock
 } vm_page_family_t;
 
+//pending frees coalesced by every allocation from the family
+#define MM_COALESCE_STEP    16
+
+//data blocks allocated under one family lock by xcalloc_batch()
+#define MM_BATCH_CHUNK  64
+
+//iterates a registered page family and the per thread families spawned from
+//it, registry lock must be held
+#define ITERATE_THREAD_FAMILIES_BEGIN(vm_page_family_ptr, curr)          \
+{                                                                       \
+    for(curr = vm_page_family_ptr; curr;                                \
+        curr = (curr == vm_page_family_ptr) ?                           \
+            vm_page_family_ptr->thread_families : curr->next_thread_family){
+
+#define ITERATE_THREAD_FAMILIES_END(vm_page_family_ptr, curr)   }}
+
+//single unit data blocks of one page family cached by one thread
+#define MM_MAGAZINE_SIZE    64
+//blocks moved between a magazine and its page family under one lock
+#define MM_MAGAZINE_BATCH   32
+
+typedef struct mm_magazine_{
+
+    vm_page_family_t *pg_family;
+    uint32_t count;
+    uint64_t alloc_count;   //allocations served from the magazine
+    uint64_t free_count;    //frees absorbed by the magazine
+    uint64_t bytes_zeroed;  //magazine blocks are always zeroed for xcalloc
+    vm_page_family_t *thread_family;    //of the thread, for thread affinity families
+    void *slots[MM_MAGAZINE_SIZE];
+} mm_magazine_t;
+
+//pages of one page family in an arena
+typedef struct mm_arena_family_{
+
+    vm_page_family_t *pg_family;
+    vm_page_t *first_page;      //single pages, kept by mm_arena_reset()
+    vm_page_t *current_page;    //objects are bumped from this page
+    vm_page_t *first_big_page;  //one object bigger than a page each
+} mm_arena_family_t;
+
+//an arena lives in its own vm page
+struct mm_arena_{
+
+    uint32_t families_count;
+    mm_arena_family_t *last_family; //family of the last allocation
+    mm_arena_family_t families[0];
+};
+
+#define MAX_FAMILIES_PER_ARENA  \
+    ((SYSTEM_PAGE_SIZE - sizeof(mm_arena_t)) / sizeof(mm_arena_family_t))
+
+//per thread cache, lives in its own vm page
+typedef struct mm_thread_cache_{
+
+    glthread_t thread_cache_glue;   //links all thread caches
+    mm_magazine_t **magazines;      //indexed by family id
+    uint32_t magazines_count;
+    uint32_t magazines_pages;
+    void **internal_pages;          //pages magazines are carved from
+    char *carve_ptr;
+    uint32_t carve_left;
+} mm_thread_cache_t;
+GLTHREAD_TO_STRUCT(glthread_to_thread_cache,
+    mm_thread_cache_t, thread_cache_glue, glthread_ptr);
+
 //has all the pages registered in it
 typedef struct vm_page_for_families_{
 
     struct vm_page_for_families_ *next;
+    uint32_t families_count;    //slots handed out, unregistered ones included
     vm_page_family_t vm_page_family[0];
 } vm_page_for_families_t;
 
-//size of page-size of pointer to next page is the size available for struct. so if you divide by page family size you get the max families per page
+//size of page-size of the registry page header is the size available for struct. so if you divide by page family size you get the max families per page
 #define MAX_FAMILIES_PER_VM_PAGE   \
-    ((SYSTEM_PAGE_SIZE - sizeof(vm_page_for_families_t *))/sizeof(vm_page_family_t))
+    ((SYSTEM_PAGE_SIZE - sizeof(vm_page_for_families_t))/sizeof(vm_page_family_t))
 
+//worst fit : biggest free block of the page family
 static inline block_meta_data_t *
 mm_get_biggest_free_block_page_family(
         vm_page_family_t *vm_page_family){
 
-    glthread_t *biggest_free_block_glue =
-        vm_page_family->free_block_priority_list_head.right;
+    avltree_node_t *biggest_free_block_node =
+        avltree_max(&vm_page_family->free_block_tree);
 
-    if(biggest_free_block_glue)
-        return glthread_to_block_meta_data(biggest_free_block_glue);
+    if(biggest_free_block_node)
+        return avltree_to_block_meta_data(biggest_free_block_node);
 
     return NULL;
 }
 
+//best fit : smallest free block of the page family which can hold req_size
+block_meta_data_t *
+mm_get_best_fit_free_block_page_family(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size);
+
+//first fit : lowest addressed free block of the page family which can hold req_size
+block_meta_data_t *
+mm_get_first_fit_free_block_page_family(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size);
+
+//next fit : first free block which can hold req_size walking the pages from
+//the block of the last allocation, wrapping around to the first page
+block_meta_data_t *
+mm_get_next_fit_free_block_page_family(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size);
+
 vm_page_t *
 allocate_vm_page();
 
 //set the firelds of the meta block as null
 #define MARK_VM_PAGE_EMPTY(vm_page_t_ptr)                                 \
-    vm_page_t_ptr->block_meta_data.next_block = NULL;                     \
-vm_page_t_ptr->block_meta_data.prev_block = NULL;                         \
+    SET_NEXT_META_BLOCK(&vm_page_t_ptr->block_meta_data, NULL);           \
+SET_PREV_META_BLOCK(&vm_page_t_ptr->block_meta_data, NULL);               \
 vm_page_t_ptr->block_meta_data.is_free = MM_TRUE
 
+//same as ITERATE_VM_PAGE_BEGIN for the arena pages of the page family
+#define ITERATE_VM_ARENA_PAGE_BEGIN(vm_page_family_ptr, curr)   \
+{                                             \
+    curr = vm_page_family_ptr->first_arena_page;  \
+    vm_page_t *next = NULL;                   \
+    for(; curr; curr = next){                 \
+        next = curr->next;
+
+#define ITERATE_VM_ARENA_PAGE_END(vm_page_family_ptr, curr)   \
+    }}
+
+//same as ITERATE_VM_PAGE_BEGIN for the spans of the page family
+#define ITERATE_VM_SPAN_BEGIN(vm_page_family_ptr, curr)   \
+{                                             \
+    curr = vm_page_family_ptr->first_span;    \
+    vm_page_t *next = NULL;                   \
+    for(; curr; curr = next){                 \
+        next = curr->next;
+
+#define ITERATE_VM_SPAN_END(vm_page_family_ptr, curr)   \
+    }}
+
+//same as ITERATE_VM_PAGE_BEGIN for the slab pages of the page family
+#define ITERATE_VM_SLAB_PAGE_BEGIN(vm_page_family_ptr, curr)   \
+{                                             \
+    curr = vm_page_family_ptr->first_slab_page;   \
+    vm_page_t *next = NULL;                   \
+    for(; curr; curr = next){                 \
+        next = curr->next;
+
+#define ITERATE_VM_SLAB_PAGE_END(vm_page_family_ptr, curr)   \
+    }}
+
 //iterates the vm page from the first page and evantually all the pages containing data block
 #define ITERATE_VM_PAGE_BEGIN(vm_page_family_ptr, curr)   \
 {                                             \
@@ -130,17 +502,62 @@ vm_page_t_ptr->block_meta_data.is_free = MM_TRUE
     }}
 
 //the purpose of this looping macro is to iterate throught all the page families in a particular page
+//and the registry pages linked after it, so from first_vm_page_for_families it covers the registry
 
-//this macro terminates when page family becomes zero or when it reaches the size of the page
+//slots of unregistered families have a struct size of zero and are skipped
 #define ITERATE_PAGE_FAMILIES_BEGIN(vm_page_for_families_ptr, curr)                 \
 {                                                                                   \
-    uint32_t _count = 0;                                                             \
-    for(curr = (vm_page_family_t *)&vm_page_for_families_ptr->vm_page_family[0];    \
-        curr->struct_size && _count < MAX_FAMILIES_PER_VM_PAGE;                      \
-        curr++,_count++){
+    vm_page_for_families_t *_registry_page = vm_page_for_families_ptr;              \
+    uint32_t _count;                                                                \
+    for(; _registry_page; _registry_page = _registry_page->next)                    \
+    for(_count = 0, curr = &_registry_page->vm_page_family[0];                      \
+        _count < _registry_page->families_count;                                    \
+        curr++, _count++)                                                           \
+    if(curr->struct_size){
 
 #define ITERATE_PAGE_FAMILIES_END(vm_page_for_families_ptr, curr)   }}
 
+//frames of the stack trace recorded for a sampled allocation
+#define MM_PROFILE_MAX_FRAMES   32
+//buckets of the profiler stack and object hash tables(must be power of 2)
+#define MM_PROFILE_HASH_BUCKETS 4096
+
+//a distinct stack trace of sampled allocations, kept till the profiler is
+//reset. Counts are of the samples, not scaled up
+typedef struct mm_profile_stack_{
+
+    struct mm_profile_stack_ *next; //in the same hash bucket
+    uint64_t hash;
+    uint64_t live_objects;
+    uint64_t live_bytes;
+    uint64_t alloc_objects;
+    uint64_t alloc_bytes;
+    double live_estimated_bytes;    //live bytes the samples stand for
+    uint32_t depth;
+    void *frames[MM_PROFILE_MAX_FRAMES];   //allocation site first
+} mm_profile_stack_t;
+
+//a sampled object not freed yet
+typedef struct mm_profile_object_{
+
+    struct mm_profile_object_ *next;    //in the same hash bucket
+    void *app_data;
+    uint64_t size;
+    double estimated_bytes;     //bytes of the allocations it stands for
+    mm_profile_stack_t *stack;
+} mm_profile_object_t;
+
+//number of buckets in the page family registry hash table(must be power of 2)
+#define MM_FAMILY_HASH_BUCKETS 1024
+
+//ids of page families are the slot index in the low bits and the slot
+//generation in the high bits, which wraps after 4096 unregistrations
+#define MM_FAMILY_ID_SLOT_BITS  20
+#define MM_FAMILY_ID_MAX_SLOTS  (1u << MM_FAMILY_ID_SLOT_BITS)
+#define MM_FAMILY_ID(vm_page_family_ptr)    \
+    ((vm_page_family_ptr)->family_id |      \
+     ((vm_page_family_ptr)->generation << MM_FAMILY_ID_SLOT_BITS))
+
 vm_page_family_t *
 lookup_page_family_by_name(char *struct_name);
 
@@ -0,0 +1,201 @@
+//C++ interface : STL allocator and owning pointers over page families.
+//Every type T gets a page family of its own, registered on first use and
+//kept in a function local static of family<T>, so allocations go straight
+//to xmalloc_h() without looking the family up by name
+#ifndef __MM_ALLOCATOR__
+#define __MM_ALLOCATOR__
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "uapi_mm.h"
+
+namespace mm {
+
+//specialize to name the page family of T or to configure it differently.
+//Node based containers allocate one node at a time, so by default single
+//units come from slab pages through thread caches
+template<typename T>
+struct family_traits {
+
+    //nullptr for a name made from the type
+    static const char *name() { return nullptr; }
+
+    static void configure(mm_page_family_handle_t pg_family) {
+        mm_page_family_set_slab_mode(pg_family, MM_TRUE);
+        mm_page_family_set_thread_cache(pg_family, MM_TRUE);
+    }
+};
+
+namespace detail {
+
+inline void
+init_once() {
+
+    static const bool initialized = (mm_init(), true);
+    (void)initialized;
+}
+
+//FNV-1a, names page families after the whole signature of family_name<T>
+inline std::uint64_t
+name_hash(const char *string) {
+
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(; *string; string++){
+        hash ^= (unsigned char)*string;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+//"name#hash", name is the start of the [with T = name] part of the
+//signature to read the family in stats, the hash of the full signature
+//keeps the names of types sharing that start apart
+template<typename T>
+void
+family_name(char *buffer, std::size_t size) {
+
+    const char *signature = __PRETTY_FUNCTION__;
+    const char *type = std::strstr(signature, "T = ");
+    std::size_t length = 0;
+
+    type = type ? type + 4 : "type";
+    while(type[length] && type[length] != ';' && type[length] != ']')
+        length++;
+    if(length > 14)
+        length = 14;
+
+    std::snprintf(buffer, size, "%.*s#%016llx", (int)length, type,
+            (unsigned long long)name_hash(signature));
+}
+
+template<typename T>
+mm_page_family_handle_t
+register_family() {
+
+    static_assert(alignof(T) <= 64,
+            "page families align data upto 64 bytes");
+
+    char name[32];
+    mm_page_family_handle_t pg_family = nullptr;
+
+    init_once();
+    if(family_traits<T>::name())
+        std::snprintf(name, sizeof(name), "%s", family_traits<T>::name());
+    else
+        family_name<T>(name, sizeof(name));
+
+    //a named family may have been registered from C already, it has to
+    //fit T though
+    pg_family = mm_get_page_family_handle(name);
+    if(pg_family){
+        if(mm_page_family_get_struct_size(pg_family) != sizeof(T) ||
+                mm_page_family_get_alignment(pg_family) < alignof(T)){
+            std::printf("Error : Page family %s does not fit a type of "
+                    "size %zu and alignment %zu\n",
+                    name, sizeof(T), alignof(T));
+            throw std::bad_alloc();
+        }
+        return pg_family;
+    }
+
+    pg_family = mm_instantiate_new_page_family(name, sizeof(T));
+    if(!pg_family)
+        throw std::bad_alloc();
+    if(alignof(T) > sizeof(void *))
+        mm_page_family_set_alignment(pg_family, alignof(T));
+    family_traits<T>::configure(pg_family);
+    return pg_family;
+}
+
+} // namespace detail
+
+//the page family of T, registered by the first call
+template<typename T>
+struct family {
+
+    static mm_page_family_handle_t handle() {
+        static const mm_page_family_handle_t pg_family =
+            detail::register_family<T>();
+        return pg_family;
+    }
+};
+
+//stateless, containers rebind it to their node types which then get page
+//families of their own
+template<typename T>
+class allocator {
+
+public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+
+    allocator() noexcept = default;
+
+    template<typename U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+
+        if(n > (std::size_t)INT_MAX)
+            throw std::bad_array_new_length();
+
+        void *ptr = xmalloc_h(family<T>::handle(), (int)n);
+        if(!ptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t) noexcept {
+        xfree(ptr);
+    }
+
+    template<typename U>
+    bool operator==(const allocator<U> &) const noexcept { return true; }
+
+    template<typename U>
+    bool operator!=(const allocator<U> &) const noexcept { return false; }
+};
+
+template<typename T>
+struct deleter {
+
+    void operator()(T *ptr) const noexcept {
+        ptr->~T();
+        xfree(ptr);
+    }
+};
+
+//owns an object made by make<T>(). No conversion to a base class pointer,
+//which may not be the address the object was allocated at
+template<typename T>
+using unique_ptr = std::unique_ptr<T, deleter<T>>;
+
+template<typename T, typename... Args>
+unique_ptr<T>
+make(Args &&... args) {
+
+    static_assert(!std::is_array<T>::value,
+            "use a container with mm::allocator for arrays");
+
+    T *ptr = allocator<T>().allocate(1);
+    try{
+        ::new (static_cast<void *>(ptr)) T(std::forward<Args>(args)...);
+    }
+    catch(...){
+        xfree(ptr);
+        throw;
+    }
+    return unique_ptr<T>(ptr);
+}
+
+} // namespace mm
+
+#endif /* __MM_ALLOCATOR__ */
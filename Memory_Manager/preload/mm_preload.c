@@ -0,0 +1,509 @@
+/*
+ * malloc() interposition over page families, for binaries which can not be
+ * changed to call xcalloc() :
+ *
+ *     LD_PRELOAD=libmm_preload.so ./legacy_binary
+ *
+ * Requests upto MM_PRELOAD_MAX_CLASS bytes are rounded up to a size class,
+ * every size class is a page family in slab mode with thread caching, so a
+ * malloc() is a magazine pop. Bigger requests are units of 16 bytes of one
+ * "large" family and so get data blocks or spans and grow in place on
+ * realloc(). Every alignment upto MM_PRELOAD_MAX_ALIGNMENT has a set of families of
+ * its own.
+ *
+ * Data blocks of page families never start on a page boundary, the page
+ * starts with its header. So a page aligned pointer is one which was mapped
+ * directly, for alignments above MM_PRELOAD_MAX_ALIGNMENT and sizes above
+ * MM_PRELOAD_MAX_SIZE, with a header just below it.
+ *
+ * Allocations made while the families are being set up, or from within the
+ * manager itself (nested malloc() of libc calls it makes), come from a
+ * static bootstrap buffer and are never reused.
+ *
+ * The library is built with hidden visibility and exports only the libc
+ * allocation functions, so the manager never binds to xfree() and the
+ * like of the binary (readline has them) nor shadows them.
+ *
+ * MM_PRELOAD_STATS=1 in the environment prints the stats of every size
+ * class to stderr at exit.
+ *
+ * MM_PRELOAD_PROFILE=path runs the sampling heap profiler and writes the
+ * profile of what is still allocated to path at exit, sampling about every
+ * MM_PRELOAD_PROFILE_SAMPLE bytes (512KB), as a pprof heap profile or, with
+ * MM_PRELOAD_PROFILE_FORMAT=folded, as folded stacks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "uapi_mm.h"
+
+#define MM_PRELOAD_MIN_ALIGNMENT    16      /*alignof(max_align_t)*/
+#define MM_PRELOAD_MAX_ALIGNMENT    64      /*mm_page_family_set_alignment()*/
+#define MM_PRELOAD_MAX_CLASS        1024
+#define MM_PRELOAD_CLASSES          20
+#define MM_PRELOAD_ALIGNMENTS       3       /*16, 32 and 64*/
+#define MM_PRELOAD_LARGE_UNIT       16
+#define MM_PRELOAD_MAX_SIZE         (1UL << 30)
+#define MM_PRELOAD_BOOTSTRAP_SIZE   (256 * 1024)
+
+#define MM_PRELOAD_EXPORT   __attribute__((visibility("default")))
+
+_Static_assert(MM_PRELOAD_MAX_ALIGNMENT ==
+        MM_PRELOAD_MIN_ALIGNMENT << (MM_PRELOAD_ALIGNMENTS - 1),
+        "a set of families per power of 2 alignment");
+
+/*16 byte steps upto 128, then 4 classes per doubling*/
+static const uint32_t class_sizes[MM_PRELOAD_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024
+};
+
+/*size class of every 16 byte step upto MM_PRELOAD_MAX_CLASS*/
+static uint8_t class_of_step[MM_PRELOAD_MAX_CLASS / 16 + 1];
+
+static mm_page_family_handle_t
+    class_families[MM_PRELOAD_ALIGNMENTS][MM_PRELOAD_CLASSES];
+static mm_page_family_handle_t large_families[MM_PRELOAD_ALIGNMENTS];
+
+static size_t page_size;
+
+typedef enum{
+
+    MM_PRELOAD_UNINITIALIZED,
+    MM_PRELOAD_INITIALIZING,
+    MM_PRELOAD_READY
+} mm_preload_state_t;
+
+static int preload_state = MM_PRELOAD_UNINITIALIZED;
+
+/*set while the calling thread is inside the manager, a malloc() nested
+ * in it is served from the bootstrap buffer*/
+static __thread int in_mm __attribute__((tls_model("initial-exec")));
+
+/*Bootstrap buffer, every allocation is preceded by its size*/
+
+static char bootstrap_buffer[MM_PRELOAD_BOOTSTRAP_SIZE]
+    __attribute__((aligned(MM_PRELOAD_MAX_ALIGNMENT)));
+static size_t bootstrap_used;
+
+static inline int
+is_bootstrap(void *ptr){
+
+    return (char *)ptr >= bootstrap_buffer &&
+        (char *)ptr < bootstrap_buffer + MM_PRELOAD_BOOTSTRAP_SIZE;
+}
+
+static void *
+bootstrap_allocate(size_t size, size_t alignment){
+
+    size_t used, offset;
+
+    if(alignment < MM_PRELOAD_MIN_ALIGNMENT)
+        alignment = MM_PRELOAD_MIN_ALIGNMENT;
+
+    used = __atomic_load_n(&bootstrap_used, __ATOMIC_RELAXED);
+    do{
+        offset = (used + MM_PRELOAD_MIN_ALIGNMENT + alignment - 1) &
+            ~(alignment - 1);
+        if(offset + size > MM_PRELOAD_BOOTSTRAP_SIZE)
+            return NULL;
+    } while(!__atomic_compare_exchange_n(&bootstrap_used, &used,
+                offset + size, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    /*the buffer is zero and never reused, no need to clear it*/
+    *(size_t *)(bootstrap_buffer + offset - sizeof(size_t)) = size;
+    return bootstrap_buffer + offset;
+}
+
+static inline size_t
+bootstrap_size(void *ptr){
+
+    return *(size_t *)((char *)ptr - sizeof(size_t));
+}
+
+/*Direct mappings*/
+
+typedef struct mm_preload_direct_{
+
+    void *base;
+    size_t length;
+} mm_preload_direct_t;
+
+static inline int
+is_direct(void *ptr){
+
+    return ((uintptr_t)ptr & (page_size - 1)) == 0;
+}
+
+static void *
+direct_allocate(size_t size, size_t alignment){
+
+    size_t length;
+    char *base;
+    uintptr_t ptr;
+
+    if(alignment < page_size)
+        alignment = page_size;
+    if(size > SIZE_MAX - 2 * page_size - alignment)
+        return NULL;
+
+    /*a page for the header below the data, and slack to align it*/
+    length = page_size + ((size + page_size - 1) & ~(page_size - 1)) +
+        (alignment - page_size);
+    base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED)
+        return NULL;
+
+    ptr = ((uintptr_t)base + page_size + alignment - 1) & ~(alignment - 1);
+    ((mm_preload_direct_t *)ptr - 1)->base = base;
+    ((mm_preload_direct_t *)ptr - 1)->length = length;
+    return (void *)ptr;
+}
+
+static inline size_t
+direct_usable_size(void *ptr){
+
+    mm_preload_direct_t *direct = (mm_preload_direct_t *)ptr - 1;
+    return direct->length - ((char *)ptr - (char *)direct->base);
+}
+
+static void
+direct_free(void *ptr){
+
+    mm_preload_direct_t *direct = (mm_preload_direct_t *)ptr - 1;
+    munmap(direct->base, direct->length);
+}
+
+/*Setup*/
+
+static const char *profile_path;
+static mm_profile_format_t profile_format = MM_PROFILE_PPROF;
+
+static void
+mm_preload_dump_profile(){
+
+    mm_profiler_dump((char *)profile_path, profile_format);
+}
+
+static void
+mm_preload_print_stats(){
+
+    mm_page_family_stats_t stats;
+    char line[160], class_name[8];
+    int a, i, len;
+
+    for(a = 0; a < MM_PRELOAD_ALIGNMENTS; a++){
+        for(i = 0; i <= MM_PRELOAD_CLASSES; i++){
+
+            mm_get_page_family_stats(i < MM_PRELOAD_CLASSES ?
+                    class_families[a][i] : large_families[a], &stats);
+            if(!stats.alloc_count)
+                continue;
+
+            if(i < MM_PRELOAD_CLASSES)
+                snprintf(class_name, sizeof(class_name), "%u", class_sizes[i]);
+            else
+                strcpy(class_name, "large");
+
+            /*stdio may malloc() from a destructor, stay with write()*/
+            len = snprintf(line, sizeof(line),
+                    "mm_preload : align %-3d %-6s allocs %-10lu frees %-10lu "
+                    "pages held %-6lu released/min %-6lu peak bytes %lu\n",
+                    MM_PRELOAD_MIN_ALIGNMENT << a, class_name,
+                    (unsigned long)stats.alloc_count,
+                    (unsigned long)stats.free_count,
+                    (unsigned long)stats.pages_held,
+                    (unsigned long)stats.pages_released_per_minute,
+                    (unsigned long)stats.peak_bytes_in_use);
+            if(write(STDERR_FILENO, line, len) < 0)
+                return;
+        }
+    }
+}
+
+static void
+mm_preload_setup(){
+
+    char name[32];
+    int a, i, step;
+    uint32_t alignment;
+    const char *print_stats, *profile_sample, *format;
+    uint64_t sample_bytes = MM_PROFILE_DEFAULT_SAMPLE_BYTES;
+
+    page_size = getpagesize();
+    mm_init();
+
+    for(i = 0, step = 0; step <= MM_PRELOAD_MAX_CLASS / 16; step++){
+        while(class_sizes[i] < (uint32_t)step * 16)
+            i++;
+        class_of_step[step] = i;
+    }
+
+    for(a = 0; a < MM_PRELOAD_ALIGNMENTS; a++){
+
+        alignment = MM_PRELOAD_MIN_ALIGNMENT << a;
+
+        for(i = 0; i < MM_PRELOAD_CLASSES; i++){
+            snprintf(name, sizeof(name), "malloc_%u_a%u",
+                    class_sizes[i], alignment);
+            class_families[a][i] = mm_instantiate_new_page_family(name,
+                    class_sizes[i]);
+            mm_page_family_set_alignment(class_families[a][i], alignment);
+            mm_page_family_set_slab_mode(class_families[a][i], MM_TRUE);
+            mm_page_family_set_thread_cache(class_families[a][i], MM_TRUE);
+        }
+
+        snprintf(name, sizeof(name), "malloc_large_a%u", alignment);
+        large_families[a] = mm_instantiate_new_page_family(name,
+                MM_PRELOAD_LARGE_UNIT);
+        mm_page_family_set_alignment(large_families[a], alignment);
+    }
+
+    print_stats = getenv("MM_PRELOAD_STATS");
+    if(print_stats && *print_stats && *print_stats != '0')
+        atexit(mm_preload_print_stats);
+
+    profile_path = getenv("MM_PRELOAD_PROFILE");
+    if(profile_path && *profile_path){
+        profile_sample = getenv("MM_PRELOAD_PROFILE_SAMPLE");
+        if(profile_sample && *profile_sample)
+            sample_bytes = strtoull(profile_sample, NULL, 10);
+        format = getenv("MM_PRELOAD_PROFILE_FORMAT");
+        if(format && !strcmp(format, "folded"))
+            profile_format = MM_PROFILE_FOLDED;
+        if(mm_profiler_start(sample_bytes))
+            atexit(mm_preload_dump_profile);
+    }
+}
+
+/*returns 0 while the families are not usable by the calling thread*/
+static inline int
+mm_preload_ready(){
+
+    int state = __atomic_load_n(&preload_state, __ATOMIC_ACQUIRE);
+
+    if(state == MM_PRELOAD_READY)
+        return 1;
+
+    state = MM_PRELOAD_UNINITIALIZED;
+    if(__atomic_compare_exchange_n(&preload_state, &state,
+                MM_PRELOAD_INITIALIZING, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)){
+        in_mm = 1;
+        mm_preload_setup();
+        in_mm = 0;
+        __atomic_store_n(&preload_state, MM_PRELOAD_READY, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    /*nested in the setup*/
+    if(in_mm)
+        return 0;
+
+    while(__atomic_load_n(&preload_state, __ATOMIC_ACQUIRE) != MM_PRELOAD_READY)
+        sched_yield();
+    return 1;
+}
+
+/*Allocation*/
+
+static inline int
+alignment_index(size_t alignment){
+
+    if(alignment <= MM_PRELOAD_MIN_ALIGNMENT)
+        return 0;
+    return alignment <= 2 * MM_PRELOAD_MIN_ALIGNMENT ? 1 : 2;
+}
+
+static void *
+mm_preload_allocate(size_t size, size_t alignment, int zero){
+
+    void *ptr;
+    int a;
+
+    if(!mm_preload_ready() || in_mm){
+        ptr = bootstrap_allocate(size, alignment);
+        if(!ptr)
+            errno = ENOMEM;
+        return ptr;
+    }
+
+    if(alignment > MM_PRELOAD_MAX_ALIGNMENT || size > MM_PRELOAD_MAX_SIZE){
+        /*fresh anonymous memory is zero*/
+        ptr = direct_allocate(size, alignment);
+        if(!ptr)
+            errno = ENOMEM;
+        return ptr;
+    }
+
+    a = alignment_index(alignment);
+
+    in_mm = 1;
+    if(size <= MM_PRELOAD_MAX_CLASS){
+        mm_page_family_handle_t pg_family =
+            class_families[a][class_of_step[(size + 15) / 16]];
+        ptr = zero ? xcalloc_h(pg_family, 1) : xmalloc_h(pg_family, 1);
+    }
+    else{
+        int units = (size + MM_PRELOAD_LARGE_UNIT - 1) / MM_PRELOAD_LARGE_UNIT;
+        ptr = zero ? xcalloc_h(large_families[a], units) :
+            xmalloc_h(large_families[a], units);
+    }
+    in_mm = 0;
+
+    if(!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+static size_t
+mm_preload_usable_size(void *ptr){
+
+    if(is_bootstrap(ptr))
+        return bootstrap_size(ptr);
+    if(is_direct(ptr))
+        return direct_usable_size(ptr);
+    return mm_usable_size(ptr);
+}
+
+MM_PRELOAD_EXPORT void *
+malloc(size_t size){
+
+    return mm_preload_allocate(size, MM_PRELOAD_MIN_ALIGNMENT, 0);
+}
+
+MM_PRELOAD_EXPORT void *
+calloc(size_t count, size_t size){
+
+    size_t total;
+
+    if(__builtin_mul_overflow(count, size, &total)){
+        errno = ENOMEM;
+        return NULL;
+    }
+    return mm_preload_allocate(total, MM_PRELOAD_MIN_ALIGNMENT, 1);
+}
+
+MM_PRELOAD_EXPORT void
+free(void *ptr){
+
+    if(!ptr || is_bootstrap(ptr))
+        return;
+
+    if(is_direct(ptr)){
+        direct_free(ptr);
+        return;
+    }
+
+    in_mm = 1;
+    xfree(ptr);
+    in_mm = 0;
+}
+
+MM_PRELOAD_EXPORT void *
+realloc(void *ptr, size_t size){
+
+    size_t usable;
+    void *new_ptr;
+
+    if(!ptr)
+        return malloc(size);
+
+    if(!size){
+        free(ptr);
+        return NULL;
+    }
+
+    usable = mm_preload_usable_size(ptr);
+
+    //keeps the block unless more than half of it would be wasted
+    if(size <= usable &&
+            (size > usable / 2 || usable <= MM_PRELOAD_MIN_ALIGNMENT))
+        return ptr;
+
+    //data blocks of the large families can shrink and grow in place
+    if(!is_bootstrap(ptr) && !is_direct(ptr) &&
+            usable > MM_PRELOAD_MAX_CLASS &&
+            size > MM_PRELOAD_MAX_CLASS && size <= MM_PRELOAD_MAX_SIZE){
+
+        in_mm = 1;
+        new_ptr = xrealloc(ptr, (size + MM_PRELOAD_LARGE_UNIT - 1) /
+                MM_PRELOAD_LARGE_UNIT);
+        in_mm = 0;
+        if(!new_ptr)
+            errno = ENOMEM;
+        return new_ptr;
+    }
+
+    new_ptr = malloc(size);
+    if(!new_ptr)
+        return NULL;
+    memcpy(new_ptr, ptr, size < usable ? size : usable);
+    free(ptr);
+    return new_ptr;
+}
+
+MM_PRELOAD_EXPORT int
+posix_memalign(void **out, size_t alignment, size_t size){
+
+    void *ptr;
+
+    if(alignment < sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+
+    ptr = mm_preload_allocate(size, alignment, 0);
+    if(!ptr)
+        return ENOMEM;
+    *out = ptr;
+    return 0;
+}
+
+MM_PRELOAD_EXPORT void *
+aligned_alloc(size_t alignment, size_t size){
+
+    if(!alignment || (alignment & (alignment - 1))){
+        errno = EINVAL;
+        return NULL;
+    }
+    return mm_preload_allocate(size, alignment, 0);
+}
+
+MM_PRELOAD_EXPORT void *
+memalign(size_t alignment, size_t size){
+
+    return aligned_alloc(alignment, size);
+}
+
+MM_PRELOAD_EXPORT void *
+valloc(size_t size){
+
+    if(!page_size)
+        page_size = getpagesize();
+    return mm_preload_allocate(size, page_size, 0);
+}
+
+MM_PRELOAD_EXPORT void *
+pvalloc(size_t size){
+
+    if(!page_size)
+        page_size = getpagesize();
+    size = (size + page_size - 1) & ~(page_size - 1);
+    return mm_preload_allocate(size, page_size, 0);
+}
+
+MM_PRELOAD_EXPORT size_t
+malloc_usable_size(void *ptr){
+
+    if(!ptr)
+        return 0;
+    return mm_preload_usable_size(ptr);
+}
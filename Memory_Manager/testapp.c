@@ -58,5 +58,11 @@ main(int argc, char **argv){
     mm_print_memory_usage(0);
     mm_print_block_usage();
     mm_check_for_leaks();
+
+    mm_heap_snapshot_t *snapshot = mm_heap_snapshot_take();
+    if(snapshot){
+        mm_heap_snapshot_write_json(snapshot, NULL);
+        mm_heap_snapshot_free(snapshot);
+    }
     return 0; 
 }
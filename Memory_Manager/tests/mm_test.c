@@ -0,0 +1,719 @@
+/*
+ * Unit tests of the memory manager, every test_*() asserts on what the
+ * public interface promises and, for the occupancy bins, on the page
+ * bookkeeping of mm.h. Run by ctest, exits non zero on the first failure.
+ */
+
+/*the asserts are the tests, keep them in release builds*/
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "uapi_mm.h"
+#include "mm.h"
+
+typedef struct unit_{
+
+    uint64_t words[2];
+} unit_t;
+
+static char tmp_dir[] = "/tmp/mm_test.XXXXXX";
+
+static char *
+tmp_path(char *buffer, size_t size, const char *name){
+
+    snprintf(buffer, size, "%s/%s", tmp_dir, name);
+    return buffer;
+}
+
+static char *
+read_file(const char *path){
+
+    FILE *fp = fopen(path, "r");
+    char *content;
+    long size;
+
+    assert(fp);
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    content = calloc(1, size + 1);
+    assert(content);
+    assert(fread(content, 1, size, fp) == (size_t)size);
+    fclose(fp);
+    return content;
+}
+
+static void
+remove_tmp_dir(){
+
+    static const char *files[] = {"snapshot.bin", "snapshot.json",
+        "heap.pprof", "heap.folded", "empty.folded"};
+    char path[256];
+    size_t i;
+
+    for(i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        unlink(tmp_path(path, sizeof(path), files[i]));
+    rmdir(tmp_dir);
+}
+
+static uintptr_t
+page_of(void *ptr){
+
+    return (uintptr_t)ptr & ~((uintptr_t)getpagesize() - 1);
+}
+
+static void
+test_xrealloc(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_realloc", sizeof(unit_t));
+    unit_t *ptr, *next, *moved;
+    int i;
+
+    assert(pg_family);
+    ptr = xcalloc_h(pg_family, 8);
+    next = xcalloc_h(pg_family, 1);
+    for(i = 0; i < 8; i++)
+        ptr[i].words[0] = i;
+
+    /*shrinks in place, the tail becomes a free block before next*/
+    assert(xrealloc(ptr, 2) == ptr);
+    assert(mm_usable_size(ptr) >= 2 * sizeof(unit_t));
+    assert(ptr[1].words[0] == 1);
+
+    /*grows back into the free block it left*/
+    assert(xrealloc(ptr, 8) == ptr);
+    assert(ptr[0].words[0] == 0 && ptr[1].words[0] == 1);
+
+    /*grows into a freed neighbour*/
+    xfree(next);
+    assert(xrealloc(ptr, 12) == ptr);
+    assert(mm_usable_size(ptr) >= 12 * sizeof(unit_t));
+
+    /*no room after it, moves and keeps the data*/
+    next = xcalloc_h(pg_family, 1);
+    moved = xrealloc(ptr, 100);
+    assert(moved && mm_usable_size(moved) >= 100 * sizeof(unit_t));
+    assert(moved[0].words[0] == 0 && moved[1].words[0] == 1);
+
+    /*invalid sizes leave the block as is*/
+    assert(xrealloc(moved, 0) == NULL);
+    assert(moved[1].words[0] == 1);
+
+    xfree(moved);
+    xfree(next);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_arena(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_arena", sizeof(unit_t));
+    mm_arena_t *arena = mm_arena_create();
+    unit_t *first, *ptr = NULL;
+    int i;
+
+    assert(pg_family && arena);
+    first = xcalloc_in_h(arena, pg_family, 1);
+    assert(first);
+    for(i = 0; i < 10000; i++){
+        ptr = xcalloc_in_h(arena, pg_family, 3);
+        assert(ptr);
+        assert(ptr[0].words[0] == 0 && ptr[2].words[1] == 0);
+        ptr[0].words[0] = ptr[2].words[1] = UINT64_MAX;
+    }
+    /*objects of an arena have no meta block*/
+    assert(mm_usable_size(ptr) == 0);
+
+    /*pages are kept and handed out again from the start, zeroed*/
+    mm_arena_reset(arena);
+    ptr = xcalloc_in_h(arena, pg_family, 1);
+    assert(ptr == first);
+    for(i = 0; i < 10000; i++){
+        ptr = xcalloc_in_h(arena, pg_family, 3);
+        assert(ptr[0].words[0] == 0 && ptr[2].words[1] == 0);
+    }
+
+    /*a family with objects in an arena stays registered*/
+    assert(mm_unregister_page_family(pg_family) == MM_FALSE);
+    mm_arena_destroy(arena);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_batch(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_batch", sizeof(unit_t));
+    mm_page_family_stats_t stats;
+    void *ptrs[1000];
+    int i, j;
+
+    assert(pg_family);
+    assert(xcalloc_batch(pg_family, 1000, ptrs) == 1000);
+    mm_get_page_family_stats(pg_family, &stats);
+    assert(stats.blocks_in_use == 1000);
+    for(i = 0; i < 1000; i++){
+        unit_t *unit = ptrs[i];
+        assert(unit->words[0] == 0 && unit->words[1] == 0);
+        unit->words[0] = i;
+    }
+    for(i = 0; i < 1000; i++){
+        for(j = i + 1; j < 1000; j++)
+            assert(ptrs[i] != ptrs[j]);
+    }
+
+    xfree_batch(ptrs, 1000);
+    mm_get_page_family_stats(pg_family, &stats);
+    assert(stats.blocks_in_use == 0 && stats.bytes_in_use == 0);
+
+    /*the freed blocks coalesced, a block of them all fits*/
+    assert(xcalloc_batch(pg_family, 10, ptrs) == 10);
+    xfree_batch(ptrs, 10);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_unregister(){
+
+    mm_page_family_handle_t first, second, reused;
+    uint32_t first_id, second_id;
+    char name[MM_MAX_STRUCT_NAME];
+    int i;
+
+    first = mm_instantiate_new_page_family("test_unreg_first", sizeof(unit_t));
+    second = mm_instantiate_new_page_family("test_unreg_second", 64);
+    assert(first && second);
+    /*a name registers one family only*/
+    assert(mm_instantiate_new_page_family("test_unreg_first", 64) == NULL);
+    assert(mm_get_page_family_handle("test_unreg_first") == first);
+    assert(mm_page_family_get_struct_size(first) == sizeof(unit_t));
+    first_id = mm_page_family_get_id(first);
+    second_id = mm_page_family_get_id(second);
+    assert(mm_get_page_family_by_id(first_id) == first);
+    assert(xcalloc_h(first, 4));
+
+    /*blocks still allocated are released with the family*/
+    assert(mm_unregister_page_family(first) == MM_TRUE);
+    assert(mm_get_page_family_handle("test_unreg_first") == NULL);
+    assert(mm_get_page_family_by_id(first_id) == NULL);
+    assert(mm_get_page_family_handle("test_unreg_second") == second);
+    assert(mm_get_page_family_by_id(second_id) == second);
+
+    /*slots are reused, ids of unregistered families stay dead*/
+    for(i = 0; i < 100; i++){
+        snprintf(name, sizeof(name), "test_unreg_%d", i);
+        reused = mm_instantiate_new_page_family(name, sizeof(unit_t));
+        assert(reused);
+        assert(mm_page_family_get_id(reused) != first_id);
+        assert(mm_get_page_family_by_id(first_id) == NULL);
+        assert(mm_get_page_family_handle(name) == reused);
+        assert(mm_get_page_family_by_id(mm_page_family_get_id(reused)) ==
+                reused);
+        assert(mm_get_page_family_handle("test_unreg_second") == second);
+        assert(mm_unregister_page_family(reused) == MM_TRUE);
+        assert(mm_get_page_family_handle(name) == NULL);
+    }
+
+    /*registered again under its old name, a new family with a new id*/
+    first = mm_instantiate_new_page_family("test_unreg_first", sizeof(unit_t));
+    assert(first && mm_page_family_get_id(first) != first_id);
+    assert(mm_get_page_family_by_id(first_id) == NULL);
+    assert(mm_unregister_page_family(first) == MM_TRUE);
+    assert(mm_unregister_page_family(second) == MM_TRUE);
+}
+
+static void
+test_thread_cache_switch(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_thread_cache", sizeof(unit_t));
+    void *ptr;
+
+    assert(pg_family);
+    assert(mm_page_family_set_thread_cache(pg_family, MM_TRUE) == pg_family);
+    assert(mm_page_family_set_thread_cache(pg_family, MM_FALSE) == pg_family);
+
+    /*blocks may already sit in magazines once allocated from*/
+    ptr = xcalloc_h(pg_family, 1);
+    assert(ptr);
+    assert(mm_page_family_set_thread_cache(pg_family, MM_TRUE) == NULL);
+    xfree(ptr);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_deferred_coalescing(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_deferred", sizeof(unit_t));
+    mm_page_family_stats_t stats;
+    mm_heap_snapshot_t *snapshot;
+    void *sentinel, *ptrs[40];
+    uint32_t i;
+
+    assert(pg_family);
+    assert(mm_page_family_set_deferred_coalescing(pg_family, MM_TRUE) ==
+            pg_family);
+
+    /*one page, the sentinel keeps it from being released*/
+    sentinel = xcalloc_h(pg_family, 1);
+    for(i = 0; i < 40; i++)
+        ptrs[i] = xcalloc_h(pg_family, 1);
+    for(i = 1; i < 40; i++)
+        assert(page_of(ptrs[i]) == page_of(sentinel));
+
+    /*only queued, maintenance coalesces them upto its budget*/
+    for(i = 0; i < 40; i++)
+        xfree(ptrs[i]);
+    assert(mm_maintenance(10) == 10);
+    assert(mm_maintenance(25) == 25);
+    assert(mm_maintenance(UINT32_MAX) == 5);
+    assert(mm_maintenance(UINT32_MAX) == 0);
+
+    mm_get_page_family_stats(pg_family, &stats);
+    assert(stats.blocks_in_use == 1);
+    assert(stats.bytes_in_use == sizeof(unit_t));
+    assert(stats.alloc_count == 41 && stats.free_count == 40);
+
+    /*the freed blocks and the tail of the page are one free block*/
+    snapshot = mm_heap_snapshot_take();
+    assert(snapshot);
+    for(i = 0; i < snapshot->families_count; i++){
+        mm_family_snapshot_t *family = &snapshot->families[i];
+
+        if(strcmp(family->struct_name, "test_deferred"))
+            continue;
+        assert(family->pages_count == 1);
+        assert(family->occupied_blocks == 1 && family->free_blocks == 1);
+    }
+    mm_heap_snapshot_free(snapshot);
+
+    /*frees still pending are coalesced by the allocation needing them*/
+    for(i = 0; i < 40; i++)
+        ptrs[i] = xcalloc_h(pg_family, 1);
+    for(i = 0; i < 40; i++)
+        xfree(ptrs[i]);
+    ptrs[0] = xcalloc_h(pg_family, 40);
+    assert(ptrs[0] && page_of(ptrs[0]) == page_of(sentinel));
+    xfree(ptrs[0]);
+    xfree(sentinel);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_span_realloc(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_span", 1000);
+    unsigned char *ptr, *grown;
+    uint32_t i;
+
+    assert(pg_family);
+    /*bigger than a page, a span of its own*/
+    ptr = xcalloc_h(pg_family, 10);
+    assert(ptr && mm_usable_size(ptr) >= 10000);
+    for(i = 0; i < 10000; i++){
+        assert(ptr[i] == 0);
+        ptr[i] = (unsigned char)i;
+    }
+
+    grown = xrealloc(ptr, 40);
+    assert(grown && mm_usable_size(grown) >= 40000);
+    for(i = 0; i < 10000; i++)
+        assert(grown[i] == (unsigned char)i);
+    memset(grown + 10000, 0xff, 30000);
+
+    /*shrinks in place while it stays a span*/
+    assert(xrealloc(grown, 20) == grown);
+    for(i = 0; i < 10000; i++)
+        assert(grown[i] == (unsigned char)i);
+
+    /*moves to a data block once it fits a page*/
+    ptr = xrealloc(grown, 2);
+    assert(ptr && ptr != grown);
+    for(i = 0; i < 2000; i++)
+        assert(ptr[i] == (unsigned char)i);
+    xfree(ptr);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_placement_policies(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_placement", sizeof(unit_t));
+    void *holes[3], *kept[4], *ptr;
+    int i;
+
+    assert(pg_family);
+    assert(mm_page_family_set_placement_policy(pg_family, MM_BEST_FIT) ==
+            pg_family);
+    assert(mm_page_family_get_placement_policy(pg_family) == MM_BEST_FIT);
+
+    /*free blocks of 4, 2 and 3 units in address order, apart*/
+    kept[0] = xcalloc_h(pg_family, 1);
+    holes[0] = xcalloc_h(pg_family, 4);
+    kept[1] = xcalloc_h(pg_family, 1);
+    holes[1] = xcalloc_h(pg_family, 2);
+    kept[2] = xcalloc_h(pg_family, 1);
+    holes[2] = xcalloc_h(pg_family, 3);
+    kept[3] = xcalloc_h(pg_family, 1);
+    for(i = 0; i < 3; i++){
+        assert(page_of(holes[i]) == page_of(kept[0]));
+        xfree(holes[i]);
+    }
+
+    /*smallest which fits*/
+    ptr = xcalloc_h(pg_family, 2);
+    assert(ptr == holes[1]);
+    xfree(ptr);
+    ptr = xcalloc_h(pg_family, 3);
+    assert(ptr == holes[2]);
+    xfree(ptr);
+
+    /*lowest addressed which fits*/
+    mm_page_family_set_placement_policy(pg_family, MM_FIRST_FIT);
+    ptr = xcalloc_h(pg_family, 2);
+    assert(ptr == holes[0]);
+    xfree(ptr);
+    ptr = xcalloc_h(pg_family, 4);
+    assert(ptr == holes[0]);
+    xfree(ptr);
+
+    /*biggest, the tail of the page*/
+    mm_page_family_set_placement_policy(pg_family, MM_WORST_FIT);
+    ptr = xcalloc_h(pg_family, 2);
+    assert(ptr > kept[3] && page_of(ptr) == page_of(kept[3]));
+    xfree(ptr);
+
+    for(i = 0; i < 4; i++)
+        xfree(kept[i]);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_page_pool(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_pool", 2000);
+    mm_page_family_stats_t stats;
+    void *ptrs[16];
+    int i;
+
+    assert(pg_family);
+    assert(mm_page_family_set_page_pool(pg_family, 4, 2) == pg_family);
+
+    /*a page each*/
+    for(i = 0; i < 16; i++){
+        ptrs[i] = xcalloc_h(pg_family, 1);
+        assert(ptrs[i] && (i == 0 || page_of(ptrs[i]) != page_of(ptrs[i - 1])));
+    }
+    for(i = 0; i < 16; i++)
+        xfree(ptrs[i]);
+    mm_get_page_family_stats(pg_family, &stats);
+    assert(stats.pages_held == 0);
+    assert(stats.pages_retained >= 2 && stats.pages_retained <= 4);
+
+    /*pooled pages come back first*/
+    ptrs[0] = xcalloc_h(pg_family, 1);
+    mm_get_page_family_stats(pg_family, &stats);
+    assert(stats.pages_retained >= 1 && stats.pages_retained <= 3);
+    xfree(ptrs[0]);
+
+    /*decayed pages are unmapped by maintenance*/
+    mm_set_page_pool_decay(1);
+    usleep(20 * 1000);
+    mm_maintenance(0);
+    mm_set_page_pool_decay(0);
+    mm_get_page_family_stats(pg_family, &stats);
+    assert(stats.pages_retained == 0);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void *
+affinity_thread_fn(void *arg){
+
+    return xcalloc_h((mm_page_family_handle_t)arg, 1);
+}
+
+static void
+test_thread_affinity(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_affinity", sizeof(unit_t));
+    pthread_t thread;
+    void *ptr, *other;
+
+    assert(pg_family);
+    assert(mm_page_family_set_thread_affinity(pg_family, MM_TRUE) ==
+            pg_family);
+
+    /*blocks of two threads never share a page*/
+    ptr = xcalloc_h(pg_family, 1);
+    assert(pthread_create(&thread, NULL, affinity_thread_fn, pg_family) == 0);
+    assert(pthread_join(thread, &other) == 0);
+    assert(ptr && other);
+    assert(page_of(ptr) != page_of(other));
+
+    /*per thread families hold blocks now*/
+    assert(mm_page_family_set_thread_affinity(pg_family, MM_FALSE) == NULL);
+    assert(mm_page_family_set_thread_affinity(pg_family, MM_TRUE) ==
+            pg_family);
+
+    /*freed by a thread which did not allocate it*/
+    xfree(other);
+    xfree(ptr);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_snapshot(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_snapshot", sizeof(unit_t));
+    mm_heap_snapshot_t *snapshot, *read_back;
+    char path[256];
+    char *json;
+    void *ptrs[500];
+    uint32_t i, j;
+
+    assert(pg_family);
+    for(i = 0; i < 500; i++)
+        ptrs[i] = xcalloc_h(pg_family, 1 + i % 5);
+    for(i = 0; i < 500; i += 3)
+        xfree(ptrs[i]);
+
+    snapshot = mm_heap_snapshot_take();
+    assert(snapshot && snapshot->families_count > 0);
+
+    assert(mm_heap_snapshot_write_binary(snapshot,
+                tmp_path(path, sizeof(path), "snapshot.bin")) == MM_TRUE);
+    read_back = mm_heap_snapshot_read_binary(path);
+    assert(read_back);
+    assert(read_back->taken_at_ms == snapshot->taken_at_ms);
+    assert(read_back->page_size == snapshot->page_size);
+    assert(read_back->families_count == snapshot->families_count);
+    assert(read_back->pages_count == snapshot->pages_count);
+
+    for(i = 0; i < snapshot->families_count; i++){
+        mm_family_snapshot_t *family = &snapshot->families[i];
+        mm_family_snapshot_t *other = &read_back->families[i];
+
+        assert(strcmp(family->struct_name, other->struct_name) == 0);
+        assert(family->family_id == other->family_id);
+        assert(family->struct_size == other->struct_size);
+        assert(family->pages_count == other->pages_count);
+        assert(family->occupied_blocks == other->occupied_blocks);
+        assert(family->free_blocks == other->free_blocks);
+        assert(family->occupied_bytes == other->occupied_bytes);
+        assert(family->free_bytes == other->free_bytes);
+        assert(family->meta_bytes == other->meta_bytes);
+        assert(family->largest_free_block == other->largest_free_block);
+        assert(memcmp(family->free_block_histogram,
+                    other->free_block_histogram,
+                    sizeof(family->free_block_histogram)) == 0);
+        if(strcmp(family->struct_name, "test_snapshot") == 0){
+            assert(family->family_id == mm_page_family_get_id(pg_family));
+            assert(family->occupied_blocks == 500 - 167);
+        }
+    }
+    for(i = 0; i < snapshot->pages_count; i++){
+        mm_page_snapshot_t *page = &snapshot->pages[i];
+        mm_page_snapshot_t *other = &read_back->pages[i];
+
+        assert(page->address == other->address);
+        assert(page->page_type == other->page_type);
+        assert(page->occupied_bytes == other->occupied_bytes);
+        assert(page->free_bytes == other->free_bytes);
+        assert(page->meta_bytes == other->meta_bytes);
+        assert(page->largest_free_block == other->largest_free_block);
+        for(j = 0; j < MM_SNAPSHOT_HISTOGRAM_BUCKETS; j++){
+            assert(page->free_block_histogram[j] ==
+                    other->free_block_histogram[j]);
+        }
+    }
+    mm_heap_snapshot_free(read_back);
+
+    /*not a snapshot*/
+    assert(mm_heap_snapshot_read_binary(
+                tmp_path(path, sizeof(path), "missing.bin")) == NULL);
+
+    assert(mm_heap_snapshot_write_json(snapshot,
+                tmp_path(path, sizeof(path), "snapshot.json")) == MM_TRUE);
+    json = read_file(path);
+    assert(json[0] == '{');
+    assert(strstr(json, "\"struct_name\":\"test_snapshot\""));
+    free(json);
+
+    mm_heap_snapshot_free(snapshot);
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+static void
+test_profiler(){
+
+    mm_page_family_handle_t pg_family =
+        mm_instantiate_new_page_family("test_profiler", sizeof(unit_t));
+    char path[256];
+    char *profile;
+    void *ptrs[1000];
+    int i;
+
+    assert(pg_family);
+    /*sample about every allocation*/
+    assert(mm_profiler_start(16) == MM_TRUE);
+    for(i = 0; i < 1000; i++)
+        ptrs[i] = xcalloc_h(pg_family, 4);
+    mm_profiler_stop();
+
+    assert(mm_profiler_dump(tmp_path(path, sizeof(path), "heap.pprof"),
+                MM_PROFILE_PPROF) == MM_TRUE);
+    profile = read_file(path);
+    assert(strncmp(profile, "heap profile: ", 14) == 0);
+    /*the interval the samples were taken at, though stopped*/
+    assert(strstr(profile, "@ heap_v2/16\n"));
+    assert(strstr(profile, "MAPPED_LIBRARIES:"));
+    free(profile);
+
+    assert(mm_profiler_dump(tmp_path(path, sizeof(path), "heap.folded"),
+                MM_PROFILE_FOLDED) == MM_TRUE);
+    profile = read_file(path);
+    assert(strlen(profile) > 0 && strchr(profile, '\n'));
+    free(profile);
+
+    /*freed objects are no longer tracked*/
+    for(i = 0; i < 1000; i++)
+        xfree(ptrs[i]);
+    assert(mm_profiler_dump(tmp_path(path, sizeof(path), "empty.folded"),
+                MM_PROFILE_FOLDED) == MM_TRUE);
+    profile = read_file(path);
+    assert(profile[0] == '\0');
+    free(profile);
+
+    mm_profiler_reset();
+    assert(mm_unregister_page_family(pg_family) == MM_TRUE);
+}
+
+/*occupancy bins hold the pages with room for a unit, fuller pages in
+ * higher bins*/
+static void
+check_occupancy_bins(vm_page_family_t *vm_page_family){
+
+    vm_page_t *vm_page, *other;
+    block_meta_data_t *block_meta_data;
+    glthread_t *curr;
+    uint32_t i;
+
+    ITERATE_VM_PAGE_BEGIN(vm_page_family, vm_page){
+
+        uint32_t free_bytes = 0, largest_free = 0;
+
+        ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page, block_meta_data){
+            if(block_meta_data->is_free){
+                free_bytes += block_meta_data->block_size;
+                if(block_meta_data->block_size > largest_free)
+                    largest_free = block_meta_data->block_size;
+            }
+        } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page, block_meta_data);
+
+        assert(free_bytes == vm_page->free_bytes);
+        assert(largest_free <= vm_page->largest_free);
+        assert(MM_VM_PAGE_IN_OCCUPANCY_BIN(vm_page) ==
+                (vm_page->largest_free >= vm_page_family->struct_size));
+
+        ITERATE_VM_PAGE_BEGIN(vm_page_family, other){
+            if(MM_VM_PAGE_IN_OCCUPANCY_BIN(vm_page) &&
+                    MM_VM_PAGE_IN_OCCUPANCY_BIN(other) &&
+                    vm_page->free_bytes < other->free_bytes){
+                assert(vm_page->occupancy_bin >= other->occupancy_bin);
+            }
+        } ITERATE_VM_PAGE_END(vm_page_family, other);
+    } ITERATE_VM_PAGE_END(vm_page_family, vm_page);
+
+    for(i = 0; i < MM_OCCUPANCY_BINS; i++){
+        ITERATE_GLTHREAD_BEGIN(&vm_page_family->page_bins[i], curr){
+            assert(glthread_to_occupancy_vm_page(curr)->occupancy_bin == i);
+        } ITERATE_GLTHREAD_END(&vm_page_family->page_bins[i], curr);
+    }
+}
+
+static void
+test_occupancy_bins(){
+
+    vm_page_family_t *vm_page_family =
+        mm_instantiate_new_page_family("test_occupancy", 64);
+    void *ptrs[4096];
+    int page_index[4096];
+    uintptr_t pages[8];
+    int pages_count = 0, count = 0, i, j;
+
+    assert(vm_page_family);
+    assert(mm_page_family_get_placement_policy(vm_page_family) ==
+            MM_FULLEST_PAGE_FIT);
+
+    /*8 full pages, the fullest page with room is the last one*/
+    for(;;){
+        void *ptr = xcalloc_h(vm_page_family, 1);
+
+        assert(ptr && count < 4096);
+        if(!pages_count || page_of(ptr) != pages[pages_count - 1]){
+            if(pages_count == 8){
+                xfree(ptr);
+                break;
+            }
+            pages[pages_count++] = page_of(ptr);
+        }
+        page_index[count] = pages_count - 1;
+        ptrs[count++] = ptr;
+    }
+    check_occupancy_bins(vm_page_family);
+
+    /*even pages keep their first block only, odd ones lose one in four*/
+    for(i = 0; i < count; i++){
+        j = page_index[i];
+        if(j % 2 == 0 ? (i > 0 && page_index[i - 1] == j) : i % 4 == 0)
+            xfree(ptrs[i]);
+    }
+    check_occupancy_bins(vm_page_family);
+
+    /*allocations fill the holes of the fullest pages first*/
+    for(i = 0; i < 20; i++){
+        void *ptr = xcalloc_h(vm_page_family, 1);
+        for(j = 0; page_of(ptr) != pages[j]; j++);
+        assert(j % 2 == 1);
+    }
+    check_occupancy_bins(vm_page_family);
+    assert(mm_unregister_page_family(vm_page_family) == MM_TRUE);
+}
+
+int
+main(){
+
+    assert(mkdtemp(tmp_dir));
+    mm_init();
+
+    test_xrealloc();
+    test_arena();
+    test_batch();
+    test_unregister();
+    test_thread_cache_switch();
+    test_thread_affinity();
+    test_deferred_coalescing();
+    test_span_realloc();
+    test_placement_policies();
+    test_page_pool();
+    test_snapshot();
+    test_profiler();
+    test_occupancy_bins();
+
+    remove_tmp_dir();
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Unit tests of the C++ interface : page families of types whose names
+ * start alike, containers over mm::allocator, and families registered
+ * from C which do not fit the type.
+ */
+
+//the asserts are the tests, keep them in release builds
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <new>
+#include <unordered_map>
+#include <unordered_set>
+#include "mm_allocator.hpp"
+
+namespace {
+
+struct small_value { int value; };
+struct big_value { char bytes[64]; };
+
+//names of node types sharing the first 14 characters
+template<typename K, typename V>
+using mm_map = std::map<K, V, std::less<K>,
+      mm::allocator<std::pair<const K, V>>>;
+
+struct unfit { long words[4]; };
+struct misaligned { alignas(32) char bytes[32]; };
+
+} // namespace
+
+namespace mm {
+
+template<>
+struct family_traits<unfit> {
+    static const char *name() { return "test_unfit"; }
+    static void configure(mm_page_family_handle_t) {}
+};
+
+template<>
+struct family_traits<misaligned> {
+    static const char *name() { return "test_misaligned"; }
+    static void configure(mm_page_family_handle_t) {}
+};
+
+} // namespace mm
+
+static void
+test_family_names() {
+
+    using small_node = std::pair<const int, small_value>;
+    using big_node = std::pair<const int, big_value>;
+    char small_name[32], big_name[32];
+
+    mm::detail::family_name<small_node>(small_name, sizeof(small_name));
+    mm::detail::family_name<big_node>(big_name, sizeof(big_name));
+    assert(std::strcmp(small_name, big_name) != 0);
+
+    assert(mm::family<small_node>::handle() != mm::family<big_node>::handle());
+    assert(mm_page_family_get_struct_size(mm::family<small_node>::handle()) ==
+            sizeof(small_node));
+    assert(mm_page_family_get_struct_size(mm::family<big_node>::handle()) ==
+            sizeof(big_node));
+}
+
+static void
+test_maps() {
+
+    mm_map<int, small_value> small_map;
+    mm_map<int, big_value> big_map;
+
+    for(int i = 0; i < 10000; i++){
+        small_map[i].value = i;
+        std::memset(big_map[i].bytes, i & 0x7f, sizeof(big_value));
+    }
+    for(int i = 0; i < 10000; i++){
+        assert(small_map[i].value == i);
+        for(std::size_t j = 0; j < sizeof(big_value); j++)
+            assert(big_map[i].bytes[j] == (char)(i & 0x7f));
+    }
+    for(int i = 0; i < 10000; i += 2){
+        small_map.erase(i);
+        big_map.erase(i);
+    }
+    assert(small_map.size() == 5000 && big_map.size() == 5000);
+    assert(small_map.begin()->second.value == 1);
+}
+
+static void
+test_hash_containers() {
+
+    //bucket arrays are multi unit allocations of the same families as
+    //single nodes
+    std::unordered_set<int, std::hash<int>, std::equal_to<int>,
+        mm::allocator<int>> set;
+    std::unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+        mm::allocator<std::pair<const long, long>>> map;
+
+    set.reserve(10000);
+    for(int i = 0; i < 10000; i++){
+        set.insert(i);
+        map[i] = -i;
+    }
+    for(int i = 0; i < 10000; i++){
+        assert(set.count(i) == 1);
+        assert(map.at(i) == -i);
+    }
+    map.rehash(100000);
+    for(int i = 0; i < 10000; i++)
+        assert(map.at(i) == -i);
+}
+
+static void
+test_unique_ptr() {
+
+    auto ptr = mm::make<big_value>();
+    assert(ptr);
+    std::memset(ptr->bytes, 1, sizeof(ptr->bytes));
+    ptr.reset();
+}
+
+template<typename T>
+static bool
+rejected() {
+
+    try{
+        mm::allocator<T>().allocate(1);
+    }
+    catch(std::bad_alloc &){
+        return true;
+    }
+    return false;
+}
+
+static void
+test_unfit_families() {
+
+    mm::detail::init_once();
+    assert(mm_instantiate_new_page_family((char *)"test_unfit", 8));
+    assert(rejected<unfit>());
+
+    assert(mm_instantiate_new_page_family((char *)"test_misaligned",
+                sizeof(misaligned)));
+    assert(rejected<misaligned>());
+}
+
+int
+main() {
+
+    test_family_names();
+    test_maps();
+    test_hash_containers();
+    test_unique_ptr();
+    test_unfit_families();
+
+    std::printf("All tests passed\n");
+    return 0;
+}
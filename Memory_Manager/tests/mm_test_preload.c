@@ -0,0 +1,138 @@
+/*
+ * Unit tests of the malloc() interposition, not linked with the manager :
+ * ctest runs it with LD_PRELOAD=libmm_preload.so and it checks that the
+ * libc allocation functions resolve to the library and keep their contracts.
+ */
+
+//dladdr()
+#define _GNU_SOURCE
+/*the asserts are the tests, keep them in release builds*/
+#undef NDEBUG
+#include <assert.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void
+test_interposed(){
+
+    Dl_info info;
+    void *malloc_fn = dlsym(RTLD_DEFAULT, "malloc");
+
+    assert(malloc_fn);
+    assert(dladdr(malloc_fn, &info) && info.dli_fname);
+    if(!strstr(info.dli_fname, "mm_preload")){
+        printf("malloc() comes from %s, run with "
+                "LD_PRELOAD=libmm_preload.so\n", info.dli_fname);
+        exit(1);
+    }
+}
+
+static void
+test_sizes(){
+
+    /*size classes, large family blocks, spans and direct mappings*/
+    static const size_t sizes[] = {1, 8, 24, 100, 512, 4000, 20000,
+        100000, 4 << 20};
+    unsigned char *ptrs[sizeof(sizes) / sizeof(sizes[0])];
+    size_t i, j;
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+        ptrs[i] = malloc(sizes[i]);
+        assert(ptrs[i]);
+        assert((uintptr_t)ptrs[i] % 16 == 0);
+        assert(malloc_usable_size(ptrs[i]) >= sizes[i]);
+        memset(ptrs[i], (int)i, sizes[i]);
+    }
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+        for(j = 0; j < sizes[i]; j++)
+            assert(ptrs[i][j] == (unsigned char)i);
+        free(ptrs[i]);
+    }
+    free(NULL);
+}
+
+static void
+test_calloc(){
+
+    /*volatile, gcc warns about a constant product which overflows*/
+    volatile size_t count = SIZE_MAX / 2;
+    size_t i, j;
+
+    for(i = 1; i < 100000; i *= 3){
+        unsigned char *ptr = calloc(i, 7);
+        assert(ptr);
+        for(j = 0; j < i * 7; j++)
+            assert(ptr[j] == 0);
+        memset(ptr, 0xff, i * 7);
+        free(ptr);
+    }
+    /*overflowing count * size*/
+    assert(calloc(count, 4) == NULL);
+}
+
+static void
+test_realloc(){
+
+    unsigned char *ptr = realloc(NULL, 10), *grown;
+    size_t size, i;
+
+    assert(ptr);
+    for(i = 0; i < 10; i++)
+        ptr[i] = (unsigned char)i;
+
+    /*through every size class and back*/
+    for(size = 10; size < (8 << 20); size *= 2){
+        grown = realloc(ptr, size * 2);
+        assert(grown);
+        for(i = 0; i < 10; i++)
+            assert(grown[i] == (unsigned char)i);
+        ptr = grown;
+    }
+    ptr = realloc(ptr, 5);
+    assert(ptr);
+    for(i = 0; i < 5; i++)
+        assert(ptr[i] == (unsigned char)i);
+    free(ptr);
+}
+
+static void
+test_alignment(){
+
+    size_t alignment;
+    void *ptr;
+
+    for(alignment = sizeof(void *); alignment <= 8192; alignment *= 2){
+        assert(posix_memalign(&ptr, alignment, 100) == 0);
+        assert((uintptr_t)ptr % alignment == 0);
+        memset(ptr, 1, 100);
+        free(ptr);
+
+        ptr = aligned_alloc(alignment, alignment * 3);
+        assert(ptr && (uintptr_t)ptr % alignment == 0);
+        memset(ptr, 1, alignment * 3);
+        free(ptr);
+
+        ptr = memalign(alignment, 24);
+        assert(ptr && (uintptr_t)ptr % alignment == 0);
+        free(ptr);
+    }
+    /*not a power of 2*/
+    assert(posix_memalign(&ptr, 24, 100) != 0);
+}
+
+int
+main(){
+
+    test_interposed();
+    test_sizes();
+    test_calloc();
+    test_realloc();
+    test_alignment();
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -6,32 +6,435 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//enumeration for data type true and false
+typedef enum{
+
+    MM_FALSE,
+    MM_TRUE
+} vm_bool_t;
+
+//opaque handle to a registered page family, returned by MM_REG_STRUCT()
+struct vm_page_family_;
+typedef struct vm_page_family_ *mm_page_family_handle_t;
+
+//how a page family picks the free block to allocate from
+typedef enum{
+
+    MM_WORST_FIT,   /*biggest free block*/
+    MM_BEST_FIT,    /*smallest free block which fits*/
+    MM_FIRST_FIT,   /*lowest addressed free block which fits*/
+    MM_NEXT_FIT,    /*first block which fits after the last allocation*/
+    MM_FULLEST_PAGE_FIT /*free block of the fullest page it fits in(default)*/
+} mm_placement_policy_t;
+
 void *
 xcalloc(char *struct_name, int units);
+void *
+xcalloc_h(mm_page_family_handle_t pg_family, int units);
+//ignores objects of an arena
 void xfree(void *ptr);
 
+//same as xcalloc() but the memory is not zeroed, for callers which
+//initialize all of it themselves
+void *
+xmalloc(char *struct_name, int units);
+void *
+xmalloc_h(mm_page_family_handle_t pg_family, int units);
+
 #define XCALLOC(units, struct_name) \
     (xcalloc(#struct_name, units))
 
+//fast path, skips the struct name lookup
+#define XCALLOC_H(handle, units) \
+    (xcalloc_h(handle, units))
+
+#define XMALLOC(units, struct_name) \
+    (xmalloc(#struct_name, units))
+
+#define XMALLOC_H(handle, units) \
+    (xmalloc_h(handle, units))
+
 #define XFREE(ptr)  \
     (xfree(ptr))
 
+//resizes a data block to units of its page family, in place when the block
+//can shrink or grow into a free neighbour, by moving it otherwise. Units
+//added are not initialized. Returns NULL, leaving the block as is, on failure
+void *
+xrealloc(void *ptr, int units);
+
+#define XREALLOC(ptr, units)    \
+    (xrealloc(ptr, units))
+
+//bytes of the data block the application may use, at least what was
+//allocated. 0 for objects of an arena, which have no meta block
+uint32_t
+mm_usable_size(void *ptr);
+
+//allocates n zeroed single units of the page family into out, carving many
+//data blocks per free block under one family lock. Returns n, or 0 when
+//out of memory in which case nothing stays allocated
+int
+xcalloc_batch(mm_page_family_handle_t pg_family, int n, void **out);
+
+//frees n data blocks of any page families, the ones of one page are merged
+//with their free neighbours together. Reorders ptrs by address
+void
+xfree_batch(void **ptrs, int n);
+
+#define XCALLOC_BATCH(handle, n, out) \
+    (xcalloc_batch(handle, n, out))
+
+#define XFREE_BATCH(ptrs, n)  \
+    (xfree_batch(ptrs, n))
+
+//objects of any page families allocated by bumping a pointer in pages of
+//the arena and released all together, they are not freed one by one.
+//An arena is used by one thread at a time
+typedef struct mm_arena_ mm_arena_t;
+
+mm_arena_t *
+mm_arena_create();
+
+void *
+xcalloc_in(mm_arena_t *arena, char *struct_name, int units);
+void *
+xcalloc_in_h(mm_arena_t *arena, mm_page_family_handle_t pg_family, int units);
+
+#define XCALLOC_IN(arena, units, struct_name)   \
+    (xcalloc_in(arena, #struct_name, units))
+
+#define XCALLOC_IN_H(arena, handle, units)  \
+    (xcalloc_in_h(arena, handle, units))
+
+//releases all the objects of the arena, its pages are kept for reuse
+void
+mm_arena_reset(mm_arena_t *arena);
+
+//releases all the objects and pages of the arena
+void
+mm_arena_destroy(mm_arena_t *arena);
+
 //Initialization Functions
 void
 mm_init();
 
-//Registration function
-void
+//Registration function, returns the handle of the new page family, NULL if
+//a page family of that name is registered already
+mm_page_family_handle_t
 mm_instantiate_new_page_family(
         char *struct_name,
         uint32_t struct_size);
 
+//handle of an already registered struct, NULL if not registered
+mm_page_family_handle_t
+mm_get_page_family_handle(char *struct_name);
+
 #define MM_REG_STRUCT(struct_name)  \
     (mm_instantiate_new_page_family(#struct_name, sizeof(struct_name)))
 
+//releases all the pages of a page family, blocks still allocated from it
+//included, and removes it from the registry. The handle must not be used by
+//any thread anymore. Fails if the family has objects in arenas
+vm_bool_t
+mm_unregister_page_family(mm_page_family_handle_t pg_family);
+
+#define MM_UNREG_STRUCT(struct_name)    \
+    (mm_unregister_page_family(mm_get_page_family_handle(#struct_name)))
+
+//id of a page family, the same for its whole life. A family registered
+//in the slot of an unregistered one gets another id, ids of unregistered
+//families name no family(until a slot is reused 4096 times)
+uint32_t
+mm_page_family_get_id(mm_page_family_handle_t pg_family);
+
+//NULL if no page family with that id is registered
+mm_page_family_handle_t
+mm_get_page_family_by_id(uint32_t family_id);
+
+//size of the struct the page family was registered with
+uint32_t
+mm_page_family_get_struct_size(mm_page_family_handle_t pg_family);
+
+//same as MM_REG_STRUCT(), named for call sites which keep the handle
+#define MM_REG_STRUCT_H(struct_name)    \
+    MM_REG_STRUCT(struct_name)
+
+//changes the placement policy of a page family at any time, returns the handle
+mm_page_family_handle_t
+mm_page_family_set_placement_policy(
+        mm_page_family_handle_t pg_family,
+        mm_placement_policy_t placement_policy);
+
+mm_placement_policy_t
+mm_page_family_get_placement_policy(mm_page_family_handle_t pg_family);
+
+//data blocks of the page family are aligned to alignment bytes, a power of
+//2 upto 64(pointer size by default). Only before the first allocation from
+//the family, returns NULL otherwise
+mm_page_family_handle_t
+mm_page_family_set_alignment(
+        mm_page_family_handle_t pg_family,
+        uint32_t alignment);
+
+uint32_t
+mm_page_family_get_alignment(mm_page_family_handle_t pg_family);
+
+//objects of a family registered with the cache line size as alignment
+//never share a cache line with each other
+#define MM_CACHE_LINE_SIZE  64
+
+#define MM_REG_STRUCT_ALIGNED(struct_name, alignment)  \
+    (mm_page_family_set_alignment(MM_REG_STRUCT(struct_name), alignment))
+
+//single unit allocations of a slab mode page family come from pages carved
+//into equal sized slots with no meta block, multi unit ones still use blocks
+mm_page_family_handle_t
+mm_page_family_set_slab_mode(
+        mm_page_family_handle_t pg_family,
+        vm_bool_t slab_mode);
+
+#define MM_REG_STRUCT_SLAB(struct_name)    \
+    (mm_page_family_set_slab_mode(MM_REG_STRUCT(struct_name), MM_TRUE))
+
+//single unit allocations and frees of the page family go through a magazine
+//of the calling thread and take the family lock only once per batch. Only
+//before the first allocation from the family, returns NULL otherwise
+mm_page_family_handle_t
+mm_page_family_set_thread_cache(
+        mm_page_family_handle_t pg_family,
+        vm_bool_t thread_cache);
+
+//every thread allocates from pages of its own, so blocks allocated by
+//different threads never share a page or a cache line. A block may still be
+//freed by any thread. Per thread copies take the configuration the family
+//has at the first allocation of each thread. Only before the first
+//allocation from the family, returns NULL otherwise
+mm_page_family_handle_t
+mm_page_family_set_thread_affinity(
+        mm_page_family_handle_t pg_family,
+        vm_bool_t thread_affinity);
+
+//xfree() only queues data blocks on a lock free list of the page family,
+//merging them with their neighbours is deferred to later allocations from
+//the family and to mm_maintenance(). Slab slots and spans are freed as usual
+mm_page_family_handle_t
+mm_page_family_set_deferred_coalescing(
+        mm_page_family_handle_t pg_family,
+        vm_bool_t deferred_coalescing);
+
+//coalesces upto budget deferred frees across all page families and unmaps
+//decayed pooled pages, returns the number of frees coalesced
+uint32_t
+mm_maintenance(uint32_t budget);
+
+//calls mm_maintenance(budget) every interval_ms from a background thread
+vm_bool_t
+mm_start_maintenance_thread(uint32_t interval_ms, uint32_t budget);
+
+void
+mm_stop_maintenance_thread();
+
+//hands the blocks cached by the calling thread back to their page families,
+//done automatically when the thread exits
+void
+mm_thread_cache_flush();
+
+//registers the struct with the given placement policy
+#define MM_REG_STRUCT_POLICY(struct_name, placement_policy)    \
+    (mm_page_family_set_placement_policy(MM_REG_STRUCT(struct_name), \
+        placement_policy))
+
+//counters of a page family, maintained in O(1) on every alloc and free
+typedef struct mm_page_family_stats_{
+
+    uint64_t bytes_in_use;      /*data bytes held by the application*/
+    uint64_t peak_bytes_in_use; /*includes blocks cached by threads*/
+    uint64_t blocks_in_use;
+    uint64_t pages_held;        /*system pages mapped for the family*/
+    uint64_t pages_retained;    /*empty pages in the page pool of the family*/
+    uint64_t alloc_count;
+    uint64_t free_count;
+    uint64_t bytes_zeroed;      /*memset by xcalloc, known zero memory is skipped*/
+    uint64_t pages_released;    /*system pages the family gave back, to a pool or the kernel*/
+    uint64_t pages_released_per_minute; /*over the last minute*/
+} mm_page_family_stats_t;
+
+void
+mm_get_page_family_stats(mm_page_family_handle_t pg_family,
+        mm_page_family_stats_t *stats);
+
+void
+mm_print_memory_usage_stats(mm_page_family_handle_t pg_family);
+
+//empty pages are retained in a pool of their page family and, past its
+//watermarks, in a global pool shared by all families before being unmapped.
+//high watermark 0 disables the pool
+mm_page_family_handle_t
+mm_page_family_set_page_pool(
+        mm_page_family_handle_t pg_family,
+        uint32_t high_watermark,
+        uint32_t low_watermark);
+
+void
+mm_set_global_page_pool(uint32_t high_watermark,
+        uint32_t low_watermark);
+
+//pages retained for longer than decay_ms are unmapped, 0 disables decay
+void
+mm_set_page_pool_decay(uint32_t decay_ms);
+
+//unmaps all the pages retained by the page pools
+void
+mm_page_pool_purge();
+
+//backing of the regions pages are carved from, applies to regions mapped
+//after the call. Hugetlb falls back to normal pages if none are reserved
+typedef enum{
+
+    MM_REGION_NORMAL_PAGES,
+    MM_REGION_TRANSPARENT_HUGE_PAGES,   /*madvise(MADV_HUGEPAGE)*/
+    MM_REGION_HUGETLB_PAGES             /*mmap(MAP_HUGETLB)*/
+} mm_region_backing_t;
+
+void
+mm_set_region_backing(mm_region_backing_t region_backing);
+
+/*Heap snapshot : per page family and per page occupancy and fragmentation,
+ * taken in one pass over all the pages. Bytes of a page add up as
+ * occupied + free + meta + hard fragmentation + page header*/
+
+//free block sizes are counted in power of 2 buckets, bucket i holds the
+//sizes from 2^i upto 2^(i+1) - 1
+#define MM_SNAPSHOT_HISTOGRAM_BUCKETS   32
+
+typedef enum{
+
+    MM_SNAPSHOT_PAGE_BLOCKS,    /*data blocks each guarded by a meta block*/
+    MM_SNAPSHOT_PAGE_SLAB,      /*equal sized slots*/
+    MM_SNAPSHOT_PAGE_SPAN,      /*one data block over several system pages*/
+    MM_SNAPSHOT_PAGE_ARENA      /*bump allocated objects of an arena*/
+} mm_snapshot_page_type_t;
+
+typedef struct mm_page_snapshot_{
+
+    uint64_t address;
+    uint32_t page_type;         /*mm_snapshot_page_type_t*/
+    uint32_t system_pages;
+    uint32_t occupied_blocks;
+    uint32_t free_blocks;
+    uint32_t occupied_bytes;
+    uint32_t free_bytes;
+    uint32_t meta_bytes;        /*meta blocks*/
+    uint32_t largest_free_block;
+    /*free blocks too small for one unit, left by a soft internal
+     * fragmentation split. Counted in free bytes too*/
+    uint32_t soft_internal_frag_bytes;
+    /*bytes too small for a meta block left behind allocated blocks, and
+     * the unused tails of slab pages and spans*/
+    uint32_t hard_internal_frag_bytes;
+    uint16_t free_block_histogram[MM_SNAPSHOT_HISTOGRAM_BUCKETS];
+    /*1 - largest free block / free bytes, 0 when all the free memory is
+     * one block*/
+    double external_frag_index;
+} mm_page_snapshot_t;
+
+typedef struct mm_family_snapshot_{
+
+    char struct_name[32];
+    uint32_t family_id;
+    uint32_t struct_size;
+    uint32_t pages_count;       /*page snapshots of the family*/
+    uint32_t pages_retained;    /*empty pages in the page pool of the family*/
+    uint64_t system_pages;
+    uint64_t cached_blocks;     /*occupied blocks held by thread caches*/
+    uint64_t occupied_blocks;
+    uint64_t free_blocks;
+    uint64_t occupied_bytes;
+    uint64_t free_bytes;
+    uint64_t meta_bytes;
+    uint64_t largest_free_block;
+    uint64_t soft_internal_frag_bytes;
+    uint64_t hard_internal_frag_bytes;
+    uint64_t free_block_histogram[MM_SNAPSHOT_HISTOGRAM_BUCKETS];
+    double external_frag_index;
+    mm_page_snapshot_t *pages;  /*pages of the per thread families included*/
+} mm_family_snapshot_t;
+
+typedef struct mm_heap_snapshot_{
+
+    uint64_t taken_at_ms;       /*wall clock, ms since the epoch*/
+    uint64_t size;              /*bytes of the snapshot in memory*/
+    uint32_t page_size;
+    uint32_t families_count;
+    uint32_t pages_count;
+    mm_family_snapshot_t *families;
+    mm_page_snapshot_t *pages;  /*pages of all the families, family by family*/
+} mm_heap_snapshot_t;
+
+//snapshot of every registered page family, NULL if out of memory.
+//Coalesces the pending frees of deferred coalescing families
+mm_heap_snapshot_t *
+mm_heap_snapshot_take();
+
+void
+mm_heap_snapshot_free(mm_heap_snapshot_t *snapshot);
+
+//NULL path writes JSON to stdout
+vm_bool_t
+mm_heap_snapshot_write_json(mm_heap_snapshot_t *snapshot, char *path);
+
+//compact little endian encoding, histograms hold their non zero buckets only
+vm_bool_t
+mm_heap_snapshot_write_binary(mm_heap_snapshot_t *snapshot, char *path);
+
+//snapshot written by mm_heap_snapshot_write_binary(), NULL if the file can
+//not be read or is not one. Free it with mm_heap_snapshot_free()
+mm_heap_snapshot_t *
+mm_heap_snapshot_read_binary(char *path);
+
+/*Sampling heap profiler : about one allocation in every sample_bytes bytes
+ * allocated, at geometrically distributed intervals, gets its stack trace
+ * recorded and is tracked till it is freed. Objects of arenas are not
+ * sampled*/
+typedef enum{
+
+    MM_PROFILE_PPROF,   /*heap_v2 legacy heap profile, read by pprof*/
+    MM_PROFILE_FOLDED   /*"root;...;site bytes" lines for flame graphs*/
+} mm_profile_format_t;
+
+#define MM_PROFILE_DEFAULT_SAMPLE_BYTES (512 * 1024)
+
+//starts sampling or changes the sampling interval
+vm_bool_t
+mm_profiler_start(uint64_t sample_bytes);
+
+//stops sampling, objects sampled already stay tracked till freed
+void
+mm_profiler_stop();
+
+//stops sampling and forgets all the samples
+void
+mm_profiler_reset();
+
+//profile of the sampled objects not freed yet, with estimated live bytes
+//for folded stacks. NULL path writes to stdout
+vm_bool_t
+mm_profiler_dump(char *path, mm_profile_format_t format);
+
 void mm_print_memory_usage(char *struct_name);
 void mm_print_registered_page_families();
 void mm_print_block_usage();
+//reports data blocks of every page family which were never freed
+void mm_check_for_leaks();
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* __UAPI_MM__ */
 